@@ -0,0 +1,219 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# Runs bin/bb_load against bin/bb once per scenario and prints one JSON line
+# per run, tagged with the commit, so runs of two commits can be compared:
+#
+#   make bench BENCH_ARGS="-o before.json"
+#   make bench BENCH_ARGS="-o after.json"
+#   ./bench/bench.sh -C before.json after.json
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+SECS=5         # Seconds per scenario.
+THREADS=2      # Load generator threads.
+OUT=           # Also append the results to this file.
+ONLY=          # Only scenarios whose label matches this regex.
+PORT=8080      # bb listens here.
+
+#------------------------------------------------------------------------------
+# Scenarios: label | bb options | bb_load options [| bb_load wrapper]
+#
+# The skew-* ones keep the load generator on CPU 0, so every SYN comes in
+# there and the reuseport steering hands all the connections to core 0.
+#
+# The burst-* ones block 2ms per request in the handler, as on a backend,
+# and step the rate up 6x for half a second out of every 1.5s: a fixed pool
+# is too small for the bursts or too big for a CPU-bound handler, elastic
+# should be close to the best fixed one in both.
+#
+# The overload-* ones offer 8 such threads (4000 req/s at most, some 3500
+# with the load generator on the same CPU) their saturation load and
+# twice that: without shedding the queue and the latencies grow for as long
+# as the run, with it the goodput (rps, 503s are counted apart) stays flat.
+#
+# The static-* ones serve files from WWW: a 4KB one from memory (req/s) and
+# a 256MB one with sendfile() (mbps, 8000 is 1 GB/s).
+#
+# The cache-* ones answer from the response cache (--cache) and go with
+# per-core (no cache) for the hit path, on one core and on all of them
+# (scaling), and with overload-1x for what a hit saves on a backend.
+#
+# The engine-* ones sweep the connection count for epoll and io_uring,
+# both per-core: batching grows with the ready clients per round.
+#
+# The connect-storm* ones open a connection per request (churn 1) from 500
+# at a time: cps is the accept rate, connect_p50/p99/p999_us the time from
+# connect() to the first response byte (handshake, accept queue, answer).
+#
+# The conns-* ones hold 1k, 10k and 100k keep-alive connections, shared
+# against per-core. Both processes need that many descriptors: the soft
+# limit is raised to the hard one (ulimit -Hn), scenarios that do not fit
+# are skipped with a note (raise it, e.g. prlimit or limits.conf). bb_load
+# spreads loopback connections over 127.0.0.2 on, 20000 per address.
+#------------------------------------------------------------------------------
+
+BLOCK=$PWD/bin/bb_block.so
+WWW=${TMPDIR:-/tmp}/bb-bench-www.$$
+
+SCENARIOS=(
+  "shared|                          |-c 50"
+  "data-threads-4|--data-threads=4  |-c 50"
+  "data-threads-64|--data-threads=64|-c 50"
+  "epoll-events-10|--epoll-events=10|-c 200"
+  "epoll-events-256|--epoll-events=256|-c 200"
+  "tcp-nodelay|--tcp-nodelay        |-c 50"
+  "reuseport|--reuseport            |-c 50"
+  "per-core|--mode=per-core --reuseport|-c 50"
+  "uring|--mode=per-core --reuseport --engine=uring|-c 50"
+  "engine-epoll-50|--mode=per-core --reuseport|-c 50"
+  "engine-uring-50|--mode=per-core --reuseport --engine=uring|-c 50"
+  "engine-epoll-500|--mode=per-core --reuseport|-c 500"
+  "engine-uring-500|--mode=per-core --reuseport --engine=uring|-c 500"
+  "engine-epoll-5000|--mode=per-core --reuseport|-c 5000"
+  "engine-uring-5000|--mode=per-core --reuseport --engine=uring|-c 5000"
+  "pipeline-16|--mode=per-core      |-c 50 -d 16"
+  "large-request|                   |-c 50 -s 4096"
+  "open-loop|--mode=per-core        |-c 50 -R 20000"
+  "churn|                           |-c 50 -k 1"
+  "low-rate|                        |-c 10 -R 1000"
+  "low-rate-busy-poll|--busy-poll=50|-c 10 -R 1000"
+  "mid-rate|                        |-c 50 -R 20000"
+  "mid-rate-busy-poll|--busy-poll=50|-c 50 -R 20000"
+  "low-rate-per-core|--mode=per-core|-c 10 -R 1000"
+  "low-rate-per-core-busy-poll|--mode=per-core --busy-poll=50|-c 10 -R 1000"
+  "mid-rate-per-core|--mode=per-core|-c 50 -R 20000"
+  "mid-rate-per-core-busy-poll|--mode=per-core --busy-poll=50|-c 50 -R 20000"
+  "skew-shared|--reuseport          |-c 200 -d 4|taskset -c 0"
+  "skew-per-core|--mode=per-core --reuseport|-c 200 -d 4|taskset -c 0"
+  "skew-steal|--mode=steal --reuseport|-c 200 -d 4|taskset -c 0"
+  "elastic|--data-threads=2-64      |-c 50"
+  "burst-data-threads-4|--data-threads=4 --handler=$BLOCK|-c 100 -P 1000:1,6000:0.5"
+  "burst-data-threads-16|--data-threads=16 --handler=$BLOCK|-c 100 -P 1000:1,6000:0.5"
+  "burst-data-threads-64|--data-threads=64 --handler=$BLOCK|-c 100 -P 1000:1,6000:0.5"
+  "burst-elastic|--data-threads=2-64 --handler=$BLOCK|-c 100 -P 1000:1,6000:0.5"
+  "overload-1x|--data-threads=8 --handler=$BLOCK|-c 200 -R 3500"
+  "overload-2x|--data-threads=8 --handler=$BLOCK|-c 200 -R 7000"
+  "overload-2x-shed|--data-threads=8 --handler=$BLOCK --shed=5|-c 200 -R 7000"
+  "static-small|--mode=per-core --handler=static:$WWW|-c 50 -u /small.html"
+  "static-small-pipeline-16|--mode=per-core --handler=static:$WWW|-c 50 -d 16 -u /small.html"
+  "static-large|--mode=per-core --handler=static:$WWW|-c 8 -u /large.bin"
+  "static-large-uring|--mode=per-core --reuseport --engine=uring --handler=static:$WWW|-c 8 -u /large.bin"
+  "cache-1-core|--mode=per-core --cpus=0 --cache=64|-c 50"
+  "cache|--mode=per-core --reuseport --cache=64|-c 50"
+  "cache-pipeline-16|--mode=per-core --cache=64|-c 50 -d 16"
+  "cache-block|--data-threads=8 --handler=$BLOCK --cache=64|-c 200 -R 3500"
+  "connect-storm|--reuseport       |-c 500 -k 1"
+  "connect-storm-per-core|--mode=per-core --reuseport|-c 500 -k 1"
+  "conns-1k-shared|--max-connections=131072|-c 1000"
+  "conns-1k-per-core|--mode=per-core --reuseport --max-connections=131072|-c 1000"
+  "conns-10k-shared|--max-connections=131072|-c 10000"
+  "conns-10k-per-core|--mode=per-core --reuseport --max-connections=131072|-c 10000"
+  "conns-100k-shared|--max-connections=131072|-c 100000"
+  "conns-100k-per-core|--mode=per-core --reuseport --max-connections=131072|-c 100000"
+)
+
+#------------------------------------------------------------------------------
+# compare: rps and p99 of two result files, by label.
+#------------------------------------------------------------------------------
+
+compare() {
+  awk '
+    function val(k,   v) { if (!match($0, "\"" k "\":\"?[^,\"}]*")) return ""; v = substr($0, RSTART, RLENGTH); sub(/^"[^"]*":"?/, "", v); return v }
+    FNR == 1 { f++ }
+    { l = val("label"); rps[f, l] = val("rps"); p99[f, l] = val("p99_us"); if (f == 1) order[++n] = l }
+    END {
+      printf "%-28s %12s %12s %8s %10s %10s %8s\n", "label", "rps A", "rps B", "delta", "p99 A", "p99 B", "delta"
+      for (i = 1; i <= n; i++) {
+        l = order[i]; if (!((2, l) in rps)) continue
+        printf "%-28s %12d %12d %+7.1f%% %10.1f %10.1f %+7.1f%%\n", l, rps[1, l], rps[2, l],
+          rps[1, l] ? 100 * (rps[2, l] - rps[1, l]) / rps[1, l] : 0, p99[1, l], p99[2, l],
+          p99[1, l] ? 100 * (p99[2, l] - p99[1, l]) / p99[1, l] : 0
+      }
+    }' "$1" "$2"
+}
+
+#------------------------------------------------------------------------------
+# Options:
+#------------------------------------------------------------------------------
+
+while getopts "T:t:o:s:C" opt; do
+  case $opt in
+    T) SECS=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    s) ONLY=$OPTARG ;;
+    C) shift $((OPTIND - 1)); compare "$1" "$2"; exit ;;
+    *) echo "usage: $0 [-T secs] [-t threads] [-o file] [-s regex] | -C a.json b.json" >&2; exit 1 ;;
+  esac
+done
+
+[ -x bin/bb ] && [ -x bin/bb_load ] || { echo "run make bench" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+# Descriptors for the conns-* ones:
+ulimit -n "$(ulimit -Hn)" 2>/dev/null
+FDS=$(ulimit -n)
+
+# Files for the static-* ones:
+mkdir -p "$WWW" && trap 'rm -rf "$WWW"' EXIT
+head -c 4096 /dev/urandom | base64 -w 76 | head -c 4096 > "$WWW/small.html"
+head -c 256M /dev/zero > "$WWW/large.bin"
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+git diff --quiet HEAD 2>/dev/null || COMMIT="$COMMIT-dirty"
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+for s in "${SCENARIOS[@]}"; do
+  IFS='|' read -r label opts load wrap <<< "$s"
+  [ -n "$ONLY" ] && ! [[ $label =~ $ONLY ]] && continue
+
+  # Connections and a margin for everything else:
+  conns=$(sed -n 's/.*-c \([0-9]*\).*/\1/p' <<< "$load")
+  if [ "$FDS" != unlimited ] && [ $((${conns:-0} + 1024)) -gt "$FDS" ]; then
+    echo "$label: skipped, needs $((conns + 1024)) descriptors, the limit is $FDS" >&2
+    continue
+  fi
+
+  # bb daemonizes, wait for its listener:
+  ./bin/bb $opts || { echo "$label: bb failed to start" >&2; continue; }
+  for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+  pid=$(pgrep -n -x bb)
+
+  line=$($wrap ./bin/bb_load -t "$THREADS" -T "$SECS" -l "$label" $load)
+  kill "$pid" 2>/dev/null
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+
+  line="{\"commit\":\"$COMMIT\",\"server\":\"$(echo $opts)\",${line#\{}"
+  echo "$line"
+  [ -n "$OUT" ] && echo "$line" >> "$OUT"
+done
@@ -0,0 +1,81 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# Zero-downtime reload check: keeps bin/bb_load running against bin/bb while
+# the server is sent SIGUSR2 (RELOADS times), then SIGTERM. Passes when no
+# request failed and a new process took over every time:
+#
+#   make bench BENCH_ARGS="-s none" && ./bench/reload.sh --mode=per-core
+#
+# Extra arguments go to bb, both the old and the new process run with them.
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+SECS=8         # Load duration.
+RELOADS=3      # SIGUSR2 sent, evenly spread.
+CONNS=50       # Load generator connections.
+PORT=8080      # bb listens here.
+
+[ -x bin/bb ] && [ -x bin/bb_load ] || { echo "run make bench" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+# bb daemonizes, wait for its listener:
+./bin/bb "$@" || { echo "bb failed to start" >&2; exit 1; }
+for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+pid=$(pgrep -n -x bb)
+out=$(mktemp)
+./bin/bb_load -t 2 -c "$CONNS" -T "$SECS" -l reload > "$out" &
+load=$!
+
+# Each reload hands the listeners over, the old process drains and exits:
+fail=0
+for r in $(seq "$RELOADS"); do
+  sleep "$(awk "BEGIN { print $SECS / ($RELOADS + 1) }")"
+  kill -USR2 "$pid"
+  for i in $(seq 100); do kill -0 "$pid" 2>/dev/null || break; sleep 0.1; done
+  kill -0 "$pid" 2>/dev/null && { echo "reload $r: old process $pid still running" >&2; fail=1; break; }
+  new=$(pgrep -n -x bb)
+  [ -z "$new" ] && { echo "reload $r: no new process" >&2; fail=1; break; }
+  echo "reload $r: $pid -> $new" >&2
+  pid=$new
+done
+
+wait "$load"
+kill -TERM "$pid"
+while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+
+line=$(cat "$out"); rm -f "$out"
+echo "$line"
+errs=$(echo "$line" | sed -n 's/.*"errors":\([0-9]*\).*/\1/p')
+[ "$fail" = 0 ] && [ "$errs" = 0 ] && [ -n "$line" ] || { echo "FAIL" >&2; exit 1; }
+echo "PASS" >&2
@@ -0,0 +1,107 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# TLS against plaintext with a throwaway self-signed certificate, bin/bb
+# built with make TLS=1. Prints one JSON line per run:
+#
+#   handshakes-*  new connections per second from CLIENTS clients: full TLS
+#                 handshakes (openssl s_time -new), plain TCP connections
+#                 with one request each for plaintext (bb_load -k 1).
+#   bulk-*        MB/s of CLIENTS clients fetching a 256MB file each (curl),
+#                 sent with sendfile() (by the kernel through kTLS, or read
+#                 in and encrypted in userspace without it).
+#
+#   make bench BENCH_ARGS="-s none" && make TLS=1 && ./bench/tls.sh
+#
+# Extra arguments go to bb. "ktls" is bb_ktls_total out of the handshakes:
+# 0 means the kernel has no tls module (modprobe tls) or did not take the
+# cipher, and userspace did the encryption.
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+SECS=5         # Seconds per handshake run.
+CLIENTS=4      # Concurrent clients.
+PORT=8080      # bb listens here.
+
+[ -x bin/bb ] && [ -x bin/bb_load ] || { echo "run make bench" >&2; exit 1; }
+command -v openssl > /dev/null && command -v curl > /dev/null || { echo "needs openssl and curl" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+TMP=$(mktemp -d) && trap 'rm -rf "$TMP"' EXIT
+openssl req -x509 -newkey rsa:2048 -nodes -keyout "$TMP/key.pem" -out "$TMP/cert.pem" -days 1 -subj /CN=localhost 2> /dev/null || exit 1
+head -c 256M /dev/zero > "$TMP/large.bin"
+
+#------------------------------------------------------------------------------
+# start: run bb with the arguments given, wait for its listener.
+# stop: SIGTERM it and wait until it is gone.
+# metric: a counter from the admin socket, summed over every core.
+#------------------------------------------------------------------------------
+
+start() {
+  ./bin/bb "$@" --admin="$TMP/admin.sock" || { echo "bb failed to start (built with make TLS=1?)" >&2; exit 1; }
+  for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+  pid=$(pgrep -n -x bb)
+}
+
+stop() {
+  kill -TERM "$pid"
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+}
+
+metric() {
+  curl -s --unix-socket "$TMP/admin.sock" http://bb/metrics | awk -v m="$1" '$1 ~ "^" m "[{ ]" { n += $2 } END { print n + 0 }'
+}
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+# Handshakes, each s_time client connects one after another:
+start --tls="$TMP/cert.pem:$TMP/key.pem" "$@"
+for c in $(seq "$CLIENTS"); do openssl s_time -connect 127.0.0.1:$PORT -new -time "$SECS" > "$TMP/st.$c" 2>&1 & done
+wait
+n=$(cat "$TMP"/st.* | awk '/connections in .* real seconds/ { n += $1 } END { print n + 0 }')
+echo "{\"label\":\"handshakes-tls\",\"server\":\"$*\",\"clients\":$CLIENTS,\"rate\":$((n / SECS)),\"ktls\":$(metric bb_ktls_total),\"handshakes\":$(metric bb_tls_handshakes_total)}"
+stop
+
+start "$@"
+n=$(./bin/bb_load -t 2 -c "$CLIENTS" -T "$SECS" -k 1 -l churn | sed -n 's/.*"rps":\([0-9]*\).*/\1/p')
+echo "{\"label\":\"handshakes-plain\",\"server\":\"$*\",\"clients\":$CLIENTS,\"rate\":$n}"
+stop
+
+# Bulk, the same file over both:
+for proto in tls plain; do
+  if [ $proto = tls ]; then start --tls="$TMP/cert.pem:$TMP/key.pem" --handler=static:"$TMP" "$@"; url=https; else start --handler=static:"$TMP" "$@"; url=http; fi
+  t=$(date +%s.%N)
+  for c in $(seq "$CLIENTS"); do curl -sk "$url://127.0.0.1:$PORT/large.bin" -o /dev/null & done
+  wait
+  mbs=$(awk -v t="$t" -v n="$CLIENTS" -v now="$(date +%s.%N)" 'BEGIN { printf "%.1f", n * 256 / (now - t) }')
+  echo "{\"label\":\"bulk-$proto\",\"server\":\"$*\",\"clients\":$CLIENTS,\"mbps\":$mbs$([ $proto = tls ] && echo ",\"ktls\":$(metric bb_ktls_total)")}"
+  stop
+done
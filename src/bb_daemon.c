@@ -33,6 +33,7 @@ void daemonize(void)
 
 {
     pid_t pid;
+    int fd;
 
     // Already a daemon:
     if(getppid() == 1) return;
@@ -46,8 +47,90 @@ void daemonize(void)
     if(setsid() < 0) exit(1);
     if((chdir("/")) < 0) exit(1);
 
-    // Close the std file descriptors:
-    close(STDIN_FILENO);
-    close(STDOUT_FILENO);
-    close(STDERR_FILENO);
+    // Point the std file descriptors to /dev/null, closed they would be
+    // reused by sockets that a reload's new process closes again:
+    if((fd = open("/dev/null", O_RDWR)) < 0) exit(1);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if(fd > STDERR_FILENO) close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// sendfds: pass n descriptors over a SOCK_SEQPACKET socket, FDS_CHUNK per
+// message. Each one carries how many are still to come, returns -1 on error.
+//-----------------------------------------------------------------------------
+
+int sendfds(int sock, const int *fds, int n)
+
+{
+    int k, left = n;
+    char cbuf[CMSG_SPACE(FDS_CHUNK * sizeof(int))];
+    struct iovec iov = { &left, sizeof(left) };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    do
+
+    {
+        k = left < FDS_CHUNK ? left : FDS_CHUNK;
+        left -= k;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if(k > 0)
+
+        {
+            msg.msg_control = cbuf;
+            msg.msg_controllen = CMSG_SPACE(k * sizeof(int));
+            cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(k * sizeof(int));
+            memcpy(CMSG_DATA(cm), fds + n - left - k, k * sizeof(int));
+        }
+
+        if(sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(left)) return -1;
+    }
+
+    while(left > 0);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// recvfds: descriptors sent by sendfds (close-on-exec), the ones past max
+// are closed. Returns how many were kept or -1 on error.
+//-----------------------------------------------------------------------------
+
+int recvfds(int sock, int *fds, int max)
+
+{
+    int i, k, fd, n = 0, left;
+    char cbuf[CMSG_SPACE(FDS_CHUNK * sizeof(int))];
+    struct iovec iov = { &left, sizeof(left) };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    do
+
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(left)) return -1;
+
+        for(cm=CMSG_FIRSTHDR(&msg); cm; cm=CMSG_NXTHDR(&msg, cm))
+
+        {
+            if(cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+            k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(i=0; i<k; i++){memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int)); if(n < max) fds[n++] = fd; else close(fd);}
+        }
+    }
+
+    while(left > 0);
+    return n;
 }
@@ -34,12 +34,23 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define FDS_CHUNK 64    // Descriptors per message (SCM_MAX_FD is 253).
 
 //-----------------------------------------------------------------------------
 // Prototypes:
 //-----------------------------------------------------------------------------
 
 void daemonize(void);
+int sendfds(int sock, const int *fds, int n);
+int recvfds(int sock, int *fds, int max);
 
 //-----------------------------------------------------------------------------
 // End of include guard:
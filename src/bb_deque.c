@@ -0,0 +1,167 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "bb_deque.h"
+
+//-----------------------------------------------------------------------------
+// Chase-Lev work-stealing deque, bounded. Its owner pushes at the bottom
+// without atomics read-modify-write, everybody else takes from the top with
+// a CAS, oldest first. The owner (a Wait-Worker) never consumes, so there
+// is no owner pop and no race on the last element to settle. Consumers of
+// the owning core park on the futex, bb_deque_wake() calls them back.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// bb_deque_new:
+//-----------------------------------------------------------------------------
+
+int bb_deque_new(PDEQUE d, size_t size)
+
+{
+    long cap = 2;
+
+    while(cap < size) cap <<= 1;
+    if((d->buf = aligned_alloc(CACHELINE, cap * sizeof(void *))) == NULL) return -1;
+
+    d->mask = cap - 1;
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->top, 0);
+    atomic_init(&d->wake, 0);
+    atomic_init(&d->idle, 0);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_len: pointers queued, a snapshot for monitoring only.
+//-----------------------------------------------------------------------------
+
+size_t bb_deque_len(PDEQUE d)
+
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    return b > t ? b - t : 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_push: owner only, returns -1 when the deque is full.
+//-----------------------------------------------------------------------------
+
+int bb_deque_push(PDEQUE d, void *cptr)
+
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if(b - t > d->mask) return -1;
+    atomic_store_explicit(&d->buf[b & d->mask], cptr, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_steal: oldest pointer or NULL when the deque is empty.
+//-----------------------------------------------------------------------------
+
+void *bb_deque_steal(PDEQUE d)
+
+{
+    long t, b;
+    void *cptr;
+
+    while(1)
+
+    {
+        t = atomic_load_explicit(&d->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+        if(t >= b) return NULL;
+
+        // The slot is only reused once top has moved past it, so a stale
+        // read is caught by the CAS:
+        cptr = atomic_load_explicit(&d->buf[t & d->mask], memory_order_relaxed);
+        if(atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+           memory_order_seq_cst, memory_order_relaxed)) return cptr;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_idle: announce a consumer about to park, returns what it has to
+// pass to bb_deque_park() after looking for work one last time.
+//-----------------------------------------------------------------------------
+
+unsigned int bb_deque_idle(PDEQUE d)
+
+{
+    unsigned int wake = atomic_load_explicit(&d->wake, memory_order_acquire);
+
+    atomic_fetch_add_explicit(&d->idle, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    return wake;
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_park: sleep unless woken since bb_deque_idle() or the last look
+// found something, the consumer is busy again afterwards.
+//-----------------------------------------------------------------------------
+
+void bb_deque_park(PDEQUE d, unsigned int wake, void *found)
+
+{
+    if(found == NULL) syscall(SYS_futex, &d->wake, FUTEX_WAIT_PRIVATE, wake, NULL, NULL, 0);
+    atomic_fetch_sub_explicit(&d->idle, 1, memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_wake: call a parked consumer back, returns 0 if none was idle.
+//-----------------------------------------------------------------------------
+
+int bb_deque_wake(PDEQUE d)
+
+{
+    // Pairs with the fence in bb_deque_idle(), only syscall if someone sleeps:
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&d->idle, memory_order_relaxed) <= 0) return 0;
+
+    atomic_fetch_add_explicit(&d->wake, 1, memory_order_release);
+    syscall(SYS_futex, &d->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_deque_free:
+//-----------------------------------------------------------------------------
+
+void bb_deque_free(PDEQUE d)
+
+{
+    free(d->buf);
+    d->buf = NULL;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_DEQUE_
+#define _BB_DEQUE_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "bb_fifo.h"
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _DEQUE
+
+{
+    _Atomic(void *) *buf;    // Power of two array of pointers.
+    long            mask;    // Capacity minus one.
+
+    atomic_long     bottom __attribute__((aligned(CACHELINE)));  // Owner end.
+    atomic_long     top __attribute__((aligned(CACHELINE)));     // Steal end.
+    atomic_uint     wake __attribute__((aligned(CACHELINE)));    // Futex.
+    atomic_int      idle;                                        // Parked.
+}
+
+DEQUE, *PDEQUE;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_deque_new(PDEQUE d, size_t size);
+size_t bb_deque_len(PDEQUE d);
+int bb_deque_push(PDEQUE d, void *cptr);
+void *bb_deque_steal(PDEQUE d);
+unsigned int bb_deque_idle(PDEQUE d);
+void bb_deque_park(PDEQUE d, unsigned int wake, void *found);
+int bb_deque_wake(PDEQUE d);
+void bb_deque_free(PDEQUE d);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,47 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include "bb_handler.h"
+
+//-----------------------------------------------------------------------------
+// echo_data: send back whatever was received.
+//-----------------------------------------------------------------------------
+
+static int echo_data(PCLIENT cptr, char *buff, int len)
+
+{
+    if(bb_send(cptr, buff, len) < 0) return -1;
+    return len;
+}
+
+//-----------------------------------------------------------------------------
+// Handler:
+//-----------------------------------------------------------------------------
+
+HANDLER bb_echo = { .name = "echo", .on_data = echo_data };
+
+#ifdef BB_PLUGIN
+extern HANDLER bb_handler __attribute__((alias("bb_echo")));
+#endif
@@ -0,0 +1,474 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <linux/openat2.h>
+#include "bb_fcache.h"
+
+//-----------------------------------------------------------------------------
+// Open-file cache for the static handler. Entries live in a fixed array of
+// slots and are found through a set-associative index of single words, so
+// a lookup is a few loads and one CAS on the entry: pinning only succeeds
+// for the generation the index word names and while it is not retired.
+// Slots are recycled, never freed, once the last pin of a retired entry is
+// gone. Writers (misses, the CLOCK eviction and W_Notify, which retires
+// what inotify says changed) take the lock.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static const char *types[][2] = {
+    { "html", "text/html; charset=UTF-8" },  { "htm", "text/html; charset=UTF-8" },
+    { "css", "text/css" },                   { "js", "text/javascript" },
+    { "json", "application/json" },         { "txt", "text/plain; charset=UTF-8" },
+    { "xml", "application/xml" },           { "svg", "image/svg+xml" },
+    { "png", "image/png" },                 { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },               { "gif", "image/gif" },
+    { "webp", "image/webp" },               { "ico", "image/x-icon" },
+    { "woff2", "font/woff2" },              { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },           { "mp4", "video/mp4" }};
+
+//-----------------------------------------------------------------------------
+// hash: FNV-1a.
+//-----------------------------------------------------------------------------
+
+static unsigned int hash(const char *p)
+
+{
+    unsigned int h = 2166136261u;
+
+    while(*p) h = (h ^ (unsigned char)*p++) * 16777619u;
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+// type: Content-Type by extension.
+//-----------------------------------------------------------------------------
+
+static const char *type(const char *path)
+
+{
+    int i;
+    const char *x = strrchr(path, '.');
+
+    if(x == NULL || strchr(x, '/')) return "application/octet-stream";
+    for(i=0; i<sizeof(types)/sizeof(types[0]); i++) if(!strcasecmp(x + 1, types[i][0])) return types[i][1];
+    return "application/octet-stream";
+}
+
+//-----------------------------------------------------------------------------
+// pin: hold e if it still is generation gen, -1 if it went meanwhile.
+//-----------------------------------------------------------------------------
+
+static int pin(PFENT e, unsigned long gen)
+
+{
+    unsigned long st = atomic_load_explicit(&e->st, memory_order_acquire);
+
+    do {if(((st >> 32) & 0xffff) != gen || (st & FC_DEAD)) return -1;}
+    while(!atomic_compare_exchange_weak_explicit(&e->st, &st, st + 1, memory_order_acquire, memory_order_acquire));
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// lookup: pinned entry for path (hashed h), NULL if not cached. Lock-free.
+//-----------------------------------------------------------------------------
+
+static PFENT lookup(PFCACHE c, const char *path, unsigned int h)
+
+{
+    int i;
+    unsigned long w;
+    PFENT e;
+    atomic_ulong *b = &c->idx[(h & c->mask) * FC_WAYS];
+
+    for(i=0; i<FC_WAYS; i++)
+
+    {
+        w = atomic_load_explicit(&b[i], memory_order_acquire);
+        if(w == 0 || w >> 32 != h) continue;
+        e = &c->slot[(w & 0xffff) - 1];
+        if(pin(e, (w >> 16) & 0xffff) < 0) continue;
+        if(strcmp(e->path, path) == 0){__atomic_store_n(&e->used, 1, __ATOMIC_RELAXED); return e;}
+        bb_fcache_put(c, e);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// reclaim: close a retired entry and free its slot (locked).
+//-----------------------------------------------------------------------------
+
+static void reclaim(PFCACHE c, PFENT e)
+
+{
+    if(e->fd >= 0) close(e->fd);
+    free(e->data);
+    e->fd = -1;
+    e->data = NULL;
+    c->free[c->nfree++] = e - c->slot;
+}
+
+//-----------------------------------------------------------------------------
+// retire: take slot i out of the index, reclaimed now or by the last pin
+// (locked).
+//-----------------------------------------------------------------------------
+
+static void retire(PFCACHE c, int i)
+
+{
+    int j;
+    unsigned long st;
+    PFENT e = &c->slot[i];
+    atomic_ulong *b = &c->idx[(e->hash & c->mask) * FC_WAYS];
+
+    if(atomic_load_explicit(&e->st, memory_order_relaxed) & FC_DEAD) return;
+    for(j=0; j<FC_WAYS; j++) if((atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) == (unsigned long)i + 1) atomic_store_explicit(&b[j], 0, memory_order_relaxed);
+    st = atomic_fetch_or_explicit(&e->st, FC_DEAD, memory_order_acq_rel);
+    if((st & FC_PINS) == 0) reclaim(c, e);
+}
+
+//-----------------------------------------------------------------------------
+// find: slot of the live entry for path, -1 if none (locked).
+//-----------------------------------------------------------------------------
+
+static int find(PFCACHE c, const char *path)
+
+{
+    int i, k;
+    unsigned long w;
+    unsigned int h = hash(path);
+    atomic_ulong *b = &c->idx[(h & c->mask) * FC_WAYS];
+
+    for(i=0; i<FC_WAYS; i++)
+
+    {
+        w = atomic_load_explicit(&b[i], memory_order_relaxed);
+        k = (w & 0xffff) - 1;
+        if(w != 0 && w >> 32 == h && !strcmp(c->slot[k].path, path)) return k;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// grab: a free slot, evicting with the CLOCK hand if needed. -1 if every
+// entry is pinned (locked).
+//-----------------------------------------------------------------------------
+
+static int grab(PFCACHE c)
+
+{
+    int n;
+    PFENT e;
+
+    for(n=0; c->nfree == 0 && n < 2 * FC_SLOTS; n++)
+
+    {
+        e = &c->slot[c->hand];
+        if(!(atomic_load_explicit(&e->st, memory_order_relaxed) & FC_DEAD))
+
+        {
+            if(__atomic_exchange_n(&e->used, 0, __ATOMIC_RELAXED) == 0) retire(c, c->hand);
+        }
+
+        c->hand = (c->hand + 1) % FC_SLOTS;
+    }
+
+    return c->nfree > 0 ? c->free[--c->nfree] : -1;
+}
+
+//-----------------------------------------------------------------------------
+// insert: publish the loaded entry tmp, returned pinned. NULL if there is
+// no room (locked).
+//-----------------------------------------------------------------------------
+
+static PFENT insert(PFCACHE c, PFENT tmp)
+
+{
+    int i, j, k;
+    unsigned long gen;
+    PFENT e;
+    atomic_ulong *b = &c->idx[(tmp->hash & c->mask) * FC_WAYS];
+
+    if((i = grab(c)) < 0) return NULL;
+
+    // A full bucket loses its least recently hit entry (or the first):
+    for(j=0; j<FC_WAYS && atomic_load_explicit(&b[j], memory_order_relaxed) != 0; j++);
+
+    if(j == FC_WAYS)
+
+    {
+        for(j=0; j<FC_WAYS; j++){k = (atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) - 1; if(!__atomic_load_n(&c->slot[k].used, __ATOMIC_RELAXED)) break;}
+        if(j == FC_WAYS) j = 0;
+        retire(c, (atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) - 1);
+    }
+
+    // Filled while retired (no pin can succeed), then born pinned:
+    e = &c->slot[i];
+    gen = (atomic_load_explicit(&e->st, memory_order_relaxed) >> 32) + 1;
+    memcpy((char *)e + sizeof(e->st), (char *)tmp + sizeof(tmp->st), sizeof(FENT) - sizeof(e->st));
+    e->used = 1;
+    atomic_store_explicit(&e->st, gen << 32 | 1, memory_order_release);
+    atomic_store_explicit(&b[j], (unsigned long)e->hash << 32 | (gen & 0xffff) << 16 | (i + 1), memory_order_release);
+    return e;
+}
+
+//-----------------------------------------------------------------------------
+// load: open and describe path into e, -1 if it is not a regular file that
+// can be read. The worker waits for the disk here (misses only).
+//-----------------------------------------------------------------------------
+
+static int load(PFCACHE c, const char *path, PFENT e)
+
+{
+    struct open_how how = { .flags = O_RDONLY | O_CLOEXEC, .resolve = RESOLVE_BENEATH };
+    struct stat sb;
+    struct tm tm;
+    char lm[32];
+
+    // Never outside the root, even through symlinks (plain openat before 5.6):
+    if((e->fd = syscall(SYS_openat2, c->root, path, &how, sizeof(how))) < 0 && errno == ENOSYS) e->fd = openat(c->root, path, O_RDONLY | O_CLOEXEC);
+    if(e->fd < 0) return -1;
+    if(fstat(e->fd, &sb) < 0) goto end0;
+    if(!S_ISREG(sb.st_mode)){errno = ENOENT; goto end0;}
+
+    e->size = sb.st_size;
+    e->data = NULL;
+
+    // Small ones are read in, the descriptor goes:
+    if(e->size <= FC_SMALL)
+
+    {
+        if((e->data = malloc(e->size + 1)) == NULL) goto end0;
+        if(pread(e->fd, e->data, e->size, 0) != e->size){errno = EIO; goto end1;}
+        close(e->fd);
+        e->fd = -1;
+    }
+
+    // Validators as nginx makes them, and the fixed header lines:
+    gmtime_r(&sb.st_mtime, &tm);
+    strftime(lm, sizeof(lm), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    e->elen = snprintf(e->etag, sizeof(e->etag), "\"%lx-%lx\"", (unsigned long)sb.st_mtime, (unsigned long)sb.st_size);
+    e->hlen = snprintf(e->head, sizeof(e->head), "Content-Type: %s\r\nLast-Modified: %s\r\nETag: %s\r\nAccept-Ranges: bytes\r\n", type(path), lm, e->etag);
+    e->clen_n = snprintf(e->clen, sizeof(e->clen), "Content-Length: %lld\r\n", (long long)e->size);
+    strcpy(e->path, path);
+    e->hash = hash(path);
+    return 0;
+
+    // Return on error:
+    end1: free(e->data);
+    end0: close(e->fd);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// watch: make sure the directory of path is watched, -1 if it can not be.
+//-----------------------------------------------------------------------------
+
+static int watch(PFCACHE c, const char *path)
+
+{
+    int wd, n, r;
+    char dir[PATH_MAX], **d;
+    const char *s = strrchr(path, '/');
+
+    n = snprintf(dir, sizeof(dir), "%s/%.*s", c->rpath, s ? (int)(s - path) : 0, path);
+    if(n >= sizeof(dir)) return -1;
+    if((wd = inotify_add_watch(c->ifd, dir, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)) < 0) return -1;
+
+    pthread_mutex_lock(&c->lock);
+
+    if(wd >= c->ndirs)
+
+    {
+        if((d = realloc(c->dirs, (wd + 64) * sizeof(char *))) == NULL){pthread_mutex_unlock(&c->lock); return -1;}
+        memset(d + c->ndirs, 0, (wd + 64 - c->ndirs) * sizeof(char *));
+        c->dirs = d;
+        c->ndirs = wd + 64;
+    }
+
+    // Below the root, without the slash:
+    if(c->dirs[wd] == NULL) c->dirs[wd] = strndup(path, s ? s - path : 0);
+    r = c->dirs[wd] ? 0 : -1;
+    pthread_mutex_unlock(&c->lock);
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+// W_Notify: retire what changed on disk, everything if events were lost or
+// a watched directory went.
+//-----------------------------------------------------------------------------
+
+static void *W_Notify(void *arg)
+
+{
+    PFCACHE c = (PFCACHE)arg;
+    char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[FC_PATH * 2];
+    struct inotify_event *ev;
+    ssize_t n;
+    char *p;
+    int i;
+
+    while((n = read(c->ifd, buff, sizeof(buff))) > 0 || (n < 0 && errno == EINTR))
+
+    {
+        pthread_mutex_lock(&c->lock);
+
+        for(p=buff; n > 0 && p < buff + n; p += sizeof(struct inotify_event) + ev->len)
+
+        {
+            ev = (struct inotify_event *)p;
+
+            if(ev->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+
+            {
+                for(i=0; i<FC_SLOTS; i++) retire(c, i);
+                if((ev->mask & IN_IGNORED) && ev->wd < c->ndirs){free(c->dirs[ev->wd]); c->dirs[ev->wd] = NULL;}
+            }
+
+            else if(ev->len && ev->wd < c->ndirs && c->dirs[ev->wd])
+
+            {
+                snprintf(path, sizeof(path), "%s%s%s", c->dirs[ev->wd], *c->dirs[ev->wd] ? "/" : "", ev->name);
+                if((i = find(c, path)) >= 0) retire(c, i);
+            }
+        }
+
+        atomic_fetch_add_explicit(&c->changes, 1, memory_order_release);
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// bb_fcache_init: serve root, -1 if it is not a directory we can watch.
+//-----------------------------------------------------------------------------
+
+int bb_fcache_init(PFCACHE c, const char *root)
+
+{
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    if((c->rpath = realpath(root, NULL)) == NULL) return -1;
+    if((c->root = open(c->rpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) goto end0;
+    if((c->ifd = inotify_init1(IN_CLOEXEC)) < 0) goto end1;
+    if((c->slot = calloc(FC_SLOTS, sizeof(FENT))) == NULL) goto end2;
+    if((c->free = malloc(FC_SLOTS * sizeof(int))) == NULL) goto end3;
+
+    // Twice as many index words as slots:
+    for(c->mask=1; c->mask * FC_WAYS < 2 * FC_SLOTS; c->mask <<= 1);
+    if((c->idx = calloc(c->mask, FC_WAYS * sizeof(atomic_ulong))) == NULL) goto end4;
+    c->mask--;
+
+    // Every slot starts retired and free:
+    for(i=0; i<FC_SLOTS; i++){atomic_init(&c->slot[i].st, FC_DEAD); c->slot[i].fd = -1; c->free[c->nfree++] = FC_SLOTS - 1 - i;}
+    atomic_init(&c->changes, 0);
+    pthread_mutex_init(&c->lock, NULL);
+    return 0;
+
+    // Return on error:
+    end4: free(c->free);
+    end3: free(c->slot);
+    end2: close(c->ifd);
+    end1: close(c->root);
+    end0: free(c->rpath);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_fcache_get: pinned entry for path (below the root), loaded on a miss.
+// NULL with errno set if it can not be served (EBUSY: every slot pinned).
+//-----------------------------------------------------------------------------
+
+PFENT bb_fcache_get(PFCACHE c, const char *path)
+
+{
+    unsigned int h = hash(path);
+    unsigned long seen;
+    pthread_t tid;
+    FENT tmp;
+    PFENT e;
+    int ok;
+
+    if((e = lookup(c, path, h)) != NULL) return e;
+
+    // Watched before it is read, changes from then on are not missed. The
+    // watcher starts with the first miss (we may have forked since init):
+    seen = atomic_load_explicit(&c->changes, memory_order_acquire);
+    ok = watch(c, path) == 0;
+    if(load(c, path, &tmp) < 0) return NULL;
+
+    pthread_mutex_lock(&c->lock);
+    if(!c->watching && pthread_create(&tid, NULL, W_Notify, c) == 0){pthread_detach(tid); c->watching = 1;}
+    if((e = lookup(c, path, h)) == NULL && (e = insert(c, &tmp)) != NULL) tmp.fd = -1, tmp.data = NULL;
+
+    // Maybe stale already (or not watched), good for this request only:
+    if(e && (!ok || atomic_load_explicit(&c->changes, memory_order_acquire) != seen)) retire(c, e - c->slot);
+    pthread_mutex_unlock(&c->lock);
+
+    // Lost the race or no room:
+    if(tmp.fd >= 0) close(tmp.fd);
+    free(tmp.data);
+    if(e == NULL) errno = EBUSY;
+    return e;
+}
+
+//-----------------------------------------------------------------------------
+// bb_fcache_put: let go of a pinned entry.
+//-----------------------------------------------------------------------------
+
+void bb_fcache_put(PFCACHE c, PFENT e)
+
+{
+    unsigned long st = atomic_fetch_sub_explicit(&e->st, 1, memory_order_acq_rel);
+
+    // The last pin of a retired entry:
+    if((st & FC_DEAD) && (st & FC_PINS) == 1)
+
+    {
+        pthread_mutex_lock(&c->lock);
+        reclaim(c, e);
+        pthread_mutex_unlock(&c->lock);
+    }
+}
@@ -0,0 +1,106 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_FCACHE_
+#define _BB_FCACHE_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define FC_SLOTS 4096      // Cached files (open descriptors at most).
+#define FC_WAYS 8          // Index entries per bucket.
+#define FC_SMALL 16384     // Files up to this size are kept in memory.
+#define FC_PATH 256        // Longest path below the root.
+#define FC_HEAD 320        // Precomputed header lines.
+#define FC_DEAD (1UL << 31)          // Entry state: out of the index.
+#define FC_PINS (FC_DEAD - 1)        // Entry state: readers holding it.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _FENT
+
+{
+    atomic_ulong st;           // Generation (high 32 bits), FC_DEAD, pins.
+    unsigned int hash;         // Of path.
+    unsigned char used;        // Hit since the CLOCK hand last passed.
+    char path[FC_PATH];        // Below the root, no leading slash.
+    int fd;                    // Open file, -1 if kept in memory.
+    char *data;                // Small files: the contents.
+    off_t size;                // File size.
+    char etag[48];             // Quoted ETag.
+    int elen;
+    char head[FC_HEAD];        // Content-Type, Last-Modified, ETag and
+    int hlen;                  // Accept-Ranges lines.
+    char clen[32];             // Content-Length line.
+    int clen_n;
+}
+
+FENT, *PFENT;
+
+typedef struct _FCACHE
+
+{
+    int root;                  // The directory served.
+    char *rpath;               // Its absolute path (watches).
+    PFENT slot;                // FC_SLOTS entries, never freed.
+    atomic_ulong *idx;         // Buckets of FC_WAYS words: hash, generation
+    unsigned int mask;         // and slot + 1 (0 is free).
+    pthread_mutex_t lock;      // Writers: misses, evictions, changes.
+    int *free;                 // Free slots.
+    int nfree;
+    int hand;                  // CLOCK hand.
+    int ifd;                   // inotify.
+    char **dirs;               // Watched directories by descriptor.
+    int ndirs;
+    atomic_ulong changes;      // Events seen so far.
+    int watching;              // W_Notify started.
+}
+
+FCACHE, *PFCACHE;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_fcache_init(PFCACHE c, const char *root);
+PFENT bb_fcache_get(PFCACHE c, const char *path);
+void bb_fcache_put(PFCACHE c, PFENT e);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
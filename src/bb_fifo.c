@@ -23,18 +23,35 @@
 // Includes:
 //-----------------------------------------------------------------------------
 
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "bb_fifo.h"
 
+//-----------------------------------------------------------------------------
+// Bounded multi-producer/multi-consumer ring. Every slot carries a sequence
+// number telling whose turn it is, so producers and consumers only compete
+// on their own cursor and never allocate after bb_fifo_new().
+//-----------------------------------------------------------------------------
+
 //-----------------------------------------------------------------------------
 // bb_fifo_new:
 //-----------------------------------------------------------------------------
 
-int bb_fifo_new(PFIFO fifo)
+int bb_fifo_new(PFIFO fifo, size_t size)
 
 {
-    if((fifo->cap = malloc(sizeof(NODE))) == NULL) return -1;
-    fifo->cua = fifo->cap;
-    fifo->cua->nxt = NULL;
+    size_t i, cap = 2;
+
+    while(cap < size) cap <<= 1;
+    if((fifo->ring = aligned_alloc(CACHELINE, cap * sizeof(SLOT))) == NULL) return -1;
+    for(i=0; i<cap; i++) atomic_init(&fifo->ring[i].seq, i);
+
+    fifo->mask = cap - 1;
+    atomic_init(&fifo->head, 0);
+    atomic_init(&fifo->tail, 0);
+    atomic_init(&fifo->wake, 0);
+    atomic_init(&fifo->idle, 0);
     return 0;
 }
 
@@ -45,37 +62,144 @@ int bb_fifo_new(PFIFO fifo)
 int bb_fifo_empty(PFIFO fifo)
 
 {
-    if(fifo->cap == fifo->cua) return 1;
+    size_t pos = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    PSLOT slot = &fifo->ring[pos & fifo->mask];
+
+    if(atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) return 1;
     return 0;
 }
 
 //-----------------------------------------------------------------------------
-// bb_fifo_push:
+// bb_fifo_len: pointers queued, a snapshot for monitoring only.
+//-----------------------------------------------------------------------------
+
+size_t bb_fifo_len(PFIFO fifo)
+
+{
+    size_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+
+    return head > tail ? head - tail : 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_fifo_push: returns -1 when the ring is full.
 //-----------------------------------------------------------------------------
 
 int bb_fifo_push(PFIFO fifo, void *cptr)
 
 {
-    PNODE ptr;
+    PSLOT slot;
+    size_t seq, pos = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+
+    while(1)
+
+    {
+        slot = &fifo->ring[pos & fifo->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        // Free slot, try to claim it:
+        if(seq == pos)
+
+        {
+            if(atomic_compare_exchange_weak_explicit(&fifo->head, &pos, pos + 1,
+               memory_order_relaxed, memory_order_relaxed)) break;
+        }
+
+        // Consumers are a whole lap behind:
+        else if(seq < pos) return -1;
+
+        // Another producer won the slot:
+        else pos = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    }
+
+    slot->cptr = cptr;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // Pairs with the fence in bb_fifo_wait(), only syscall if someone sleeps:
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&fifo->idle, memory_order_relaxed) > 0)
+
+    {
+        atomic_fetch_add_explicit(&fifo->wake, 1, memory_order_release);
+        syscall(SYS_futex, &fifo->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
 
-    if((ptr = malloc(sizeof(NODE))) == NULL) return -1;
-    ptr->cptr = cptr;
-    ptr->nxt = NULL;
-    fifo->cua->nxt = ptr;
-    fifo->cua = ptr;
     return 0;
 }
 
 //-----------------------------------------------------------------------------
-// bb_fifo_pop:
+// bb_fifo_pop: returns NULL when the ring is empty.
+//-----------------------------------------------------------------------------
+
+void *bb_fifo_pop(PFIFO fifo)
+
+{
+    PSLOT slot;
+    void *cptr;
+    size_t seq, pos = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+
+    while(1)
+
+    {
+        slot = &fifo->ring[pos & fifo->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        // Full slot, try to claim it:
+        if(seq == pos + 1)
+
+        {
+            if(atomic_compare_exchange_weak_explicit(&fifo->tail, &pos, pos + 1,
+               memory_order_relaxed, memory_order_relaxed)) break;
+        }
+
+        // Nothing pushed here yet:
+        else if(seq < pos + 1) return NULL;
+
+        // Another consumer won the slot:
+        else pos = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    }
+
+    cptr = slot->cptr;
+    atomic_store_explicit(&slot->seq, pos + fifo->mask + 1, memory_order_release);
+    return cptr;
+}
+
+//-----------------------------------------------------------------------------
+// bb_fifo_wait: pop or park on the futex until something is pushed.
 //-----------------------------------------------------------------------------
 
-void bb_fifo_pop(PFIFO fifo)
+void *bb_fifo_wait(PFIFO fifo)
 
 {
-    PNODE ptr;
+    void *cptr;
+    unsigned int wake;
+
+    while(1)
+
+    {
+        if((cptr = bb_fifo_pop(fifo)) != NULL) return cptr;
+
+        // Announce ourselves and look again before sleeping:
+        wake = atomic_load_explicit(&fifo->wake, memory_order_acquire);
+        atomic_fetch_add_explicit(&fifo->idle, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if((cptr = bb_fifo_pop(fifo)) == NULL)
+        syscall(SYS_futex, &fifo->wake, FUTEX_WAIT_PRIVATE, wake, NULL, NULL, 0);
+
+        atomic_fetch_sub_explicit(&fifo->idle, 1, memory_order_relaxed);
+        if(cptr != NULL) return cptr;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// bb_fifo_free:
+//-----------------------------------------------------------------------------
+
+void bb_fifo_free(PFIFO fifo)
 
-    ptr = fifo->cap;
-    fifo->cap = ptr->nxt;
-    free(ptr);
+{
+    free(fifo->ring);
+    fifo->ring = NULL;
 }
@@ -31,33 +31,53 @@
 //-----------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define CACHELINE 64    // Keep producers and consumers on separate lines.
 
 //-----------------------------------------------------------------------------
 // Typedefs:
 //-----------------------------------------------------------------------------
 
-typedef struct _NODE {
+typedef struct _SLOT
+
+{
+    atomic_size_t   seq;     // Slot turn: pos (free) or pos+1 (full).
+    void            *cptr;   // Stored pointer.
+}
 
-    void            *cptr;
-    struct _NODE    *nxt;
+SLOT, *PSLOT;
 
-} NODE, *PNODE;
+typedef struct _FIFO
 
-typedef struct _FIFO {
+{
+    PSLOT           ring;    // Power of two array of slots.
+    size_t          mask;    // Capacity minus one.
 
-    PNODE    cap;
-    PNODE    cua;
+    atomic_size_t   head __attribute__((aligned(CACHELINE)));    // Push.
+    atomic_size_t   tail __attribute__((aligned(CACHELINE)));    // Pop.
+    atomic_uint     wake __attribute__((aligned(CACHELINE)));    // Futex.
+    atomic_int      idle;                                        // Parked.
+}
 
-} FIFO, *PFIFO;
+FIFO, *PFIFO;
 
 //-----------------------------------------------------------------------------
 // Prototypes:
 //-----------------------------------------------------------------------------
 
-int bb_fifo_new(PFIFO fifo);
+int bb_fifo_new(PFIFO fifo, size_t size);
 int bb_fifo_empty(PFIFO fifo);
+size_t bb_fifo_len(PFIFO fifo);
 int bb_fifo_push(PFIFO fifo, void *cptr);
-void bb_fifo_pop(PFIFO fifo);
+void *bb_fifo_pop(PFIFO fifo);
+void *bb_fifo_wait(PFIFO fifo);
+void bb_fifo_free(PFIFO fifo);
 
 //-----------------------------------------------------------------------------
 // End of include guard:
@@ -0,0 +1,104 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_HANDLER_
+#define _BB_HANDLER_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _CLIENT CLIENT, *PCLIENT;    // Opaque to protocol handlers.
+
+typedef struct _HANDLER
+
+{
+    const char *name;    // Used by --handler (name or name:arg).
+    size_t size;         // Per-connection state preallocated in the CLIENT slab.
+
+    int  (*on_init)(const char *arg);                    // Once, before daemonizing.
+                                                         // arg may be NULL, <0 fails.
+    int  (*on_accept)(PCLIENT cptr);                     // <0 refuses.
+    int  (*on_data)(PCLIENT cptr, char *buff, int len);  // Consumed, <0 closes.
+    int  (*on_writable)(PCLIENT cptr);                   // <0 closes.
+    void (*on_close)(PCLIENT cptr);
+    int  (*on_shed)(PCLIENT cptr, char *buff, int len);  // Overloaded: consume a frame
+                                                         // like on_data, answer it
+                                                         // cheaply. None or <0 resets.
+    void (*on_release)(void *arg);                       // A bb_send_hold() mark was
+                                                         // passed (sent or dropped).
+    int  (*on_key)(PCLIENT cptr, char *buff, int len,    // --cache: a complete cacheable
+                   char *key, int *klen);                // frame, its length and its key
+                                                         // (BB_KEY_MAX at most). 0 if not.
+}
+
+HANDLER, *PHANDLER;
+
+//-----------------------------------------------------------------------------
+// Prototypes (exported by bb to handlers and plugins):
+//-----------------------------------------------------------------------------
+
+int bb_fd(PCLIENT cptr);
+void *bb_udata(PCLIENT cptr);
+void bb_set_udata(PCLIENT cptr, void *udata);
+void bb_want_write(PCLIENT cptr);
+int bb_send(PCLIENT cptr, const void *buff, size_t len);          // Copied if it has to wait.
+int bb_send_static(PCLIENT cptr, const void *buff, size_t len);   // Never copied.
+int bb_send_copy(PCLIENT cptr, const void *buff, size_t len);     // Copied right away.
+int bb_send_file(PCLIENT cptr, int fd, off_t off, size_t len);    // sendfile(), fd kept open
+                                                                  // up to the next mark.
+int bb_send_hold(PCLIENT cptr, void *arg);                        // Mark: on_release(arg) once
+                                                                  // all queued before is out.
+                                                                  // Queue it along with what
+                                                                  // it guards, not later.
+const char *bb_date(void);                                        // BB_DATE_LEN bytes, good for
+                                                                  // a second: bb_send_copy() it.
+void bb_close(PCLIENT cptr);                                      // Once the output is out.
+int bb_draining(void);                                            // Shutting down, say goodbye.
+void bb_cache(PCLIENT cptr, int ttl);                             // From on_data: cache what it
+                                                                  // sends for ttl seconds.
+int bb_purge(const char *key, int klen);                          // Drop a cached response (all
+                                                                  // if key is NULL), how many.
+
+//-----------------------------------------------------------------------------
+// A plugin is a shared object exporting: HANDLER bb_handler;
+//-----------------------------------------------------------------------------
+
+#define BB_HANDLER_SYM "bb_handler"
+#define BB_DATE_LEN 37    // "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+#define BB_KEY_MAX 1024   // Longest response cache key.
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
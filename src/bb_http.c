@@ -0,0 +1,180 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include <strings.h>
+#include "bb_handler.h"
+#include "bb_scan.h"
+
+#ifdef BB_BLOCK
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _HTTP
+
+{
+    int scan;    // Offset where the delimiter search resumes.
+}
+
+HTTP, *PHTTP;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static const char head[] = "HTTP/1.1 200 OK\r\n";
+
+static const char tail[] = "Server: Apache\r\n"
+                           "Last-Modified: Mon, 13 Aug 2007 18:48:31 GMT\r\n"
+                           "ETag: \"1c78037-b-2bc99dc0\"\r\n"
+                           "Accept-Ranges: bytes\r\n"
+                           "Content-Length: 11\r\n"
+                           "Content-Type: text/html; charset=UTF-8\r\n"
+                           "\r\n";
+
+static const char body[] = "HelloWorld\n";
+
+static const char bye[] = "Connection: close\r\n";
+
+static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                           "Retry-After: 1\r\n"
+                           "Content-Length: 0\r\n"
+                           "\r\n";
+
+//-----------------------------------------------------------------------------
+// http_accept:
+//-----------------------------------------------------------------------------
+
+static int http_accept(PCLIENT cptr)
+
+{
+    ((PHTTP)bb_udata(cptr))->scan = 0;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// http_data: answer the first complete request head in buff.
+//-----------------------------------------------------------------------------
+
+static int http_data(PCLIENT cptr, char *buff, int len)
+
+{
+    int i;
+    PHTTP http = bb_udata(cptr);
+
+    if((i = bb_scan_crlf2(buff, http->scan, len)) >= 0)
+
+    {
+        http->scan = 0;
+#ifdef BB_BLOCK
+        // Bench only: stand in for a blocking backend call (BB_BLOCK us):
+        usleep(BB_BLOCK);
+#endif
+        // Cacheable for as long as its Date line is right:
+        bb_cache(cptr, 1);
+
+        // Read-only pieces by reference, the Date line is copied (the ticker
+        // reuses its buffer):
+        if(bb_send_static(cptr, head, sizeof(head)-1) < 0) return -1;
+        if(bb_send_copy(cptr, bb_date(), BB_DATE_LEN) < 0) return -1;
+        // Shutting down, the last response on this connection:
+        if(bb_draining()){if(bb_send_static(cptr, bye, sizeof(bye)-1) < 0){return -1;} bb_close(cptr);}
+        if(bb_send_static(cptr, tail, sizeof(tail)-1) < 0) return -1;
+        if(bb_send_static(cptr, body, sizeof(body)-1) < 0) return -1;
+        return i+4;
+    }
+
+    // Need more data, do not rescan what was already seen:
+    http->scan = len > 3 ? len-3 : 0;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// http_key: GET and HEAD are cacheable, keyed on the request line, Host and
+// Accept-Encoding (what a response may vary on), in that order.
+//-----------------------------------------------------------------------------
+
+static int http_key(PCLIENT cptr, char *buff, int len, char *key, int *klen)
+
+{
+    int i, j, n, r, hl = 0, el = 0;
+    char *host = "", *enc = "";
+    PHTTP http = bb_udata(cptr);
+
+    if((i = bb_scan_crlf2(buff, http->scan, len)) < 0) return 0;
+    if(strncmp(buff, "GET ", 4) && strncmp(buff, "HEAD ", 5)) return 0;
+    r = bb_scan_eol(buff, 0, i + 2);
+
+    for(j=r+2; j<i; j=n+2)
+
+    {
+        n = bb_scan_eol(buff, j, i + 2);
+        if(!strncasecmp(buff + j, "Host:", 5)){for(host = buff + j + 5; *host == ' '; host++); hl = buff + n - host;}
+        else if(!strncasecmp(buff + j, "Accept-Encoding:", 16)){for(enc = buff + j + 16; *enc == ' '; enc++); el = buff + n - enc;}
+    }
+
+    if(r + hl + el + 2 > BB_KEY_MAX) return 0;
+    memcpy(key, buff, r);
+    key[r] = '\n'; memcpy(key + r + 1, host, hl);
+    key[r + 1 + hl] = '\n'; memcpy(key + r + 2 + hl, enc, el);
+    *klen = r + hl + el + 2;
+
+    // On a hit on_data does not run, start the next frame afresh:
+    http->scan = 0;
+    return i+4;
+}
+
+//-----------------------------------------------------------------------------
+// http_shed: overloaded, answer the first complete request head in buff
+// with a canned 503 (kept alive, the client may retry later).
+//-----------------------------------------------------------------------------
+
+static int http_shed(PCLIENT cptr, char *buff, int len)
+
+{
+    int i;
+    PHTTP http = bb_udata(cptr);
+
+    if((i = bb_scan_crlf2(buff, http->scan, len)) < 0){http->scan = len > 3 ? len-3 : 0; return 0;}
+    http->scan = 0;
+    if(bb_send_static(cptr, busy, sizeof(busy)-1) < 0) return -1;
+    return i+4;
+}
+
+//-----------------------------------------------------------------------------
+// Handler:
+//-----------------------------------------------------------------------------
+
+HANDLER bb_http = { .name = "http", .size = sizeof(HTTP),
+                    .on_accept = http_accept, .on_data = http_data, .on_shed = http_shed,
+                    .on_key = http_key };
+
+#ifdef BB_PLUGIN
+extern HANDLER bb_handler __attribute__((alias("bb_http")));
+#endif
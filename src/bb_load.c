@@ -0,0 +1,648 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//-----------------------------------------------------------------------------
+// HTTP load generator for make bench. Every thread drives its share of the
+// connections on its own epoll. Closed loop keeps depth requests in flight
+// per connection. Open loop (--rate) sends on a fixed schedule and times
+// each request from when it was due, not from when it could be sent, so a
+// stalled server is not hidden by a stalled client (coordinated omission).
+// A profile (--profile=rate:secs,...) steps the open loop rate through its
+// phases over and over, for bursts.
+//
+// A server saying Connection: close, or closing a kept-alive connection
+// before any byte of the next response, is not an error: what was in flight
+// goes again on a new connection (idempotent requests, as HTTP clients do).
+// A 503 (shed by an overloaded server) is counted apart, not as goodput and
+// not in the latencies. Bodies that do not fit the receive buffer (big
+// files) are dropped as they arrive.
+//
+// Connections are timed too, from connect() to their first response byte
+// (handshake, accept and the first answer): cps and connect_p* in the
+// report, what a connect storm (--churn=1) measures.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MyDBG(x) do {fprintf(stderr, "(%d) %s:%d\n", errno, __FILE__, __LINE__); goto x;} while (0)
+
+#define RBUF 65536         // Receive buffer per connection.
+#define EVENTS 256         // Max epoll events per round.
+#define LAT_SUB 5          // 2^5 buckets per power of two (3% error).
+#define LAT_BUCKETS (64 << LAT_SUB)
+#define PHASES 16          // Max phases in a rate profile.
+#define PER_ADDR 20000     // Loopback: connections per source address.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _CONN
+
+{
+    int fd;                  // Socket, -1 between connections.
+    char *rbuf;              // Response bytes not parsed yet.
+    int rlen;                // Bytes in rbuf.
+    unsigned long *due;      // Requests in flight: when each was due (ns).
+    int dhead;               // Oldest request in flight.
+    int dcnt;                // Requests in flight.
+    unsigned long wout;      // Request bytes owed to the socket.
+    unsigned long wpos;      // Request bytes written so far.
+    unsigned long next;      // Open loop: when the next request is due.
+    unsigned long done;      // Responses on this connection.
+    long skip;               // Body bytes of the current response still to come.
+    int shed;                // The current response is a 503.
+    int fin;                 // It says Connection: close.
+    int bye;                 // The server said Connection: close.
+    int src;                 // Bound to 127.0.0.src first (0 = any).
+    unsigned long tcon;      // connect() called (ns), 0 once a byte came back.
+}
+
+CONN, *PCONN;
+
+typedef struct _WORKER
+
+{
+    pthread_t tid;                  // Thread.
+    int epfd;                       // Its epoll.
+    PCONN conn;                     // Its connections.
+    int cnt;                        // Number of connections.
+    unsigned long lat[LAT_BUCKETS]; // Latency histogram (ns).
+    unsigned long reqs;             // Responses.
+    unsigned long errs;             // Connections lost or refused.
+    unsigned long retries;          // Connections closed by the server, requests sent again.
+    unsigned long sheds;            // 503 responses.
+    unsigned long conns;            // Connections opened.
+    unsigned long rbytes;           // Bytes received.
+    unsigned long clat[LAT_BUCKETS];// connect() to the first response byte (ns).
+    unsigned long ups;              // Connections that got a byte back.
+}
+
+WORKER, *PWORKER;
+
+typedef struct _LOAD
+
+{
+    char *host;         // Server address.
+    int port;           // Server port.
+    int threads;        // Worker threads.
+    int conns;          // Connections (all threads).
+    int depth;          // Max requests in flight per connection.
+    int size;           // Request size in bytes.
+    int churn;          // Reconnect every churn responses (0 = never).
+    double rate;        // Open loop requests per second (0 = closed loop).
+    double secs;        // Duration.
+    double prate[PHASES];        // Profile: rate of each phase.
+    unsigned long psecs[PHASES]; // And how long it lasts (ns).
+    int phases;         // Phases in the profile (0 = fixed rate).
+    unsigned long cycle;// Profile length (ns).
+    char *label;        // Scenario name for the report.
+    char *path;         // Request target.
+    char *req;          // The request, repeated depth + 1 times.
+    unsigned long start;// Start time (ns).
+    unsigned long end;  // End time (ns).
+}
+
+LOAD, *PLOAD;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+LOAD l;
+
+//-----------------------------------------------------------------------------
+// now: monotonic ns.
+//-----------------------------------------------------------------------------
+
+unsigned long now(void)
+
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// record: one latency sample into histogram lat, log-linear buckets.
+//-----------------------------------------------------------------------------
+
+void record(unsigned long *lat, unsigned long ns)
+
+{
+    int msb;
+
+    if(ns < 1UL << LAT_SUB){lat[ns]++; return;}
+    msb = 63 - __builtin_clzl(ns);
+    lat[((msb - LAT_SUB + 1) << LAT_SUB) + ((ns >> (msb - LAT_SUB)) & ((1 << LAT_SUB) - 1))]++;
+}
+
+//-----------------------------------------------------------------------------
+// value: lower bound (ns) of bucket i.
+//-----------------------------------------------------------------------------
+
+unsigned long value(int i)
+
+{
+    int msb = (i >> LAT_SUB) + LAT_SUB - 1;
+
+    if(i < 1 << LAT_SUB) return i;
+    return (1UL << msb) + ((unsigned long)(i & ((1 << LAT_SUB) - 1)) << (msb - LAT_SUB));
+}
+
+//-----------------------------------------------------------------------------
+// dial: (re)connect c, returns -1 on error.
+//-----------------------------------------------------------------------------
+
+int dial(PWORKER w, PCONN c)
+
+{
+    int i = 1;
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+
+    if((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) return -1;
+    setsockopt(c->fd, SOL_TCP, TCP_NODELAY, &i, sizeof(i));
+
+    // Many connections to loopback come from several addresses, the
+    // ephemeral ports of one do not last:
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7f000000 | c->src);
+    if(c->src && bind(c->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) goto end0;
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(l.port);
+    if(inet_pton(AF_INET, l.host, &addr.sin_addr) != 1) goto end0;
+    c->tcon = now();
+    if(connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS) goto end0;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) goto end0;
+
+    // What was in flight on the last one goes again:
+    c->rlen = c->bye = c->skip = 0;
+    c->wout = (unsigned long)c->dcnt * l.size;
+    c->wpos = c->done = 0;
+    w->conns++;
+    return 0;
+
+    // Return on error:
+    end0: close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// hang: drop c, requests in flight are lost.
+//-----------------------------------------------------------------------------
+
+void hang(PCONN c)
+
+{
+    close(c->fd);
+    c->fd = -1;
+    c->dhead = c->dcnt = 0;
+}
+
+//-----------------------------------------------------------------------------
+// lost: c went down, retried if the server closed it between responses.
+//-----------------------------------------------------------------------------
+
+void lost(PWORKER w, PCONN c)
+
+{
+    if(l.churn && c->done == l.churn){hang(c); return;}
+    if(c->bye || (c->done > 0 && c->rlen == 0 && c->skip == 0)){close(c->fd); c->fd = -1; w->retries += c->dcnt > 0; return;}
+    hang(c);
+    w->errs++;
+}
+
+//-----------------------------------------------------------------------------
+// push: write what is owed, returns -1 on error.
+//-----------------------------------------------------------------------------
+
+int push(PCONN c)
+
+{
+    ssize_t n;
+    unsigned long off, len;
+
+    while(c->wout > 0)
+
+    {
+        off = c->wpos % l.size;
+        len = (unsigned long)l.size * (l.depth + 1) - off;
+        if(len > c->wout) len = c->wout;
+        if((n = write(c->fd, l.req + off, len)) < 0) return errno == EAGAIN ? 0 : -1;
+        c->wout -= n;
+        c->wpos += n;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// queue: one more request due at t (not sent until push).
+//-----------------------------------------------------------------------------
+
+void queue(PCONN c, unsigned long t)
+
+{
+    c->due[(c->dhead + c->dcnt++) % l.depth] = t;
+    c->wout += l.size;
+}
+
+//-----------------------------------------------------------------------------
+// answer: the current response is complete, returns -1 if unsolicited.
+//-----------------------------------------------------------------------------
+
+int answer(PWORKER w, PCONN c, unsigned long t)
+
+{
+    if(c->dcnt == 0) return -1;
+    if(c->shed) w->sheds++;
+    else{record(w->lat, t - c->due[c->dhead]); w->reqs++;}
+    c->dhead = (c->dhead + 1) % l.depth;
+    c->dcnt--;
+    c->done++;
+    c->bye = c->fin;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// parse: count the complete responses in c->rbuf, returns -1 on garbage.
+//-----------------------------------------------------------------------------
+
+int parse(PWORKER w, PCONN c, unsigned long t)
+
+{
+    char *p, *e, *h;
+    long clen;
+    int off = 0;
+
+    while(1)
+
+    {
+        // The rest of a body that did not fit:
+        if(c->skip > 0)
+
+        {
+            clen = c->rlen - off < c->skip ? c->rlen - off : c->skip;
+            off += clen;
+            if((c->skip -= clen) > 0) break;
+            if(answer(w, c, t) < 0) return -1;
+            if(c->bye) return 0;
+            continue;
+        }
+
+        // Header, then Content-Length bytes of body:
+        if((e = memmem(c->rbuf + off, c->rlen - off, "\r\n\r\n", 4)) == NULL) break;
+        for(clen = 0, c->fin = 0, h = c->rbuf + off; h < e; h = p + 1)
+
+        {
+            if((p = memchr(h, '\n', e - h)) == NULL) p = e;
+            if(!strncasecmp(h, "Content-Length:", 15)) clen = atol(h + 15);
+            if(!strncasecmp(h, "Connection: close", 17)) c->fin = 1;
+        }
+
+        c->shed = !strncmp(c->rbuf + off, "HTTP/1.1 503", 12);
+
+        // Bodies bigger than what is left of the buffer go by as they come:
+        if(e + 4 + clen > c->rbuf + c->rlen)
+
+        {
+            if(e + 4 + clen - (c->rbuf + off) <= RBUF) break;
+            off = e + 4 - c->rbuf;
+            c->skip = clen;
+            continue;
+        }
+
+        off = e + 4 + clen - c->rbuf;
+        if(answer(w, c, t) < 0) return -1;
+        if(c->bye) return 0;
+    }
+
+    // A response that does not fit:
+    if(off == 0 && c->rlen == RBUF) return -1;
+    memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+    c->rlen -= off;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// rate: open loop rate at t, the profile's phase or the fixed one.
+//-----------------------------------------------------------------------------
+
+double rate(unsigned long t)
+
+{
+    int i;
+    unsigned long at;
+
+    if(l.phases == 0) return l.rate;
+    for(i=0, at=(t - l.start) % l.cycle; at >= l.psecs[i]; i++) at -= l.psecs[i];
+    return l.prate[i];
+}
+
+//-----------------------------------------------------------------------------
+// feed: queue whatever this connection may send by t.
+//-----------------------------------------------------------------------------
+
+void feed(PCONN c, unsigned long t)
+
+{
+    // Churn: stop asking once the quota is in flight, reconnect when done:
+    unsigned long left = l.churn ? l.churn - c->done - c->dcnt : ~0UL;
+
+    // Closed loop keeps depth in flight. Open loop queues what is due, the
+    // depth only limits what is on the wire (late ones keep their due time):
+    if(l.rate == 0){while(c->dcnt < l.depth && left-- > 0) queue(c, t); return;}
+    while(c->next <= t && c->dcnt < l.depth && left-- > 0){queue(c, c->next); c->next += (unsigned long)(1e9 * l.conns / rate(c->next));}
+}
+
+//-----------------------------------------------------------------------------
+// W_Load:
+//-----------------------------------------------------------------------------
+
+void *W_Load(void *arg)
+
+{
+    // Initializations:
+    PWORKER w = (PWORKER)arg;          // This worker.
+    PCONN c;                           // Connection.
+    int i, n;                          // For general use.
+    ssize_t r;                         // Bytes read.
+    unsigned long t, wake;             // Current time and next due request.
+    struct timespec ts;                // Wait timeout.
+    struct epoll_event ev[EVENTS];     // Epoll events.
+
+    if((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) MyDBG(end0);
+
+    // Open loop connections start evenly spread over the first interval:
+    for(i=0; i<w->cnt; i++)
+
+    {
+        c = &w->conn[i];
+        c->next = l.start + (unsigned long)(1e9 * l.conns / (l.rate ? l.rate : 1) * i / w->cnt);
+        if(dial(w, c) < 0) w->errs++;
+    }
+
+    while((t = now()) < l.end)
+
+    {
+        // Queue, send and reconnect:
+        for(i=0, wake=l.end; i<w->cnt; i++)
+
+        {
+            c = &w->conn[i];
+            if(c->fd < 0 && dial(w, c) < 0){w->errs++; continue;}
+            if(l.churn && c->done == l.churn){hang(c); if(dial(w, c) < 0){w->errs++; continue;}}
+            feed(c, t);
+            if(push(c) < 0){lost(w, c); continue;}
+            if(l.rate && c->dcnt < l.depth && c->next < wake) wake = c->next;
+        }
+
+        // Wait for responses or the next due request:
+        t = now();
+        wake = l.rate == 0 ? 100000000 : wake > t ? wake - t : 0;
+        ts.tv_sec = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        if((n = epoll_pwait2(w->epfd, ev, EVENTS, &ts, NULL)) < 0){if(errno == EINTR){continue;} MyDBG(end1);}
+        t = now();
+
+        for(i=0; i<n; i++)
+
+        {
+            c = (PCONN)ev[i].data.ptr;
+            if(c->fd < 0) continue;
+
+            while((r = read(c->fd, c->rbuf + c->rlen, RBUF - c->rlen)) > 0)
+
+            {
+                // Handshake, accept and the first answer:
+                if(c->tcon){record(w->clat, t - c->tcon); c->tcon = 0; w->ups++;}
+                w->rbytes += r;
+                c->rlen += r;
+                if(parse(w, c, t) < 0){hang(c); w->errs++; break;}
+                if(c->bye) break;
+            }
+
+            if(c->fd >= 0 && (c->bye || r == 0 || errno != EAGAIN)) lost(w, c);
+        }
+    }
+
+    // Return:
+    end1: close(w->epfd);
+    for(i=0; i<w->cnt; i++) if(w->conn[i].fd >= 0) close(w->conn[i].fd);
+    end0: return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// quantile: latency (ns) at q over every worker's histogram.
+//-----------------------------------------------------------------------------
+
+unsigned long quantile(unsigned long *lat, unsigned long cnt, double q)
+
+{
+    int i;
+    unsigned long c = 0, want = (unsigned long)(q * cnt);
+
+    for(i=0; i<LAT_BUCKETS; i++) if((c += lat[i]) > want) return value(i);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    // Initializations:
+    int i, j;                      // For general use.
+    PWORKER w;                     // Workers.
+    unsigned long lat[LAT_BUCKETS] = { 0 }, clat[LAT_BUCKETS] = { 0 };
+    unsigned long ups = 0, reqs = 0, errs = 0, retries = 0, sheds = 0, conns = 0, rbytes = 0, max = 0;
+    double secs;
+    char pad[] = "X-Pad: ";
+    char *p;
+
+    // Defaults:
+    l.host = "127.0.0.1";
+    l.port = 8080;
+    l.threads = 1;
+    l.conns = 50;
+    l.depth = 1;
+    l.size = 0;
+    l.churn = 0;
+    l.rate = 0;
+    l.secs = 5;
+    l.label = "default";
+    l.path = "/";
+
+    // Parse command line options:
+    struct option longopts[] = {
+    { "host",           required_argument,  NULL,  'a' },
+    { "port",           required_argument,  NULL,  'p' },
+    { "threads",        required_argument,  NULL,  't' },
+    { "connections",    required_argument,  NULL,  'c' },
+    { "depth",          required_argument,  NULL,  'd' },
+    { "size",           required_argument,  NULL,  's' },
+    { "churn",          required_argument,  NULL,  'k' },
+    { "rate",           required_argument,  NULL,  'R' },
+    { "profile",        required_argument,  NULL,  'P' },
+    { "duration",       required_argument,  NULL,  'T' },
+    { "label",          required_argument,  NULL,  'l' },
+    { "url",            required_argument,  NULL,  'u' },
+    { 0, 0, 0, 0 }};
+
+    while((i = getopt_long(argc, argv, "a:p:t:c:d:s:k:R:P:T:l:u:", longopts, NULL)) != -1)
+
+    {
+        switch(i)
+
+        {
+            case 'a': l.host = optarg;
+                      break;
+            case 'p': l.port = atoi(optarg);
+                      break;
+            case 't': l.threads = atoi(optarg);
+                      break;
+            case 'c': l.conns = atoi(optarg);
+                      break;
+            case 'd': l.depth = atoi(optarg);
+                      break;
+            case 's': l.size = atoi(optarg);
+                      break;
+            case 'k': l.churn = atoi(optarg);
+                      break;
+            case 'R': l.rate = atof(optarg);
+                      break;
+            case 'P': for(p=optarg, l.phases=0; *p && l.phases < PHASES; l.phases++)
+
+                      {
+                          l.prate[l.phases] = strtod(p, &p);
+                          if(*p++ != ':' || l.prate[l.phases] <= 0) MyDBG(end0);
+                          l.psecs[l.phases] = (unsigned long)(strtod(p, &p) * 1e9);
+                          if(l.psecs[l.phases] == 0 || (*p && *p++ != ',')) MyDBG(end0);
+                      }
+                      break;
+            case 'T': l.secs = atof(optarg);
+                      break;
+            case 'l': l.label = optarg;
+                      break;
+            case 'u': l.path = optarg;
+                      break;
+            default:  fprintf(stderr, "usage: %s [-a host] [-p port] [-t threads] [-c connections] [-d depth] [-s size] [-k churn] [-R rate] [-P rate:secs,...] [-T secs] [-l label] [-u path]\n", argv[0]);
+                      return 1;
+        }
+    }
+
+    if(l.threads < 1 || l.conns < l.threads || l.depth < 1) MyDBG(end0);
+
+    // A profile is open loop, reported at its mean rate:
+    for(i=0, l.cycle=0, secs=0; i<l.phases; i++){l.cycle += l.psecs[i]; secs += l.prate[i] * l.psecs[i];}
+    if(l.phases) l.rate = secs / l.cycle;
+
+    // The request, padded up to size with a header:
+    j = snprintf(NULL, 0, "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", l.path, l.host);
+    if(l.size < j) l.size = j;
+    if(l.size > j && l.size < j + (int)sizeof(pad) + 1) l.size = j + sizeof(pad) + 1;
+    if((l.req = malloc((size_t)l.size * (l.depth + 1) + 1)) == NULL) MyDBG(end0);
+    i = sprintf(l.req, "GET %s HTTP/1.1\r\nHost: %s\r\n", l.path, l.host);
+    if(l.size > j){i += sprintf(l.req + i, "%s", pad); memset(l.req + i, 'x', l.size - j - sizeof(pad) - 1); i += l.size - j - sizeof(pad) - 1; i += sprintf(l.req + i, "\r\n");}
+    sprintf(l.req + i, "\r\n");
+    for(i=1; i<=l.depth; i++) memcpy(l.req + (size_t)i * l.size, l.req, l.size);
+
+    // Spread the connections over the workers:
+    if((w = calloc(l.threads, sizeof(WORKER))) == NULL) MyDBG(end1);
+    l.start = now();
+    l.end = l.start + (unsigned long)(l.secs * 1e9);
+
+    for(i=0; i<l.threads; i++)
+
+    {
+        w[i].cnt = l.conns / l.threads + (i < l.conns % l.threads);
+        if((w[i].conn = calloc(w[i].cnt, sizeof(CONN))) == NULL) MyDBG(end2);
+
+        for(j=0; j<w[i].cnt; j++)
+
+        {
+            w[i].conn[j].fd = -1;
+            if(l.conns > PER_ADDR && !strncmp(l.host, "127.", 4)) w[i].conn[j].src = 2 + (j * l.threads + i) / PER_ADDR;
+            if((w[i].conn[j].rbuf = malloc(RBUF)) == NULL) MyDBG(end2);
+            if((w[i].conn[j].due = malloc(l.depth * sizeof(unsigned long))) == NULL) MyDBG(end2);
+        }
+    }
+
+    for(i=0; i<l.threads; i++) if(pthread_create(&w[i].tid, NULL, W_Load, &w[i]) != 0) MyDBG(end2);
+    for(i=0; i<l.threads; i++) pthread_join(w[i].tid, NULL);
+    secs = (now() - l.start) / 1e9;
+
+    // Merge and report as one JSON line:
+    for(i=0; i<l.threads; i++)
+
+    {
+        reqs += w[i].reqs; errs += w[i].errs; retries += w[i].retries; sheds += w[i].sheds; conns += w[i].conns; rbytes += w[i].rbytes; ups += w[i].ups;
+        for(j=0; j<LAT_BUCKETS; j++){lat[j] += w[i].lat[j]; clat[j] += w[i].clat[j]; if(w[i].lat[j] && value(j) > max) max = value(j);}
+    }
+
+    printf("{\"label\":\"%s\",\"threads\":%d,\"connections\":%d,\"depth\":%d,\"size\":%d,\"churn\":%d,\"rate\":%.0f,"
+           "\"secs\":%.2f,\"requests\":%lu,\"rps\":%.0f,\"mbps\":%.1f,\"connects\":%lu,\"errors\":%lu,\"retries\":%lu,\"shed\":%lu,"
+           "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,"
+           "\"cps\":%.0f,\"connect_p50_us\":%.1f,\"connect_p99_us\":%.1f,\"connect_p999_us\":%.1f}\n",
+           l.label, l.threads, l.conns, l.depth, l.size, l.churn, l.rate,
+           secs, reqs, reqs / secs, rbytes * 8 / secs / 1e6, conns, errs, retries, sheds,
+           quantile(lat, reqs, 0.5) / 1e3, quantile(lat, reqs, 0.99) / 1e3, quantile(lat, reqs, 0.999) / 1e3, max / 1e3,
+           ups / secs, quantile(clat, ups, 0.5) / 1e3, quantile(clat, ups, 0.99) / 1e3, quantile(clat, ups, 0.999) / 1e3);
+    return 0;
+
+    // Return on error:
+    end2: free(w);
+    end1: free(l.req);
+    end0: return 1;
+}
@@ -30,110 +30,1706 @@
 //-----------------------------------------------------------------------------
 
 SERVER s;
-pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cnd = PTHREAD_COND_INITIALIZER;
 
 //-----------------------------------------------------------------------------
-// parser:
+// Prototypes:
 //-----------------------------------------------------------------------------
 
-int parser(char *buff, int len, PCLIENT cptr)
+int out(PCLIENT cptr);
+
+//-----------------------------------------------------------------------------
+// Handler API:
+//-----------------------------------------------------------------------------
+
+int bb_fd(PCLIENT cptr){return cptr->clifd;}
+void *bb_udata(PCLIENT cptr){return cptr->udata;}
+void bb_set_udata(PCLIENT cptr, void *udata){cptr->udata = udata;}
+void bb_want_write(PCLIENT cptr){cptr->wantw = 1;}
+void bb_close(PCLIENT cptr){cptr->bye = 1;}
+int bb_draining(void){return __atomic_load_n(&s.drain, __ATOMIC_RELAXED);}
+
+const char *bb_date(void){return bb_resp_date();}
+
+int bb_send(PCLIENT cptr, const void *buff, size_t len)
+
+{
+    if(cptr->out.head + cptr->out.cnt == OUT_SEGS && out(cptr) < 0) return -1;
+    return bb_resp_add(&cptr->out, cptr->core->bpool, buff, len, OUT_PIN);
+}
+
+int bb_send_static(PCLIENT cptr, const void *buff, size_t len)
+
+{
+    if(cptr->out.head + cptr->out.cnt == OUT_SEGS && out(cptr) < 0) return -1;
+    return bb_resp_add(&cptr->out, cptr->core->bpool, buff, len, OUT_STATIC);
+}
+
+int bb_send_copy(PCLIENT cptr, const void *buff, size_t len)
+
+{
+    if(cptr->out.head + cptr->out.cnt == OUT_SEGS && out(cptr) < 0) return -1;
+    return bb_resp_add(&cptr->out, cptr->core->bpool, buff, len, OUT_COPY);
+}
+
+int bb_send_file(PCLIENT cptr, int fd, off_t off, size_t len)
+
+{
+    if(cptr->out.head + cptr->out.cnt == OUT_SEGS && out(cptr) < 0) return -1;
+    return bb_resp_file(&cptr->out, cptr->core->bpool, fd, off, len);
+}
+
+int bb_send_hold(PCLIENT cptr, void *arg)
+
+{
+    if(cptr->out.head + cptr->out.cnt == OUT_SEGS && out(cptr) < 0) return -1;
+    return bb_resp_hold(&cptr->out, cptr->core->bpool, HOLD_HANDLER, arg);
+}
+
+void bb_cache(PCLIENT cptr, int ttl){cptr->cttl = ttl;}
+int bb_purge(const char *key, int klen){return s.rc ? bb_rcache_del(s.rc, key, klen) : 0;}
+
+//-----------------------------------------------------------------------------
+// handler: built-in protocol by name or plugin by path, NULL if not found.
+//-----------------------------------------------------------------------------
+
+PHANDLER handler(const char *name)
+
+{
+    int i;
+    void *dl;
+    PHANDLER builtin[] = { &bb_http, &bb_echo, &bb_static };
+
+    for(i=0; i<sizeof(builtin)/sizeof(builtin[0]); i++)
+    if(!strcmp(name, builtin[i]->name)) return builtin[i];
+
+    // Plugins stay loaded for the life of the process:
+    if((dl = dlopen(name, RTLD_NOW | RTLD_LOCAL)) == NULL) return NULL;
+    return (PHANDLER)dlsym(dl, BB_HANDLER_SYM);
+}
+
+//-----------------------------------------------------------------------------
+// rgrow: get a receive buffer or move to the next size class.
+//-----------------------------------------------------------------------------
+
+int rgrow(PCLIENT cptr)
+
+{
+    char *buff;
+    int cls = cptr->rbuf ? cptr->rcls + 1 : 0;
+
+    // Frames bigger than the largest class are refused:
+    if(cls == BUFF_CLASSES) return -1;
+    if((buff = bb_pool_get(&cptr->core->bpool[cls])) == NULL) return -1;
+
+    if(cptr->rbuf)
+
+    {
+        memcpy(buff, cptr->rbuf, cptr->rlen);
+        bb_pool_put(&cptr->core->bpool[cptr->rcls], cptr->rbuf);
+    }
+
+    cptr->rbuf = buff;
+    cptr->rcls = cls;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// rfree: idle clients do not hold a receive buffer.
+//-----------------------------------------------------------------------------
+
+void rfree(PCLIENT cptr)
+
+{
+    if(cptr->rbuf == NULL) return;
+    bb_pool_put(&cptr->core->bpool[cptr->rcls], cptr->rbuf);
+    cptr->rbuf = NULL;
+    cptr->rlen = cptr->roff = 0;
+}
+
+//-----------------------------------------------------------------------------
+// cfree: close the socket and give the client back to its core (only the
+// owner thread, it files the timers).
+//-----------------------------------------------------------------------------
+
+void cfree(PCLIENT cptr)
+
+{
+    bb_wheel_del(&cptr->core->wheel, &cptr->tmr);
+    if(cptr->tls){bb_tls_free(cptr->tls); cptr->tls = NULL;}
+    close(cptr->clifd);
+    STAT(closes);
+    rfree(cptr);
+    bb_resp_free(&cptr->out, cptr->core->bpool);
+    bb_pool_put(&cptr->core->cpool, cptr);
+}
+
+//-----------------------------------------------------------------------------
+// drop: close the connection and give the client back to its core.
+//-----------------------------------------------------------------------------
+
+void drop(PCLIENT cptr)
+
+{
+    PCORE core = cptr->core;
+
+    if(s.hnd->on_close) s.hnd->on_close(cptr);
+    if(s.cnf.mode == MODE_CORE){cfree(cptr); return;}
+
+    // Data-Workers hand the rest over to the owner, its wheel may still
+    // hold the client and the fd number must not be reused meanwhile:
+    shutdown(cptr->clifd, SHUT_RDWR);
+    rfree(cptr);
+    bb_resp_free(&cptr->out, core->bpool);
+    cptr->next = __atomic_load_n(&core->dead, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&core->dead, &cptr->next, cptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//-----------------------------------------------------------------------------
+// ticks: coarse monotonic clock in TIMER_TICK units.
+//-----------------------------------------------------------------------------
+
+unsigned long ticks(void)
+
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * (1000 / TIMER_TICK) + ts.tv_nsec / (TIMER_TICK * 1000000L);
+}
+
+//-----------------------------------------------------------------------------
+// tset: deadline for the state a round leaves the client in. Only a store,
+// the wheel is left to the owner thread (see expire).
+//-----------------------------------------------------------------------------
+
+void tset(PCLIENT cptr)
+
+{
+    int st = cptr->out.cnt > 0 ? T_WRITE : cptr->rlen > 0 || cptr->fresh ? T_HEAD : T_IDLE;
+    void *mark = st == T_WRITE ? cptr->out.iov[cptr->out.head].iov_base : NULL;
+
+    // No extension for a request trickling in or output that does not move:
+    if(st == cptr->tst && st != T_IDLE && mark == cptr->tmark) return;
+    cptr->tst = st;
+    cptr->tmark = mark;
+    __atomic_store_n(&cptr->dline, s.cnf.tmo[st] ? ticks() + s.cnf.tmo[st] : ULONG_MAX, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// tfile: (re)file the client's timer. Deadlines set from now on are tmin
+// away at least, so checking back that often is never late.
+//-----------------------------------------------------------------------------
+
+void tfile(PCLIENT cptr, unsigned long now)
+
+{
+    unsigned long d = __atomic_load_n(&cptr->dline, __ATOMIC_RELAXED);
+
+    if(s.cnf.tmin == 0) return;
+    bb_wheel_add(&cptr->core->wheel, &cptr->tmr, d < now + s.cnf.tmin ? d : now + s.cnf.tmin);
+}
+
+//-----------------------------------------------------------------------------
+// expire: shut the clients past their deadline (and, draining, the ones
+// between requests), the hang-up drops them the usual way. Owner thread
+// only.
+//-----------------------------------------------------------------------------
+
+void expire(PCORE core)
+
+{
+    PTIMER t, next;
+    PCLIENT cptr;
+    unsigned long d, now = ticks();
+
+    for(t=bb_wheel_advance(&core->wheel, now); t; t=next)
+
+    {
+        next = t->next;
+        cptr = (PCLIENT)((char *)t - offsetof(CLIENT, tmr));
+        d = __atomic_load_n(&cptr->dline, __ATOMIC_RELAXED);
+        if(d > now && !(core->quiet && cptr->tst == T_IDLE)){tfile(cptr, now); continue;}
+        shutdown(cptr->clifd, SHUT_RDWR);
+        if(d <= now) STAT(timeouts);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// answered: responses so far are with the kernel, time their requests.
+//-----------------------------------------------------------------------------
+
+void answered(PCLIENT cptr)
+
+{
+    if(cptr->nreq == 0) return;
+    TRACE(TR_WRITE, cptr);
+    HIST(lat, bb_stat_now() - cptr->treq, cptr->nreq);
+    cptr->nreq = 0;
+}
+
+//-----------------------------------------------------------------------------
+// out: push queued output, keep private copies of what has to wait.
+// Returns 1 when all is out, 0 if the socket is full and -1 on error.
+//-----------------------------------------------------------------------------
+
+int out(PCLIENT cptr)
+
+{
+    int n;
+
+    if(cptr->out.cnt > 0) STAT(flushes);
+
+    // Nothing before the TLS handshake is done, encrypted here unless the
+    // kernel does it. Corking only matters when Nagle's algorithm is off:
+    if(cptr->tls && cptr->tls->hs) n = 0;
+    else if(cptr->tls && !cptr->tls->ktx) n = bb_resp_write(&cptr->out, cptr->core->bpool, bb_tls_write, cptr->tls);
+    else n = bb_resp_flush(&cptr->out, cptr->core->bpool, cptr->clifd, s.cnf.zcopy, s.cnf.tcpnd && s.cnf.cork);
+    if(n == 0){cptr->wrdy = 0; if(bb_resp_pin(&cptr->out, cptr->core->bpool) < 0) return -1;}
+    if(n == 1) answered(cptr);
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// rpack: move the partial frame to the front of the receive buffer.
+//-----------------------------------------------------------------------------
+
+void rpack(PCLIENT cptr)
+
+{
+    if(cptr->roff == 0) return;
+    cptr->rlen -= cptr->roff;
+    memmove(cptr->rbuf, cptr->rbuf + cptr->roff, cptr->rlen);
+    cptr->roff = 0;
+}
+
+//-----------------------------------------------------------------------------
+// rroom: make room at the tail of the receive buffer.
+//-----------------------------------------------------------------------------
+
+int rroom(PCLIENT cptr)
+
+{
+    if(cptr->rbuf != NULL && cptr->rlen < BUFF_MIN << cptr->rcls) return 0;
+
+    // Queued output may still point into the consumed bytes:
+    if(cptr->out.cnt > 0 && out(cptr) < 0) return -1;
+
+    // Reuse consumed space or grow for frames that do not fit:
+    if(cptr->roff > 0){rpack(cptr); return 0;}
+    return rgrow(cptr);
+}
+
+//-----------------------------------------------------------------------------
+// refuse: answer every complete frame in buff as overloaded, returns the
+// bytes consumed or -1 to reset the client (no on_shed).
+//-----------------------------------------------------------------------------
+
+int refuse(PCLIENT cptr, char *buff, int len)
+
+{
+    int c = 0, n = 0;
+    struct linger lg = { 1, 0 };
+
+    cptr->shed = 0;
+    while(s.hnd->on_shed && n < len && !cptr->bye && (c = s.hnd->on_shed(cptr, buff + n, len - n)) > 0){n += c; STAT(sheds);}
+    if(s.hnd->on_shed && c >= 0) return n;
+
+    // Closed with SO_LINGER off, the peer gets an RST:
+    STAT(sheds);
+    setsockopt(cptr->clifd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// uncache: a cached response was sent or dropped.
+//-----------------------------------------------------------------------------
+
+void uncache(void *arg)
+
+{
+    bb_rcache_put(s.rc, (PRENT)arg);
+}
+
+//-----------------------------------------------------------------------------
+// serve: answer the frame at buff from the response cache or have the
+// handler do it, storing what it sent if it asked to (bb_cache). Returns
+// the bytes consumed like on_data.
+//-----------------------------------------------------------------------------
+
+int serve(PCLIENT cptr, char *buff, int len)
+
+{
+    static __thread char key[BB_KEY_MAX];
+    struct iovec v[OUT_SEGS];
+    int c, n, k, klen = 0, from;
+    unsigned int moves;
+    PRENT e;
+
+    // Not cacheable (or not complete yet), nor while draining: the handler
+    // says goodbye:
+    if(s.rc == NULL || bb_draining() || s.hnd->on_key == NULL || (c = s.hnd->on_key(cptr, buff, len, key, &klen)) <= 0 || klen <= 0) return s.hnd->on_data(cptr, buff, len);
+
+    // A hit goes by reference, pinned until it is out:
+    if((e = bb_rcache_get(s.rc, key, klen, bb_now)) != NULL)
+
+    {
+        STAT(chits);
+        if(cptr->out.head + cptr->out.cnt >= OUT_SEGS - 1 && out(cptr) < 0){bb_rcache_put(s.rc, e); return -1;}
+        if(bb_resp_add(&cptr->out, cptr->core->bpool, e->data + e->klen, e->len, OUT_STATIC) < 0){bb_rcache_put(s.rc, e); return -1;}
+        if(bb_resp_hold(&cptr->out, cptr->core->bpool, HOLD_CACHE, e) < 0){bb_rcache_put(s.rc, e); return -1;}
+        return c;
+    }
+
+    // A miss, what the handler queues from here on is the response unless
+    // the chain moved meanwhile (flushed or compacted):
+    STAT(cmisses);
+    moves = cptr->out.moves;
+    from = cptr->out.head + cptr->out.cnt;
+    cptr->cttl = 0;
+    if((n = s.hnd->on_data(cptr, buff, len)) != c || cptr->cttl <= 0 || cptr->bye || cptr->out.moves != moves) return n;
+    if((k = bb_resp_since(&cptr->out, from, v)) > 0) bb_rcache_set(s.rc, key, klen, v, k, bb_now, bb_now + cptr->cttl * 1000000000UL);
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// spare: 0 if the output chain can take another response, squashing what it
+// holds in memory or flushing it first if it has to and the socket takes
+// it. Otherwise the client is left full.
+//-----------------------------------------------------------------------------
+
+int spare(PCLIENT cptr)
+
+{
+    if(OUT_SEGS - cptr->out.cnt >= FRAME_ROOM) return 0;
+    if(bb_resp_squash(&cptr->out, cptr->core->bpool, FRAME_SQUASH) == 0 && OUT_SEGS - cptr->out.cnt >= FRAME_ROOM) return 0;
+    if(s.cnf.engine == ENGINE_EPOLL && cptr->wrdy && out(cptr) >= 0 && OUT_SEGS - cptr->out.cnt >= FRAME_ROOM) return 0;
+    cptr->full = 1;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// frames: feed every complete frame in buff to the handler, returns the
+// bytes consumed or -1 if the handler wants the client closed.
+//-----------------------------------------------------------------------------
+
+int frames(PCLIENT cptr, char *buff, int len)
+
+{
+    int c = 0, n = 0, k = 0;
+
+    // Overloaded, answered cheaply (or reset) instead:
+    if(cptr->shed){if((n = refuse(cptr, buff, len)) > 0){cptr->fresh = 0;} return n;}
+
+    // Latencies from the batch the bytes came in with: accept to first
+    // byte, request in to answered:
+    if(cptr->tacc){HIST(first, bb_now - cptr->tacc, 1); cptr->tacc = 0;}
+    if(cptr->nreq == 0) cptr->treq = bb_now;
+
+    // The handler sees all pending bytes from the start of the current frame
+    // (none after it said goodbye). The rest waits while the output chain
+    // has no room for a whole response, the client reading what it asked:
+    while(n < len && !cptr->bye && !spare(cptr) && (c = serve(cptr, buff + n, len - n)) > 0){n += c; k++;}
+    STAT_ADD(reqs, k);
+    if(k > 0) TRACE(TR_PARSE, cptr);
+    cptr->nreq += k;
+    if(n > 0) cptr->fresh = 0;
+    return c < 0 ? -1 : n;
+}
+
+//-----------------------------------------------------------------------------
+// dispatch: serve the frames in the receive buffer, keep the partial one.
+// Responses only pile up in the output chain, they are flushed once per
+// round by handle().
+//-----------------------------------------------------------------------------
+
+int dispatch(PCLIENT cptr)
+
+{
+    int n;
+
+    if((n = frames(cptr, cptr->rbuf + cptr->roff, cptr->rlen - cptr->roff)) < 0) return -1;
+    cptr->roff += n;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// ready: queue a client to be served on this core's next round.
+//-----------------------------------------------------------------------------
+
+void ready(PCLIENT cptr)
+
+{
+    PCORE core = cptr->core;
+
+    if(cptr->inq) return;
+    cptr->inq = 1;
+    cptr->next = NULL;
+    if(core->rtail) core->rtail->next = cptr; else core->rhead = cptr;
+    core->rtail = cptr;
+}
+
+//-----------------------------------------------------------------------------
+// hand: a TLS handshake step, 1 once done, 0 if it waits for the socket and
+// -1 on failure. The session goes if the kernel took both directions.
+//-----------------------------------------------------------------------------
+
+int hand(PCLIENT cptr)
+
+{
+    int n;
+
+    if((n = bb_tls_hand(cptr->tls)) < 0) return -1;
+    if(n == TLS_RD){cptr->rrdy = 0; return 0;}
+    if(n == TLS_WR){cptr->rrdy = cptr->wrdy = 0; return 0;}
+
+    STAT(tlshs);
+    if(cptr->tls->ktx) STAT(ktls);
+    if(cptr->tls->ktx && cptr->tls->krx){bb_tls_free(cptr->tls); cptr->tls = NULL;}
+
+    // Request bytes may have come along with the last flight:
+    cptr->rrdy = cptr->wrdy = 1;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// handle: serve one ready client, returns -1 on fatal error.
+//-----------------------------------------------------------------------------
+
+int handle(PCLIENT cptr)
+
+{
+    // Initializations:
+    int n, len, room;         // For general use.
+    int more;                 // TLS bytes decrypted or frames left, no event for them.
+    struct epoll_event ev;    // Epoll event structure.
+
+    // Readiness reported by epoll. Per-core clients are registered once as
+    // edge-triggered so it sticks until a call says EAGAIN, one-shot ones
+    // get it re-evaluated by every re-arm and always try to read:
+    ev.events = cptr->events; cptr->events = 0;
+    if(ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) || s.cnf.mode != MODE_CORE) cptr->rrdy = 1;
+    if(ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) cptr->wrdy = 1;
+
+    // Zero-copy completions are reported on the error queue:
+    if((ev.events & EPOLLERR) && cptr->out.zcs > 0) bb_resp_reap(&cptr->out, cptr->clifd);
+
+    // TLS handshake first, a step whenever the socket is ready for it:
+    if(cptr->tls && cptr->tls->hs && (n = hand(cptr)) <= 0){if(n < 0){drop(cptr); return 0;} goto arm;}
+
+    // Output left from the previous round goes first, the client does not
+    // get served until it reads its responses:
+    if(cptr->out.cnt > 0)
+
+    {
+        if(!cptr->wrdy) goto arm;
+        if((n = out(cptr)) < 0){drop(cptr); return 0;}
+        if(n == 0) goto arm;
+    }
+
+    // Writable again, let the handler resume its own output:
+    if(cptr->wrdy && cptr->wantw)
+
+    {
+        cptr->wantw = 0;
+        if(s.hnd->on_writable && s.hnd->on_writable(cptr) < 0){drop(cptr); return 0;}
+    }
+
+    // Frames left waiting for room go before anything new is read:
+    if(cptr->full){cptr->full = 0; if(dispatch(cptr) < 0){drop(cptr); return 0;}}
+
+    // Try to non-blocking read some data until it would block or MTU (or
+    // there is no room for the answers):
+    len = 0; read: if(len == MTU || !cptr->rrdy || cptr->bye || cptr->full) goto flush;
+
+    // Make room (exhaustion is counted by the pool):
+    if(rroom(cptr) < 0){drop(cptr); return 0;}
+    room = (BUFF_MIN << cptr->rcls) - cptr->rlen;
+    if(room > MTU-len) room = MTU-len;
+    n = cptr->tls && !cptr->tls->krx ? bb_tls_read(cptr->tls, cptr->rbuf + cptr->rlen, room) : read(cptr->clifd, cptr->rbuf + cptr->rlen, room);
+    STAT(reads);
+
+    // Carry partial frames over to the next read. A short read drained the
+    // socket (not a record from a TLS session), data arriving later raises
+    // a new edge:
+    if(n>0){len+=n; cptr->rlen+=n; STAT_ADD(rbytes, n); if(n<room && !(cptr->tls && !cptr->tls->krx)){cptr->rrdy = 0;} if(dispatch(cptr) < 0){drop(cptr); return 0;} goto read;}
+
+    // The call was interrupted by a signal before any data was read:
+    else if(n<0 && errno==EINTR) goto read;
+
+    // Client has terminated:
+    else if(n==0 || errno!=EAGAIN){drop(cptr); return 0;}
+
+    // Drained:
+    cptr->rrdy = 0;
+    STAT(eagains);
+
+    // Ok, it would block or enough data readed for this round. Send all the
+    // responses of the round at once:
+    flush: if(out(cptr) < 0){drop(cptr); return 0;}
+
+    // The handler said goodbye and it is all out:
+    arm: if(cptr->bye && cptr->out.cnt == 0){drop(cptr); return 0;}
+
+    // Pending output is pinned by now, the receive buffer can be packed:
+    rpack(cptr);
+    if(cptr->rlen == 0) rfree(cptr);
+    tset(cptr);
+    more = cptr->full || (cptr->tls && !cptr->tls->hs && !cptr->tls->krx && bb_tls_pending(cptr->tls));
+
+    // Per-core clients stay registered, no edge is coming for what is left
+    // unread (MTU, a TLS record, frames waiting for room) or for a handler
+    // waiting on an already writable socket:
+    if(s.cnf.mode == MODE_CORE)
+
+    {
+        if(((cptr->rrdy || more) && cptr->out.cnt == 0) || (cptr->wrdy && cptr->wantw)) ready(cptr);
+        return 0;
+    }
+
+    // Re-arm the trigger as one-shot-edge-triggered, a writable socket
+    // brings back a client with a TLS record or frames left:
+    ev.events = EPOLLET | EPOLLONESHOT;
+    if(cptr->tls && cptr->tls->hs) ev.events |= cptr->tls->hs == TLS_WR ? EPOLLOUT : EPOLLIN;
+    else ev.events |= cptr->out.cnt > 0 ? EPOLLOUT : EPOLLIN | (cptr->wantw || more ? EPOLLOUT : 0);
+    ev.data.ptr = (void *)cptr;
+    if(epoll_ctl(cptr->core->epfd, EPOLL_CTL_MOD, cptr->clifd, &ev) < 0) return -1;
+    STAT(arms);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// adapt: next busy-poll window from how long the last wait was idle. Gaps
+// shorter than the max window pull it towards twice their length, longer
+// ones towards 0 (spinning through them would only burn the CPU).
+//-----------------------------------------------------------------------------
+
+void adapt(PSPIN sp, unsigned long idle)
+
+{
+    unsigned long want = idle < sp->max ? 2 * idle : 0;
+
+    if(want > sp->max) want = sp->max;
+    sp->win = sp->win - sp->win / 4 + want / 4;
+}
+
+//-----------------------------------------------------------------------------
+// bpoll: poll the epoll set without sleeping for the spin window, returns
+// what epoll_wait() does (0 once the window is over).
+//-----------------------------------------------------------------------------
+
+int bpoll(PCORE core, struct epoll_event *ev, PSPIN sp)
+
+{
+    int i, n;
+    unsigned long t = bb_stat_now();
+
+    do
+
+    {
+        n = epoll_wait(core->epfd, ev, s.cnf.epoev, 0);
+        STAT(waits);
+        if(n != 0){if(n > 0){STAT(spins);} return n;}
+        for(i=0; i<SPIN_PAUSES; i++) CPU_RELAX();
+    }
+
+    while(bb_stat_now() - t < sp->win);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// take: next client for a Data-Worker, NULL if there is none. In steal mode
+// from its own core's deque first, then from every other one starting at a
+// random victim.
+//-----------------------------------------------------------------------------
+
+PCLIENT take(PFIFO fifo, PCORE home, unsigned int *seed)
+
+{
+    int i, v;
+    PCLIENT cptr;
+
+    if(home == NULL) return (PCLIENT)bb_fifo_pop(fifo);
+    if((cptr = (PCLIENT)bb_deque_steal(&home->dq)) != NULL){STAT(locals); return cptr;}
+
+    for(i=1, v=rand_r(seed) % s.cores; i<=s.cores; i++, v=(v + 1) % s.cores)
+
+    {
+        if(&s.core[v] == home) continue;
+        if((cptr = (PCLIENT)bb_deque_steal(&s.core[v].dq)) != NULL){STAT(steals); return cptr;}
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// park: next client for a Data-Worker, sleeps until there is one.
+//-----------------------------------------------------------------------------
+
+PCLIENT park(PFIFO fifo, PCORE home, unsigned int *seed)
+
+{
+    PCLIENT cptr;
+    unsigned int wake;
+
+    if(home == NULL) return (PCLIENT)bb_fifo_wait(fifo);
+
+    // Announce ourselves and look everywhere once more before sleeping, a
+    // Wait-Worker pushing meanwhile either sees us idle or we see its push:
+    do
+
+    {
+        atomic_fetch_add(&s.parked, 1);
+        wake = bb_deque_idle(&home->dq);
+        cptr = take(fifo, home, seed);
+        bb_deque_park(&home->dq, wake, cptr);
+        atomic_fetch_sub(&s.parked, 1);
+    }
+
+    while(cptr == NULL && (cptr = take(fifo, home, seed)) == NULL);
+    return cptr;
+}
+
+//-----------------------------------------------------------------------------
+// seat: a serving (on) Data-Worker steps down if its crew has more than the
+// controller wants, a benched one sleeps until it wants more.
+//-----------------------------------------------------------------------------
+
+void seat(PCREW crew, int on)
+
+{
+    int n = atomic_load_explicit(&crew->live, memory_order_relaxed);
+    unsigned int b;
+
+    if(on)
+
+    {
+        while(1)
+
+        {
+            if(n <= atomic_load_explicit(&crew->want, memory_order_relaxed)) return;
+            if(atomic_compare_exchange_weak(&crew->live, &n, n - 1)) break;
+        }
+    }
+
+    // The bench is read before want, so a raise in between fails the wait:
+    while(1)
+
+    {
+        b = atomic_load(&crew->bench);
+        n = atomic_load(&crew->live);
+        if(n < atomic_load(&crew->want)){if(atomic_compare_exchange_weak(&crew->live, &n, n + 1)) return; continue;}
+        syscall(SYS_futex, &crew->bench, FUTEX_WAIT_PRIVATE, b, NULL, NULL, 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// shed: whether a client queued for wait ns is answered as overloaded, CoDel
+// as servers use it. While the queue still empties now and then, only
+// clients queued for over an interval are. Once it has not for a whole
+// interval, a standing queue, every client over the target is. empty is the
+// caller's last time it took the last client queued.
+//-----------------------------------------------------------------------------
+
+int shed(unsigned long wait, unsigned long empty)
+
+{
+    return wait > (bb_now - empty < s.cnf.sival ? s.cnf.sival : s.cnf.starg);
+}
+
+//-----------------------------------------------------------------------------
+// W_Data:
+//-----------------------------------------------------------------------------
+
+void *W_Data(void *arg)
+
+{
+    // Initializations:
+    PCLIENT cptr = NULL;                 // Pointer to client data.
+    PCREW crew = (PCREW)arg;             // Crew this worker belongs to.
+    PCORE home = crew->home;             // Steal mode: the core it works for.
+    PFIFO fifo = crew->fifo;             // Shared mode: its node's FIFO.
+    SPIN spin = { s.cnf.bpoll * 1000, s.cnf.bpoll * 1000 };
+    unsigned long t;                     // Went idle (ns).
+    unsigned int seed = (uintptr_t)&t;   // Victims, differs per thread.
+    unsigned long empty = bb_stat_now(); // Shedding: last time the queue emptied.
+
+    // Pinned to a node (counters are not attributed to a core) or, in steal
+    // mode, to the core it works for. The controller reads them too:
+    if(bb_stat_new(home ? home - s.core : -1) < 0 || TRACE_NEW() < 0) MyDBG(end0);
+    __atomic_store_n(&crew->st[atomic_fetch_add(&crew->seated, 1)], bb_st, __ATOMIC_RELEASE);
+    seat(crew, 0);
+
+    // Main thread loop:
+    while(1)
+
+    {
+        // Benched while the crew is bigger than wanted:
+        seat(crew, 1);
+
+        // Pop a client or park until a Wait-Worker pushes one. Busy-poll
+        // spins on the queues first, a spinner is not woken by a syscall:
+        if(spin.max == 0) cptr = park(fifo, home, &seed);
+        else if((cptr = take(fifo, home, &seed)) == NULL)
+
+        {
+            for(t=bb_stat_now(); (cptr = take(fifo, home, &seed)) == NULL && bb_stat_now() - t < spin.win; ) CPU_RELAX();
+            if(cptr){STAT(spins);} else cptr = park(fifo, home, &seed);
+            adapt(&spin, bb_stat_now() - t);
+        }
+
+        STAT_NOW();
+        STAT(pops);
+        STAT_ADD(qwait, bb_now - cptr->tq);
+        if(s.cnf.starg && (home ? bb_deque_len(&home->dq) : bb_fifo_len(fifo)) == 0) empty = bb_now;
+        cptr->shed = s.cnf.starg && (cptr->events & EPOLLIN) && shed(bb_now - cptr->tq, empty);
+        TRACE_AT(TR_POP, cptr, bb_now);
+        if(handle(cptr) < 0) MyDBG(end0);
+        STAT_ADD(busy, bb_stat_now() - bb_now);
+    }
+
+    // Return on error:
+    end0: pthread_exit(NULL);
+}
+
+//-----------------------------------------------------------------------------
+// cnew: client for a freshly accepted socket, NULL (and closed) when the
+// core is full. Exhaustion is counted by the pool.
+//-----------------------------------------------------------------------------
+
+PCLIENT cnew(PCORE core, int fd)
+
+{
+    PCLIENT cptr;
+
+    if((cptr = bb_pool_get(&core->cpool)) == NULL){close(fd); return NULL;}
+    cptr->clifd = fd;
+    cptr->core = core;
+    cptr->udata = s.hnd->size ? (void *)(cptr + 1) : NULL;
+    cptr->events = cptr->rrdy = cptr->wrdy = cptr->inq = 0;
+    cptr->wantw = cptr->bye = cptr->full = 0;
+    cptr->rbuf = NULL;
+    cptr->rlen = cptr->roff = 0;
+    cptr->ops = cptr->rcv = cptr->calm = cptr->busy = cptr->gone = cptr->hcnt = 0;
+    cptr->tls = NULL;
+    bb_resp_init(&cptr->out);
+
+    // Timed until the first byte comes in:
+    STAT(accepts);
+    cptr->tacc = bb_now;
+    cptr->nreq = 0;
+
+    // The request header is due first:
+    cptr->tmr.prev = NULL;
+    cptr->tst = T_HEAD;
+    cptr->fresh = 1;
+    cptr->tmark = NULL;
+    cptr->dline = s.cnf.tmo[T_HEAD] ? ticks() + s.cnf.tmo[T_HEAD] : ULONG_MAX;
+    tfile(cptr, core->wheel.now);
+    return cptr;
+}
+
+//-----------------------------------------------------------------------------
+// admit: a full core stops accepting (the kernel's backlog holds the rest,
+// then SYNs are dropped) and starts again once under ACCEPT_RESUME of its
+// slots. Owner thread only.
+//-----------------------------------------------------------------------------
+
+void admit(PCORE core, int on)
+
+{
+    struct epoll_event ev;
+
+    if(core->paused != on || core->quiet) return;
+    core->paused = !on;
+    if(!on){STAT(pauses); epoll_ctl(core->epfd, EPOLL_CTL_DEL, core->srvfd, NULL); return;}
+    ev.events = s.cnf.rport ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    epoll_ctl(core->epfd, EPOLL_CTL_ADD, core->srvfd, &ev);
+}
+
+//-----------------------------------------------------------------------------
+// acce: drain the core's listen queue, returns -1 on fatal error.
+//-----------------------------------------------------------------------------
+
+int acce(PCORE core)
+
+{
+    // Initializations:
+    int fd, i;                // Client socket file descriptor and option.
+    PCLIENT cptr = NULL;      // Pointer to client data.
+    struct epoll_event ev;    // Epoll event structure.
+
+    // Non-blocking sockets straight from accept4, options (TCP_NODELAY)
+    // are inherited from the listener:
+    while(core->cpool.used < core->cap && (fd = accept4(core->srvfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+
+    {
+        // Initialize the client data structure, refuse it when the core is
+        // full:
+        if((cptr = cnew(core, fd)) == NULL) continue;
+
+        // TLS, the handshake starts with the first bytes in:
+        if(s.cnf.tls && (cptr->tls = bb_tls_new(fd)) == NULL){cfree(cptr); continue;}
+
+        // Opt-in, it costs a syscall per connection:
+        if(s.cnf.zcopy){i=1; setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &i, sizeof(i));}
+
+        // Let the protocol set up its state (maybe greet) or refuse the client:
+        if((s.hnd->on_accept && s.hnd->on_accept(cptr) < 0) || out(cptr) < 0){cfree(cptr); continue;}
+
+        // Epoll assignment, once and for good as edge-triggered on a per-core
+        // client, one-shot-edge-triggered when handed between threads:
+        if(s.cnf.mode == MODE_CORE) ev.events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        else ev.events = EPOLLET | EPOLLONESHOT | (cptr->out.cnt > 0 ? EPOLLOUT : EPOLLIN);
+        ev.data.ptr = (void *)cptr;
+        if(epoll_ctl(core->epfd, EPOLL_CTL_ADD, fd, &ev) < 0){drop(cptr); return -1;}
+    }
+
+    // Full, until some clients go:
+    if(core->cpool.used >= core->cap){admit(core, 0); return 0;}
+
+    // Queue drained, another core won the race or the client gave up:
+    if(errno==EAGAIN || errno==EINTR || errno==ECONNABORTED) return 0;
+
+    // Out of descriptors, retry on the next wake-up:
+    if(errno==EMFILE || errno==ENFILE || errno==ENOBUFS || errno==ENOMEM) return 0;
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// quiesce: draining, stop accepting on this core and check every client
+// now, the idle ones go. Owner thread only, returns -1 to retry.
+//-----------------------------------------------------------------------------
+
+int quiesce(PCORE core)
+
+{
+    struct io_uring_sqe *sqe;
+
+    // The listener stays open, for the new process or until we exit:
+    if(s.cnf.engine == ENGINE_EPOLL) epoll_ctl(core->epfd, EPOLL_CTL_DEL, core->srvfd, NULL);
+
+    else
+
+    {
+        if((sqe = bb_uring_sqe(&core->ring)) == NULL) return -1;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UD(NULL, OP_ACCEPT);
+        sqe->user_data = UD(NULL, OP_CANCEL);
+    }
+
+    bb_wheel_pull(&core->wheel, core->wheel.now + 1);
+    __atomic_store_n(&core->quiet, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// W_Wait:
+//-----------------------------------------------------------------------------
+
+void *W_Wait(void *arg)
+
+{
+    // Initializations:
+    int i, j, n, ms;                      // For general use.
+    PCORE core = (PCORE)arg;              // Core this worker is pinned to.
+    PCLIENT cptr, next;                   // Ready and dead lists walk.
+    struct epoll_event ev[s.cnf.epoev];   // Epoll-events array (C99).
+    SPIN spin = { s.cnf.bpoll * 1000, s.cnf.bpoll * 1000 };
+    unsigned long t = 0;                  // Went idle (ns), busy-poll only.
+
+    // Per-thread counters:
+    if(bb_stat_new(core - s.core) < 0 || TRACE_NEW() < 0) MyDBG(end0);
+
+    // Main thread loop:
+    while(1)
+
+    {
+        // Shutting down (the main thread wakes us up):
+        if(!core->quiet && __atomic_load_n(&s.drain, __ATOMIC_ACQUIRE)) quiesce(core);
+
+        // Free what the Data-Workers dropped, shut who timed out:
+        for(cptr=__atomic_exchange_n(&core->dead, NULL, __ATOMIC_ACQUIRE); cptr; cptr=next){next = cptr->next; cfree(cptr);}
+        expire(core);
+        if(core->paused && core->cpool.used < core->cap * ACCEPT_RESUME) admit(core, 1);
+
+        // Sleep until the next timer (just poll if clients are already
+        // waiting to be served). Data-Workers do not wake us up to free:
+        ms = bb_wheel_next(&core->wheel);
+        if(ms > 0) ms *= TIMER_TICK;
+        if(s.cnf.mode != MODE_CORE && (ms < 0 || ms > REAP_WAIT)) ms = REAP_WAIT;
+        if(core->rhead) ms = 0;
+
+        // Busy-poll the epoll set for the spin window before sleeping:
+        n = 0;
+        if(spin.max && ms != 0){t = bb_stat_now(); n = bpoll(core, &ev[0], &spin);}
+
+        // Wait up to s.cnf.epoev on the epoll-set:
+        if(n <= 0){n = epoll_wait(core->epfd, &ev[0], s.cnf.epoev, ms); STAT(waits);}
+        if(n<0){if(errno==EINTR){continue;} else{MyDBG(end0);}}
+        STAT_NOW();
+        if(spin.max && ms != 0) adapt(&spin, bb_now - t);
+
+        // For each event fired: new connections are accepted in place, if
+        // the fd is available to be read from (or written to) without
+        // blocking, it is transfered to the Data Workers pool or, in
+        // per-core mode, served right here on this core:
+        for(i=0; i<n; i++)
+
+        {
+            // The listener is registered with a NULL pointer:
+            if(ev[i].data.ptr == NULL)
+
+            {
+                if(acce(core) < 0) MyDBG(end0);
+            }
+
+            else
+
+            {
+                TRACE_AT(TR_WAIT, ev[i].data.ptr, bb_now);
+
+                // Run to completion without leaving the core, after the whole
+                // batch so a client is served (or dropped) once per round:
+                if(s.cnf.mode == MODE_CORE)
+
+                {
+                    ((PCLIENT)ev[i].data.ptr)->events |= ev[i].events;
+                    ready((PCLIENT)ev[i].data.ptr);
+                    continue;
+                }
+
+                // Hang-ups and errors show up as failed reads:
+                ((PCLIENT)ev[i].data.ptr)->events = ev[i].events;
+                ((PCLIENT)ev[i].data.ptr)->tq = bb_now;
+
+                // Push the client-data pointer to this node's Data-Workers
+                // (wakes a parked one), back off while the ring is full:
+                TRACE(TR_PUSH, ev[i].data.ptr);
+                if(s.cnf.mode == MODE_SHARED){while(bb_fifo_push(&s.fifo[core->node], ev[i].data.ptr) < 0) sched_yield(); continue;}
+
+                // Steal mode: to this core's deque. Wake one of its own
+                // Data-Workers or, if all are busy, a sleeping one of the
+                // nearest core (same node first) to steal it:
+                while(bb_deque_push(&core->dq, ev[i].data.ptr) < 0) sched_yield();
+                if(bb_deque_wake(&core->dq) || atomic_load(&s.parked) == 0) continue;
+                for(j=1; j<s.cores && !bb_deque_wake(&s.core[(core - s.core + j) % s.cores].dq); j++);
+            }
+        }
+
+        // Serve this round's ready list, clients coming back go to the next:
+        for(cptr=core->rhead, core->rhead=core->rtail=NULL; cptr; cptr=next)
+
+        {
+            next = cptr->next;
+            cptr->inq = 0;
+            if(handle(cptr) < 0) MyDBG(end0);
+        }
+    }
+
+    // Return on error:
+    end0: pthread_exit(NULL);
+}
+
+//-----------------------------------------------------------------------------
+// io_uring engine. Every core owns a ring with a multishot accept on its
+// listener and a recv per client into provided buffers. Like in handle(), a
+// client is not served while it has output in flight: the recv is cancelled
+// and buffers arriving meanwhile are held (up to URING_HOLD), so a slow
+// reader fills its own socket buffer instead of our memory.
+//
+// A multishot recv drains the whole socket before we see the first
+// completion, so clients start with single-shot recvs and only go
+// multishot once they stop pipelining ahead of us (URING_CALM).
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// uop: SQE on behalf of the client, NULL if the SQ stays full.
+//-----------------------------------------------------------------------------
+
+struct io_uring_sqe *uop(PCLIENT cptr, int op)
+
+{
+    struct io_uring_sqe *sqe;
+
+    if((sqe = bb_uring_sqe(&cptr->core->ring)) == NULL) return NULL;
+    sqe->fd = cptr->clifd;
+    sqe->user_data = UD(cptr, op);
+    cptr->ops++;
+    return sqe;
+}
+
+//-----------------------------------------------------------------------------
+// uread: arm (on) or cancel (!on) the client's recv.
+//-----------------------------------------------------------------------------
+
+int uread(PCLIENT cptr, int on)
+
+{
+    struct io_uring_sqe *sqe;
+
+    if(on)
+
+    {
+        if(cptr->rcv || cptr->gone) return 0;
+        if((sqe = uop(cptr, OP_RECV)) == NULL) return -1;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = cptr->calm < URING_CALM ? 0 : IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = cptr->core->ubuf.bgid;
+        cptr->rcv = 1;
+        return 0;
+    }
+
+    if(cptr->rcv != 1) return 0;
+    if((sqe = uop(cptr, OP_CANCEL)) == NULL) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UD(cptr, OP_RECV);
+    cptr->rcv = 2;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// usend: queue the whole output chain as one sendmsg (one in flight). A
+// chain with file ranges waits for POLLOUT instead, then goes out with
+// sendfile() (see upoll).
+//-----------------------------------------------------------------------------
+
+int usend(PCLIENT cptr)
+
+{
+    PCORE core = cptr->core;
+    struct io_uring_sqe *sqe;
+    struct msghdr *msg;
+
+    if(cptr->busy || cptr->gone || cptr->out.cnt == 0) return 0;
+
+    // Responses may point into buffers that are reused right after this:
+    if(bb_resp_pin(&cptr->out, core->bpool) < 0) return -1;
+
+    if(cptr->out.files > 0)
+
+    {
+        if((sqe = uop(cptr, OP_POLL)) == NULL) return -1;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+        cptr->busy = 1;
+        return 0;
+    }
+
+    // Segments and headers are copied by the kernel on submission, submit
+    // early if the scratch space runs out:
+    if(core->un + cptr->out.cnt > URING_IOVS || core->um == URING_ENTRIES)
+
+    {
+        if(bb_uring_enter(&core->ring, 0, -1) != 0) return -1;
+        STAT(enters);
+        core->un = core->um = 0;
+    }
+
+    if((sqe = uop(cptr, OP_SEND)) == NULL) return -1;
+    msg = &core->umsg[core->um++];
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = &core->uiov[core->un];
+    msg->msg_iovlen = bb_resp_iov(&cptr->out, msg->msg_iov);
+    core->un += msg->msg_iovlen;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    cptr->busy = 1;
+    STAT(flushes);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// ukeep: append to the receive buffer, returns -1 if it does not fit.
+//-----------------------------------------------------------------------------
+
+int ukeep(PCLIENT cptr, char *buff, int len)
+
+{
+    if(len == 0) return 0;
+    while(cptr->rbuf == NULL || (BUFF_MIN << cptr->rcls) - cptr->rlen < len) if(rgrow(cptr) < 0) return -1;
+    memcpy(cptr->rbuf + cptr->rlen, buff, len);
+    cptr->rlen += len;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// uhold: keep a provided buffer until the client can be served.
+//-----------------------------------------------------------------------------
+
+int uhold(PCLIENT cptr, int bid, int len)
+
+{
+    PCORE core = cptr->core;
+
+    if(cptr->hcnt == URING_HOLD) return -1;
+    core->unext[bid] = -1;
+    core->ulen[bid] = len;
+    if(cptr->hcnt++ == 0) cptr->hhead = bid; else core->unext[cptr->htail] = bid;
+    cptr->htail = bid;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// unhold: oldest held buffer (the caller gives it back), -1 if none.
+//-----------------------------------------------------------------------------
+
+int unhold(PCLIENT cptr)
+
+{
+    int bid = cptr->hhead;
+
+    if(cptr->hcnt == 0) return -1;
+    cptr->hhead = cptr->core->unext[bid];
+    cptr->hcnt--;
+    return bid;
+}
+
+//-----------------------------------------------------------------------------
+// uout: send what the handler queued, then read on only if nothing is in
+// flight.
+//-----------------------------------------------------------------------------
+
+int uout(PCLIENT cptr)
+
+{
+    if(usend(cptr) < 0) return -1;
+    if(cptr->out.cnt == 0){answered(cptr); if(cptr->bye) return -1;}
+
+    // Pinned by now, the receive buffer can be packed:
+    rpack(cptr);
+    if(cptr->rlen == 0) rfree(cptr);
+    tset(cptr);
+    return uread(cptr, !cptr->busy);
+}
+
+//-----------------------------------------------------------------------------
+// userve: feed received bytes to the handler and send the responses.
+//-----------------------------------------------------------------------------
+
+int userve(PCLIENT cptr, char *buff, int len)
+
+{
+    int c;
+
+    // Nothing pending, serve straight from buff and keep the partial frame
+    // only. Otherwise append and serve from the receive buffer:
+    if(cptr->rlen > 0)
+
+    {
+        if(ukeep(cptr, buff, len) < 0 || dispatch(cptr) < 0) return -1;
+    }
+
+    else if((c = frames(cptr, buff, len)) < 0 || ukeep(cptr, buff + c, len - c) < 0) return -1;
+
+    // Responses are pinned before buff goes back:
+    return uout(cptr);
+}
+
+//-----------------------------------------------------------------------------
+// udrop: close the client once the kernel holds none of its requests.
+//-----------------------------------------------------------------------------
+
+void udrop(PCLIENT cptr)
+
+{
+    int bid;
+
+    // Whatever is in flight completes (with errors) after the shutdown:
+    if(!cptr->gone)
+
+    {
+        if(s.hnd->on_close) s.hnd->on_close(cptr);
+        shutdown(cptr->clifd, SHUT_RDWR);
+        uread(cptr, 0);
+        while((bid = unhold(cptr)) >= 0) bb_ubuf_put(&cptr->core->ubuf, bid);
+        cptr->gone = 1;
+    }
+
+    if(cptr->ops > 0) return;
+    cfree(cptr);
+}
+
+//-----------------------------------------------------------------------------
+// urecv: recv completion, returns -1 if the client has to go.
+//-----------------------------------------------------------------------------
+
+int urecv(PCLIENT cptr, struct io_uring_cqe *cqe)
+
+{
+    PUBUF ubuf = &cptr->core->ubuf;
+    int bid = -1, n = cqe->res;
+
+    // The recv ended (single-shot, EOF, error, cancelled or out of buffers):
+    if(!(cqe->flags & IORING_CQE_F_MORE)){cptr->rcv = 0; cptr->ops--;}
+    if(cqe->flags & IORING_CQE_F_BUFFER) bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if(cptr->gone){udrop(cptr); n = 0; goto put;}
+    if(n == -ENOBUFS || n == -ECANCELED){n = uread(cptr, !cptr->busy); goto put;}
+    if(n <= 0){n = -1; goto put;}
+    STAT_ADD(rbytes, n);
+
+    // Output in flight, the buffer waits its turn (back to single-shot):
+    if(cptr->busy){cptr->calm = 0; if((n = uhold(cptr, bid, n)) == 0) return uread(cptr, 0); goto put;}
+
+    // Single-shot recvs leaving data behind mean the client runs ahead:
+    if(!(cqe->flags & IORING_CQE_F_MORE)) cptr->calm = cqe->flags & IORING_CQE_F_SOCK_NONEMPTY ? 0 : cptr->calm + 1;
+
+    n = userve(cptr, bb_ubuf_get(ubuf, bid), n);
+
+    // Return:
+    put: if(bid >= 0) bb_ubuf_put(ubuf, bid);
+    return n < 0 ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// usent: send completion, returns -1 if the client has to go.
+//-----------------------------------------------------------------------------
+
+int usent(PCLIENT cptr, int res)
+
+{
+    PUBUF ubuf = &cptr->core->ubuf;
+    int n, bid;
+
+    cptr->busy = 0;
+    cptr->ops--;
+
+    if(cptr->gone){udrop(cptr); return 0;}
+    if(res < 0) return -1;
+    STAT_ADD(wbytes, res);
+
+    // Short send, the rest goes right away:
+    if(!bb_resp_done(&cptr->out, cptr->core->bpool, res)) return usend(cptr);
+    answered(cptr);
+
+    // The handler said goodbye and it is all out:
+    if(cptr->bye) return -1;
+
+    // Writable again, let the handler resume its own output:
+    if(cptr->wantw)
+
+    {
+        cptr->wantw = 0;
+        if(s.hnd->on_writable && s.hnd->on_writable(cptr) < 0) return -1;
+    }
+
+    // Frames left waiting for room first, then what arrived in the
+    // meantime, in order, until busy again:
+    if(cptr->full){cptr->full = 0; if(dispatch(cptr) < 0) return -1;}
+    while(!cptr->busy && (bid = unhold(cptr)) >= 0)
+
+    {
+        n = userve(cptr, bb_ubuf_get(ubuf, bid), cptr->core->ulen[bid]);
+        bb_ubuf_put(ubuf, bid);
+        if(n < 0) return -1;
+    }
+
+    return uout(cptr);
+}
+
+//-----------------------------------------------------------------------------
+// upoll: writable, a chain with file ranges goes out synchronously (what
+// does not fit waits for the next POLLOUT). Returns -1 if the client has to
+// go.
+//-----------------------------------------------------------------------------
+
+int upoll(PCLIENT cptr, int res)
+
+{
+    if(res >= 0 && !cptr->gone && (res = bb_resp_flush(&cptr->out, cptr->core->bpool, cptr->clifd, 0, 0)) > 0) res = 0;
+    return usent(cptr, res);
+}
+
+//-----------------------------------------------------------------------------
+// uaccept: arm the accept on the core's listener. Multishot while a whole
+// backlog fits in the slab, it goes on taking clients until a cancel lands,
+// one at a time for the last LISTENQ slots.
+//-----------------------------------------------------------------------------
+
+int uaccept(PCORE core)
+
+{
+    struct io_uring_sqe *sqe;
+    int multi = core->cap - core->cpool.used > LISTENQ;
+
+    if((sqe = bb_uring_sqe(&core->ring)) == NULL) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = core->srvfd;
+    sqe->ioprio = multi ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = UD(NULL, OP_ACCEPT);
+    core->armed = multi ? 2 : 1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// uadmit: admit() for the ring, the accept is armed again unless the core is
+// full (or was, and is not under ACCEPT_RESUME yet). Retried every round.
+//-----------------------------------------------------------------------------
+
+void uadmit(PCORE core)
+
+{
+    if(core->armed || core->quiet) return;
+    if(core->cpool.used >= core->cap){if(!core->paused){core->paused = 1; STAT(pauses);} return;}
+    if(core->paused && core->cpool.used >= core->cap * ACCEPT_RESUME) return;
+    if(uaccept(core) == 0) core->paused = 0;
+}
+
+//-----------------------------------------------------------------------------
+// uacce: set up a client accepted by the ring.
+//-----------------------------------------------------------------------------
+
+void uacce(PCORE core, int fd)
+
+{
+    PCLIENT cptr;
+    struct io_uring_sqe *sqe;
+
+    if((cptr = cnew(core, fd)) == NULL) return;
+
+    // Nearly full, the multishot goes (armed one at a time from now on):
+    if(core->armed == 2 && core->cap - core->cpool.used <= LISTENQ && (sqe = bb_uring_sqe(&core->ring)))
+
+    {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UD(NULL, OP_ACCEPT);
+        sqe->user_data = UD(NULL, OP_CANCEL);
+        core->armed = 1;
+    }
+
+    // Let the protocol set up its state (maybe greet) or refuse the client:
+    if(s.hnd->on_accept && s.hnd->on_accept(cptr) < 0){cfree(cptr); return;}
+
+    if(uout(cptr) < 0) udrop(cptr);
+}
+
+//-----------------------------------------------------------------------------
+// W_Ring:
+//-----------------------------------------------------------------------------
+
+void *W_Ring(void *arg)
+
+{
+    // Initializations:
+    int n, ms;                        // For general use.
+    PCORE core = (PCORE)arg;          // Core this worker is pinned to.
+    PCLIENT cptr;                     // Pointer to client data.
+    struct io_uring_cqe *cqe;         // Completion being handled.
+    SPIN spin = { s.cnf.bpoll * 1000, s.cnf.bpoll * 1000 };
+    unsigned long t = 0;              // Went idle (ns), busy-poll only.
+
+    // Per-thread counters:
+    if(bb_stat_new(core - s.core) < 0 || TRACE_NEW() < 0) MyDBG(end0);
+
+    // The ring is set up by the only thread submitting to it:
+    if(bb_uring_new(&core->ring, URING_ENTRIES) < 0) MyDBG(end0);
+    if(bb_ubuf_new(&core->ring, &core->ubuf, URING_BUFS, BUFF_MIN, 0) < 0) MyDBG(end1);
+    if((core->uiov = malloc(URING_IOVS * sizeof(struct iovec))) == NULL) MyDBG(end2);
+    if((core->umsg = malloc(URING_ENTRIES * sizeof(struct msghdr))) == NULL) MyDBG(end3);
+    if((core->unext = malloc(URING_BUFS * sizeof(int))) == NULL) MyDBG(end4);
+    if((core->ulen = malloc(URING_BUFS * sizeof(int))) == NULL) MyDBG(end5);
+    core->un = core->um = 0;
+    if(uaccept(core) < 0) MyDBG(end6);
+
+    // Main thread loop:
+    while(1)
+
+    {
+        // Shutting down (the main thread wakes us up):
+        if(!core->quiet && __atomic_load_n(&s.drain, __ATOMIC_ACQUIRE)) quiesce(core);
+
+        // Submit the round's requests and wait for a completion or the next
+        // timer, scratch space is free once every SQE has been consumed:
+        ms = bb_wheel_next(&core->wheel);
+        cqe = NULL;
+
+        // Busy-poll: submit only, then spin on the completion ring (no
+        // syscall) for the window before waiting in the kernel:
+        if(spin.max)
+
+        {
+            t = bb_stat_now();
+            if((n = bb_uring_enter(&core->ring, 0, -1)) < 0) MyDBG(end6);
+            STAT(enters);
+            while((cqe = bb_uring_cqe(&core->ring)) == NULL && bb_stat_now() - t < spin.win) CPU_RELAX();
+            if(cqe) STAT(spins);
+        }
+
+        if(cqe == NULL){if((n = bb_uring_enter(&core->ring, 1, ms > 0 ? ms * TIMER_TICK : ms)) < 0){MyDBG(end6);} STAT(enters);}
+        if(n == 0) core->un = core->um = 0;
+        STAT_NOW();
+        if(spin.max) adapt(&spin, bb_now - t);
+
+        while((cqe = bb_uring_cqe(&core->ring)) != NULL)
+
+        {
+            cptr = (PCLIENT)UD_PTR(cqe->user_data);
+
+            switch(UD_OP(cqe->user_data))
+
+            {
+                // New client, the multishot may end on errors (EMFILE...)
+                // or be cancelled (nearly full, to drain):
+                case OP_ACCEPT: if(cqe->res >= 0) uacce(core, cqe->res);
+                                if(!(cqe->flags & IORING_CQE_F_MORE)) core->armed = 0;
+                                break;
+                case OP_RECV:   TRACE_AT(TR_WAIT, cptr, bb_now);
+                                if(urecv(cptr, cqe) < 0) udrop(cptr);
+                                break;
+                case OP_SEND:   if(usent(cptr, cqe->res) < 0) udrop(cptr);
+                                break;
+                case OP_POLL:   if(upoll(cptr, cqe->res) < 0) udrop(cptr);
+                                break;
+                case OP_CANCEL: if(cptr == NULL) break;
+                                cptr->ops--;
+                                if(cptr->gone) udrop(cptr);
+                                break;
+            }
+
+            bb_uring_seen(&core->ring);
+        }
+
+        // Shut who timed out, accept again (once some went if full):
+        expire(core);
+        uadmit(core);
+    }
+
+    // Return on error:
+    end6: free(core->ulen);
+    end5: free(core->unext);
+    end4: free(core->umsg);
+    end3: free(core->uiov);
+    end2: bb_uring_free(&core->ring); bb_ubuf_free(&core->ubuf); pthread_exit(NULL);
+    end1: bb_uring_free(&core->ring);
+    end0: pthread_exit(NULL);
+}
+
+//-----------------------------------------------------------------------------
+// listener: bound and listening socket, returns -1 on error.
+//-----------------------------------------------------------------------------
+
+int listener(void)
+
+{
+    // Initializations:
+    int fd, i = 1;                 // Socket file descriptor and option.
+    struct sockaddr_in srvaddr;    // IPv4 socket address structure.
+
+    // Server non-blocking socket. Go ahead and reuse it:
+    if((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) return -1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i)) < 0) goto end0;
+    if(s.cnf.rport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &i, sizeof(i)) < 0) goto end0;
+
+    // Accepted sockets inherit Nagle's setting from the listener:
+    if(s.cnf.tcpnd && setsockopt(fd, SOL_TCP, TCP_NODELAY, &i, sizeof(i)) < 0) goto end0;
+
+    // And the busy-poll window, best effort (over net.core.busy_read it
+    // takes CAP_NET_ADMIN, without a NIC queue it does nothing):
+    if(s.cnf.bpoll){setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &(int){s.cnf.bpoll}, sizeof(int)); setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &i, sizeof(i));}
+
+    // Initialize srvaddr:
+    bzero(&srvaddr, sizeof(srvaddr));
+    srvaddr.sin_family = AF_INET;
+    srvaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    srvaddr.sin_port = htons(LISTENP);
+
+    // Bind and listen:
+    if(bind(fd, (struct sockaddr *) &srvaddr, sizeof(srvaddr)) < 0) goto end0;
+    if(listen(fd, LISTENQ) < 0) goto end0;
+    return fd;
+
+    // Return on error:
+    end0: close(fd);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// admin: metrics listener on a Unix socket path (anything with a '/' or
+// without a ':'), a TCP port on loopback or a TCP HOST:PORT. Returns -1 on
+// error.
+//-----------------------------------------------------------------------------
+
+int admin(const char *where)
+
+{
+    // Initializations:
+    int fd = -1, i = 1, k;         // Socket file descriptor, option, failed.
+    char host[256], *port;         // TCP: where to bind.
+    struct sockaddr_un unaddr;     // Unix socket path.
+    struct addrinfo hints = { .ai_flags = AI_PASSIVE | AI_NUMERICSERV, .ai_socktype = SOCK_STREAM }, *ai;
+
+    // A path:
+    if(strchr(where, '/') || (!strchr(where, ':') && where[strspn(where, "0123456789")] != '\0'))
+
+    {
+        if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+        bzero(&unaddr, sizeof(unaddr));
+        unaddr.sun_family = AF_UNIX;
+        strncpy(unaddr.sun_path, where, sizeof(unaddr.sun_path) - 1);
+        unlink(where);
+        if(bind(fd, (struct sockaddr *) &unaddr, sizeof(unaddr)) < 0) goto end0;
+    }
+
+    // A bare port is loopback only, other addresses have to be asked for
+    // (0.0.0.0:PORT or [::]:PORT for all of them):
+    else
+
+    {
+        if(!strchr(where, ':')) snprintf(host, sizeof(host), "127.0.0.1:%s", where);
+        else snprintf(host, sizeof(host), "%s", where);
+        port = strrchr(host, ':');
+        *port++ = '\0';
+        if(host[0] == '[' && host[strlen(host) - 1] == ']'){memmove(host, host + 1, strlen(host) - 2); host[strlen(host) - 2] = '\0';}
+        if(host[0] == '\0' || port[0] == '\0' || port[strspn(port, "0123456789")] != '\0'){errno = EINVAL; return -1;}
+        if(getaddrinfo(host, port, &hints, &ai) != 0){errno = EADDRNOTAVAIL; return -1;}
+
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        k = fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i)) < 0 || bind(fd, ai->ai_addr, ai->ai_addrlen) < 0;
+        freeaddrinfo(ai);
+        if(k) goto end0;
+    }
+
+    if(listen(fd, ADMIN_LISTENQ) < 0) goto end0;
+    return fd;
+
+    // Return on error:
+    end0: if(fd >= 0) close(fd);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// exhausted: slab requests core turned down, full (every core with STAT_ALL,
+// the Data-Workers own none).
+//-----------------------------------------------------------------------------
+
+unsigned long exhausted(int core)
+
+{
+    int i, j;
+    unsigned long n = 0;
+
+    for(i=0; i<s.cores; i++)
+
+    {
+        if(core != STAT_ALL && core != i) continue;
+        n += s.core[i].cpool.fails;
+        for(j=0; j<BUFF_CLASSES; j++) n += s.core[i].bpool[j].fails;
+    }
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// crews: the elastic crews' sizing in the Prometheus text format.
+//-----------------------------------------------------------------------------
+
+void crews(FILE *f)
 
 {
-    int i;
-    char resp[] = { 0x48, 0x54, 0x54, 0x50, 0x2f, 0x31, 0x2e, 0x31, 
-                    0x20, 0x32, 0x30, 0x30, 0x20, 0x4f, 0x4b, 0x0d, 
-                    0x0a, 0x44, 0x61, 0x74, 0x65, 0x3a, 0x20, 0x54, 
-                    0x68, 0x75, 0x2c, 0x20, 0x32, 0x34, 0x20, 0x46, 
-                    0x65, 0x62, 0x20, 0x32, 0x30, 0x31, 0x31, 0x20, 
-                    0x31, 0x35, 0x3a, 0x35, 0x31, 0x3a, 0x34, 0x31, 
-                    0x20, 0x47, 0x4d, 0x54, 0x0d, 0x0a, 0x53, 0x65, 
-                    0x72, 0x76, 0x65, 0x72, 0x3a, 0x20, 0x41, 0x70, 
-                    0x61, 0x63, 0x68, 0x65, 0x0d, 0x0a, 0x4c, 0x61, 
-                    0x73, 0x74, 0x2d, 0x4d, 0x6f, 0x64, 0x69, 0x66, 
-                    0x69, 0x65, 0x64, 0x3a, 0x20, 0x4d, 0x6f, 0x6e, 
-                    0x2c, 0x20, 0x31, 0x33, 0x20, 0x41, 0x75, 0x67, 
-                    0x20, 0x32, 0x30, 0x30, 0x37, 0x20, 0x31, 0x38, 
-                    0x3a, 0x34, 0x38, 0x3a, 0x33, 0x31, 0x20, 0x47, 
-                    0x4d, 0x54, 0x0d, 0x0a, 0x45, 0x54, 0x61, 0x67, 
-                    0x3a, 0x20, 0x22, 0x31, 0x63, 0x37, 0x38, 0x30, 
-                    0x33, 0x37, 0x2d, 0x62, 0x2d, 0x32, 0x62, 0x63, 
-                    0x39, 0x39, 0x64, 0x63, 0x30, 0x22, 0x0d, 0x0a, 
-                    0x41, 0x63, 0x63, 0x65, 0x70, 0x74, 0x2d, 0x52, 
-                    0x61, 0x6e, 0x67, 0x65, 0x73, 0x3a, 0x20, 0x62, 
-                    0x79, 0x74, 0x65, 0x73, 0x0d, 0x0a, 0x43, 0x6f, 
-                    0x6e, 0x74, 0x65, 0x6e, 0x74, 0x2d, 0x4c, 0x65, 
-                    0x6e, 0x67, 0x74, 0x68, 0x3a, 0x20, 0x31, 0x31, 
-                    0x0d, 0x0a, 0x43, 0x6f, 0x6e, 0x74, 0x65, 0x6e, 
-                    0x74, 0x2d, 0x54, 0x79, 0x70, 0x65, 0x3a, 0x20, 
-                    0x74, 0x65, 0x78, 0x74, 0x2f, 0x68, 0x74, 0x6d, 
-                    0x6c, 0x3b, 0x20, 0x63, 0x68, 0x61, 0x72, 0x73, 
-                    0x65, 0x74, 0x3d, 0x55, 0x54, 0x46, 0x2d, 0x38, 
-                    0x0d, 0x0a, 0x0d, 0x0a, 0x48, 0x65, 0x6c, 0x6c, 
-                    0x6f, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x0a };
-
-    for(i=0; i<len; i++)
-
-    {
-        if(buff[i]=='\x0d' && buff[i+1]=='\x0a' && buff[i+2]=='\x0d' && buff[i+3]=='\x0a')
+    int i, j;
+    char lbl[32];
+    PCREW c;
+
+    static const struct {const char *name, *type, *help;} m[] = {
+    { "bb_data_workers",             "gauge",   "Data-Workers serving, the rest sleep."  },
+    { "bb_data_workers_wanted",      "gauge",   "Data-Workers the controller wants."     },
+    { "bb_data_workers_threads",     "gauge",   "Data-Worker threads created."           },
+    { "bb_data_workers_utilization", "gauge",   "Busy Data-Workers last tick."           },
+    { "bb_data_queue_wait_seconds",  "gauge",   "Mean time queued last tick."            },
+    { "bb_data_cpu_utilization",     "gauge",   "Share of the crew's CPUs busy lately."  },
+    { "bb_data_grows_total",         "counter", "Times the crew was grown."              },
+    { "bb_data_shrinks_total",       "counter", "Times the crew was shrunk."             }};
+
+    for(j=0; j<sizeof(m)/sizeof(m[0]); j++)
+
+    {
+        fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", m[j].name, m[j].help, m[j].name, m[j].type);
+
+        for(i=0; i<s.crews; i++)
 
         {
-            //printf("[%d]\n", cptr->clifd);
-            write(cptr->clifd, resp, sizeof(resp));
-            break;
+            c = &s.crew[i];
+            if(c->home) snprintf(lbl, sizeof(lbl), "core=\"%d\"", (int)(c->home - s.core));
+            else snprintf(lbl, sizeof(lbl), "node=\"%d\"", (int)(c->fifo - s.fifo));
+
+            switch(j)
+
+            {
+                case 0: fprintf(f, "%s{%s} %d\n", m[j].name, lbl, atomic_load(&c->live)); break;
+                case 1: fprintf(f, "%s{%s} %d\n", m[j].name, lbl, atomic_load(&c->want)); break;
+                case 2: fprintf(f, "%s{%s} %d\n", m[j].name, lbl, c->made); break;
+                case 3: fprintf(f, "%s{%s} %.3f\n", m[j].name, lbl, c->util); break;
+                case 4: fprintf(f, "%s{%s} %.9f\n", m[j].name, lbl, c->wait / 1e9); break;
+                case 5: fprintf(f, "%s{%s} %.3f\n", m[j].name, lbl, c->load); break;
+                case 6: fprintf(f, "%s{%s} %lu\n", m[j].name, lbl, c->grows); break;
+                case 7: fprintf(f, "%s{%s} %lu\n", m[j].name, lbl, c->shrinks); break;
+            }
         }
     }
-
-    return 0;
 }
 
 //-----------------------------------------------------------------------------
-// W_Data:
+// W_Admin: answer every connection with the metrics (Prometheus text
+// format) and close it. Off the data path, unpinned and blocking.
 //-----------------------------------------------------------------------------
 
-void *W_Data(void *arg)
+void *W_Admin(void *arg)
 
 {
     // Initializations:
-    PCLIENT cptr = NULL;      // Pointer to client data.
-    char buff[MTU];           // Will store RX data.
-    int n, len;               // For general use.
-    struct epoll_event ev;    // Epoll event structure.
-
-    // Setup epoll behavior as one-shot-edge-triggered:
-    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    int i, fd, srv = (int)(intptr_t)arg;   // Admin listener and client.
+    char buff[1024], *text;                // Request and reply.
+    size_t len, n, q;                      // Reply length, bytes sent and queued.
+    ssize_t w;                             // Bytes sent (or read) by a call.
+    FILE *f;                               // Reply stream.
+    struct timeval tv = { 1, 0 };          // Admin clients are not waited for.
 
-    // Main thread loop:
     while(1)
 
     {
-        // Critical section:
-        if(pthread_mutex_lock(&mtx) != 0) MyDBG(end0);
-        while(bb_fifo_empty(&s.fifo)){if(pthread_cond_wait(&cnd, &mtx) != 0) MyDBG(end0);}
-        cptr = (PCLIENT)s.fifo.cap->nxt->cptr; bb_fifo_pop(&s.fifo);
-        if(pthread_mutex_unlock(&mtx) != 0) MyDBG(end0);
+        if((fd = accept(srv, NULL, NULL)) < 0){if(errno==EINTR || errno==ECONNABORTED){continue;} else{MyDBG(end0);}}
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 
-        // Try to non-blocking read some data until it would block or MTU:
-        len = 0; read: n = read(cptr->clifd, &buff, MTU-len);
-        if(n>0){len+=n; if(parser(buff, n, cptr) < 0){MyDBG(end0);} goto read;}
+        // The reply is built first and sent without SIGPIPE:
+        if((w = read(fd, buff, sizeof(buff) - 1)) <= 0 || (f = open_memstream(&text, &len)) == NULL){close(fd); continue;}
+        buff[w] = '\0';
 
-        // Ok, it would block or enough data readed for this round:
-        else if((n<0 && errno==EAGAIN) || (n==0 && len==MTU))
+        // Trace dumps (make TRACE=1) as Chrome JSON or binary records,
+        // metrics for anything else:
+        if(TRACE_ON && !strncmp(buff, "GET /trace", 10))
 
         {
-            // Re-arm the trigger:
-            ev.data.ptr = (void *)cptr;
-            if(epoll_ctl(cptr->epfd, EPOLL_CTL_MOD, cptr->clifd, &ev) < 0) MyDBG(end0);
+            i = strncmp(buff + 10, ".bin", 4) != 0;
+            fprintf(f, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nConnection: close\r\n\r\n", i ? "application/json" : "application/octet-stream");
+            TRACE_DUMP(f, i);
         }
 
-        // The call was interrupted by a signal before any data was read:
-        else if(n<0 && errno==EINTR) goto read;
+        else
+
+        {
+            fprintf(f, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+            for(i=0, q=0; i<s.topo.nodes; i++) q += bb_fifo_len(&s.fifo[i]);
+            for(i=0; i<s.cores && s.cnf.mode == MODE_STEAL; i++) q += bb_deque_len(&s.core[i].dq);
+            bb_stat_prom(f, s.cores, q);
+            fprintf(f, "# HELP bb_pool_exhausted_total Slab requests turned down, full.\n# TYPE bb_pool_exhausted_total counter\n");
+            for(i=0; i<s.cores; i++) fprintf(f, "bb_pool_exhausted_total{core=\"%d\"} %lu\n", i, exhausted(i));
+            crews(f);
+        }
 
-        // Server has closed the socket:
-        else if(n<0 && errno==EBADF) free(cptr);
+        fclose(f);
 
-        // Client has terminated:
-        else {close(cptr->clifd); free(cptr);}
+        for(n=0; n<len && (w = send(fd, text + n, len - n, MSG_NOSIGNAL)) > 0; n+=w);
+        free(text);
+        close(fd);
     }
 
     // Return on error:
@@ -141,106 +1737,398 @@ void *W_Data(void *arg)
 }
 
 //-----------------------------------------------------------------------------
-// W_Wait:
+// span: cores on a node, they are numbered node by node.
 //-----------------------------------------------------------------------------
 
-void *W_Wait(void *arg)
+int span(int node, int *first)
 
 {
-    // Initializations:
-    int i, n;                             // For general use.
-    struct epoll_event ev[s.cnf.epoev];   // Epoll-events array (C99).
+    int i, n = 0;
 
-    // Main thread loop:
-    while(1)
+    for(i=0, *first=0; i<s.cores; i++) if(s.core[i].node == node && n++ == 0) *first = i;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// steer: ask the kernel to pick the reuseport socket of the receiving CPU's
+// core. A CPU we do not run on (NIC queue IRQs, isolated CPUs) maps to the
+// cores of its own node in turn, and to any core without one.
+//-----------------------------------------------------------------------------
+
+int steer(int fd)
+
+{
+    int c, i, k, f, n = 0, r;
+    int turn[TOPO_CPUS] = { 0 };
+    struct sock_filter *code;
+    struct sock_fprog prog;
+
+    // if(cpu == c) return c's socket index, per online CPU (listeners are
+    // bound in core order), else cpu % cores:
+    if((code = malloc((2 * TOPO_CPUS + 3) * sizeof(struct sock_filter))) == NULL) return -1;
+    code[n++] = (struct sock_filter){ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU };
+
+    for(c=0; c<TOPO_CPUS; c++)
 
     {
-        // Wait up to s.cnf.epoev on the epoll-set:
-        wait: n = epoll_wait((intptr_t)arg, &ev[0], s.cnf.epoev, -1);
-        if(n<0){if(errno==EINTR){goto wait;} else{MyDBG(end0);}}
+        if(!CPU_ISSET(c, &s.topo.online)) continue;
+        for(i=0; i<s.cores && s.core[i].cpu != c; i++);
+        if(i == s.cores && (k = span(s.topo.node[c], &f)) > 0) i = f + turn[s.topo.node[c]]++ % k;
+        if(i == s.cores) i = c % s.cores;
+        code[n++] = (struct sock_filter){ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, c };
+        code[n++] = (struct sock_filter){ BPF_RET | BPF_K, 0, 0, i };
+    }
 
-        // For each event fired: if the fd is available to be read from
-        // without blocking, it is transfered to the Data Workers pool:
-        for(i=0; i<n; i++)
+    code[n++] = (struct sock_filter){ BPF_ALU | BPF_MOD | BPF_K, 0, 0, s.cores };
+    code[n++] = (struct sock_filter){ BPF_RET | BPF_A, 0, 0, 0 };
+
+    prog.len = n;
+    prog.filter = code;
+    r = setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    free(code);
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+// share: Data-Workers of cores [f, f+k) out of n, by their share of all the
+// cores (one at least, their FIFO or deques must be drained).
+//-----------------------------------------------------------------------------
+
+int share(int n, int f, int k)
+
+{
+    int m = n * (f + k) / s.cores - n * f / s.cores;
+
+    return m > 0 ? m : 1;
+}
+
+//-----------------------------------------------------------------------------
+// workers: Data-Workers for a node out of n (one crew per core in steal
+// mode).
+//-----------------------------------------------------------------------------
+
+int workers(int node, int n)
+
+{
+    int i, m, f, k = span(node, &f);
+
+    if(k == 0) return 0;
+    if(s.cnf.mode != MODE_STEAL) return share(n, f, k);
+    for(i=f, m=0; i<f+k; i++) m += share(n, i, 1);
+    return m;
+}
+
+//-----------------------------------------------------------------------------
+// hire: one more Data-Worker for the crew, it starts benched.
+//-----------------------------------------------------------------------------
+
+int hire(PCREW crew)
+
+{
+    int r;
+    pthread_t t;
+    pthread_attr_t a;
+
+    if(crew->made == crew->max || pthread_attr_init(&a) != 0) return -1;
+    pthread_attr_setaffinity_np(&a, sizeof(cpu_set_t), &crew->cpus);
+    pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+    if((r = pthread_create(&t, &a, W_Data, (void *)crew)) == 0) crew->made++;
+    pthread_attr_destroy(&a);
+    return r == 0 ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+// elastic: size every crew from its last tick. Grow when the serving threads
+// are nearly all busy and clients wait for them (a blocking handler counts
+// as busy) but their CPUs are not, more threads would only queue for them:
+// by half, or by the clients queued if more. Shrink by one per tick once one
+// thread less would have been under CTL_LOW for CTL_CALM ticks, so bursts
+// find the crew still sized. Threads are created on the way up only, the
+// surplus sleeps on the bench.
+//-----------------------------------------------------------------------------
+
+void elastic(void)
+
+{
+    int i, j, n, want, live;
+    unsigned long busy, pops, qwait, idle, all, now = bb_stat_now(), dt = now - s.ctl;
+    size_t q;
+    PCREW c;
+    PSTATS st;
+
+    for(i=0, s.ctl=now; i<s.crews; i++)
+
+    {
+        c = &s.crew[i];
+
+        // What its threads did since the last tick:
+        for(j=0, busy=pops=qwait=0; j<c->made; j++)
 
         {
-            if(ev[i].events & EPOLLIN)
+            if((st = __atomic_load_n(&c->st[j], __ATOMIC_ACQUIRE)) == NULL) continue;
+            busy += st->busy; pops += st->pops; qwait += st->qwait;
+        }
 
-            {
-                // Enter the critical section:
-                if(pthread_mutex_lock(&mtx) != 0) MyDBG(end0);
+        // How busy its CPUs are, by anyone. Jiffies are coarse, a look
+        // waits for CTL_JIFFIES of them per CPU:
+        if(bb_topo_idle(&c->cpus, &idle, &all) == 0 && all - c->all >= CTL_JIFFIES * CPU_COUNT(&c->cpus))
+
+        {
+            c->load = 1 - (double)(idle - c->idle) / (all - c->all);
+            c->idle = idle; c->all = all;
+        }
 
-                // Push the client-data pointer:
-                if(bb_fifo_push(&s.fifo, ev[i].data.ptr) < 0) MyDBG(end0);
+        live = atomic_load(&c->live);
+        want = atomic_load(&c->want);
+        q = c->home ? bb_deque_len(&c->home->dq) : bb_fifo_len(c->fifo);
+        c->util = (double)(busy - c->busy) / dt;
+        c->wait = pops > c->pops ? (double)(qwait - c->qwait) / (pops - c->pops) : 0;
+        c->busy = busy; c->pops = pops; c->qwait = qwait;
 
-                // Signal to awake sleeping thread:
-                if(pthread_cond_signal(&cnd) != 0) MyDBG(end0);
+        // Busy threads over the tick against the serving ones:
+        if(want < c->max && c->util > CTL_HIGH * live && (q > 0 || c->wait > CTL_WAIT) && c->load < CTL_HIGH)
 
-                // Leave the critical section:
-                if(pthread_mutex_unlock(&mtx) != 0) MyDBG(end0);
-            }
+        {
+            n = q > want / 2 ? q : want / 2;
+            want += n > 0 ? n : 1;
+            if(want > c->max) want = c->max;
+            c->grows++;
+            c->calm = 0;
+        }
+
+        else if(want > c->min && c->util < CTL_LOW * (want - 1) && c->wait < CTL_WAIT)
 
-            else {printf("Event is not: EPOLLIN\n");}
+        {
+            if(++c->calm >= CTL_CALM){want--; c->shrinks++;}
         }
+
+        else c->calm = 0;
+
+        // Raise want first, the bench is bumped after (see seat):
+        if(want == atomic_load(&c->want)) continue;
+        atomic_store(&c->want, want);
+        while(c->made < want && hire(c) == 0);
+        if((n = want - live) <= 0) continue;
+        atomic_fetch_add(&c->bench, 1);
+        syscall(SYS_futex, &c->bench, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// placement: where the workers run, to syslog.
+//-----------------------------------------------------------------------------
+
+void placement(void)
+
+{
+    int n, i, f, k, len;
+    char cpus[256], dw[32];
+    int data = s.cnf.mode != MODE_CORE && s.cnf.engine == ENGINE_EPOLL;
+
+    syslog(LOG_INFO, "placement: %d cores on %d usable cpus (%d smt siblings), %d nodes",
+           s.cores, s.topo.ncpu, s.topo.smt, s.topo.nodes);
+
+    // One line per node: cores, their CPUs in core order and Data-Workers:
+    for(n=0; n<s.topo.nodes; n++)
+
+    {
+        if((k = span(n, &f)) == 0) continue;
+        for(i=f, len=0, cpus[0]='\0'; i<f+k && len<(int)sizeof(cpus)-16; i++) len += sprintf(cpus + len, "%s%d", i>f ? "," : "", s.core[i].cpu);
+        if(i < f+k) strcat(cpus, ",...");
+        if(!data) strcpy(dw, "0");
+        else if(s.cnf.dmin == s.cnf.dmax) snprintf(dw, sizeof(dw), "%d", workers(n, s.cnf.dmin));
+        else snprintf(dw, sizeof(dw), "%d-%d", workers(n, s.cnf.dmin), workers(n, s.cnf.dmax));
+        syslog(LOG_INFO, "placement: node %d, cores %d-%d on cpus %s, %s data-workers", n, f, f+k-1, cpus, dw);
     }
+}
+
+//-----------------------------------------------------------------------------
+// sig_int: SIGINT or SIGTERM, ask the main loop to drain and quit.
+//-----------------------------------------------------------------------------
+
+void sig_int(int signo)
+
+{
+    s.quit++;
+}
+
+//-----------------------------------------------------------------------------
+// sig_usr1: ask the main loop for a counters report.
+//-----------------------------------------------------------------------------
+
+void sig_usr1(int signo)
+
+{
+    s.rprt = 1;
+}
+
+//-----------------------------------------------------------------------------
+// sig_usr2: ask the main loop for a reload.
+//-----------------------------------------------------------------------------
+
+void sig_usr2(int signo)
+
+{
+    s.rload = 1;
+}
+
+//-----------------------------------------------------------------------------
+// sig_wake: nothing, only interrupts a worker's wait.
+//-----------------------------------------------------------------------------
+
+void sig_wake(int signo)
+
+{
+}
+
+//-----------------------------------------------------------------------------
+// reload: run the binary again with our arguments and hand it the listeners
+// over a socket. Returns 0 once it serves (we drain then) or -1 if it does
+// not within RELOAD_WAIT, we keep serving.
+//-----------------------------------------------------------------------------
+
+int reload(void)
+
+{
+    // Initializations:
+    int i, n = 0, sv[2];           // For general use and the socket pair.
+    int fds[TOPO_CPUS];            // Listeners in core order.
+    char env[16], c;               // Socket number for the child, its ready.
+    pid_t pid;                     // Child, it daemonizes on its own.
+    struct pollfd pfd;             // Waits for the ready.
+    time_t end = time(NULL) + RELOAD_WAIT;
+
+    syslog(LOG_INFO, "reload: starting %s", s.exe);
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) MyDBG(end0);
+    snprintf(env, sizeof(env), "%d", sv[1]);
+    if(setenv(RELOAD_ENV, env, 1) < 0) MyDBG(end1);
+
+    // Threads around, only async-signal-safe calls until the exec:
+    if((pid = fork()) == 0){fcntl(sv[1], F_SETFD, 0); if(chdir(s.cwd) == 0) execv(s.exe, s.argv); _exit(127);}
+    unsetenv(RELOAD_ENV);
+    if(pid < 0) MyDBG(end1);
+    close(sv[1]);
+
+    // The admin listener first, then one per core (or the shared one):
+    for(i=0; i<s.cores; i++) if(i == 0 || s.cnf.rport) fds[n++] = s.core[i].srvfd;
+    if(sendfds(sv[0], &s.afd, s.afd >= 0) < 0 || sendfds(sv[0], fds, n) < 0) MyDBG(end2);
+
+    // A byte once its workers run, EOF if it gave up:
+    pfd.fd = sv[0];
+    pfd.events = POLLIN;
+    while((i = poll(&pfd, 1, 1000)) <= 0 && time(NULL) < end){bb_resp_tick(); waitpid(pid, NULL, WNOHANG);}
+    if(i <= 0 || read(sv[0], &c, 1) != 1) MyDBG(end2);
+
+    // Its first fork is done by now:
+    waitpid(pid, NULL, 0);
+    close(sv[0]);
+    syslog(LOG_INFO, "reload: new process serving, draining");
+    return 0;
 
     // Return on error:
-    end0: pthread_exit(NULL);
+    end2: waitpid(pid, NULL, WNOHANG);
+    close(sv[0]);
+    syslog(LOG_WARNING, "reload: new process failed, still serving");
+    return -1;
+    end1: close(sv[0]); close(sv[1]);
+    end0: syslog(LOG_WARNING, "reload: %s", strerror(errno));
+    return -1;
 }
 
 //-----------------------------------------------------------------------------
-// W_Acce:
+// drain: stop accepting and wait for the clients to go, up to drain seconds
+// (or another SIGINT/SIGTERM). Returns the exit status.
 //-----------------------------------------------------------------------------
 
-void *W_Acce(void *arg)
+int drain(void)
 
 {
     // Initializations:
-    int i;                              // Socket file descriptor.
-    struct sockaddr_in cliaddr;         // IPv4 socket address structure.
-    socklen_t len = sizeof(cliaddr);    // Fixed length (16 bytes).
-    PCLIENT cptr = NULL;                // Pointer to client data.
-    struct epoll_event ev;              // Epoll event structure.
+    int i, q, k = s.quit;          // For general use, quiet cores, signals.
+    STATS st;                      // Accepted and closed so far.
+    time_t t = time(NULL), end = t + s.cnf.drain;
 
-    // Setup epoll behavior as one-shot-edge-triggered:
-    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    // Workers see it on their next round, the sleeping ones are woken up
+    // (again, until they are quiet: they may have just checked):
+    __atomic_store_n(&s.drain, 1, __ATOMIC_RELEASE);
 
-    // Main thread loop:
     while(1)
 
     {
-        // Initialize the client data structure:
-        if((cptr = malloc(sizeof(CLIENT))) == NULL) MyDBG(end0);
-        cptr->epfd = (intptr_t)arg;
+        for(i=0, q=0; i<s.cores; i++) if(__atomic_load_n(&s.core[i].quiet, __ATOMIC_ACQUIRE)) q++; else pthread_kill(s.core[i].tid, SIGRTMIN);
+        bb_stat_sum(&st, STAT_ALL);
+        if(q == s.cores && st.accepts == st.closes) break;
+        if(time(NULL) >= end || s.quit > k){syslog(LOG_WARNING, "drain: %lu connections cut", st.accepts - st.closes); break;}
+        usleep(DRAIN_POLL * 1000);
+        bb_resp_tick();
+    }
 
-        // Blocking accept returns a non-blocking client socket:
-        if((cptr->clifd = accept(s.srvfd, (struct sockaddr *) &cliaddr, &len)) < 0) MyDBG(end1);
-        if(s.cnf.tcpnd){i=1; if(setsockopt(cptr->clifd, SOL_TCP, TCP_NODELAY, &i, sizeof(i)) < 0) MyDBG(end2);}
-        if((i = fcntl(cptr->clifd, F_GETFL)) < 0) MyDBG(end2);
-        i |= O_NONBLOCK; if(fcntl(cptr->clifd, F_SETFL, i) < 0) MyDBG(end2);
+    syslog(LOG_INFO, "drain: done in %lds", (long)(time(NULL) - t));
+    return EXIT_SUCCESS;
+}
 
-        // Return data to us later:
-        ev.data.ptr = (void *)cptr;
+//-----------------------------------------------------------------------------
+// report: batching efficiency to syslog.
+//-----------------------------------------------------------------------------
 
-        // Epoll assignment:
-        if(epoll_ctl((intptr_t)arg, EPOLL_CTL_ADD, cptr->clifd, &ev) < 0) MyDBG(end2);
-        continue;
-    }
+void report(void)
 
-    // Return on error:
-    end2: close(cptr->clifd);
-    end1: free(cptr);
-    end0: pthread_exit(NULL);
+{
+    int i;
+    STATS st;
+    char lbl[16];
+
+    // Totals first, the Data-Workers next, then one line per core:
+    for(i=STAT_ALL; i<s.cores; i++)
+
+    {
+        bb_stat_sum(&st, i);
+        if(st.reqs == 0) continue;
+        if(i == STAT_ALL) strcpy(lbl, "all");
+        else if(i == STAT_WORKERS) strcpy(lbl, "workers");
+        else snprintf(lbl, sizeof(lbl), "core %d", i);
+        syslog(LOG_INFO, "%s: reqs %lu, reqs/flush %.2f, syscalls/req %.2f (read %lu, send %lu, re-arm %lu, wait %lu, enter %lu), timeouts %lu, exhausted %lu",
+               lbl, st.reqs, (double)st.reqs / (st.flushes ? st.flushes : 1),
+               (double)(st.reads + st.sends + st.arms + st.waits + st.enters) / st.reqs,
+               st.reads, st.sends, st.arms, st.waits, st.enters, st.timeouts, exhausted(i));
+    }
 }
 
 //-----------------------------------------------------------------------------
-// sig_int:
+// usage: options and their defaults.
 //-----------------------------------------------------------------------------
 
-void sig_int(int signo)
+void usage(FILE *f)
 
 {
-    exit(EXIT_SUCCESS);
+    fprintf(f, "usage: bb [options]\n"
+    "  -m, --mode=shared|per-core|steal    worker layout (shared)\n"
+    "  -E, --engine=epoll|uring            per-core I/O engine (epoll)\n"
+    "  -d, --data-threads=N|MIN-MAX        Data-Workers, fixed or elastic (%d-%d,\n"
+    "                                      a fixed 20 before: --data-threads=20)\n"
+    "  -c, --max-connections=N             connection slots (%d)\n"
+    "  -p, --handler=NAME[:ARG]            protocol handler (%s)\n"
+    "  -h, --epoll-hint=N                  epoll_create() hint (%d)\n"
+    "  -e, --epoll-events=N                events per epoll_wait() (%d)\n"
+    "  -n, --tcp-nodelay                   TCP_NODELAY on clients\n"
+    "  -r, --reuseport                     one SO_REUSEPORT listener per core\n"
+    "  -H, --hugepages                     huge pages for the slabs\n"
+    "  -z, --zerocopy=BYTES                MSG_ZEROCOPY from this size (off)\n"
+    "  -k, --cork                          cork responses (with -n)\n"
+    "  -R, --header-timeout=SECS           (%d, 0 = off)\n"
+    "  -K, --idle-timeout=SECS             (%d, 0 = off)\n"
+    "  -W, --write-timeout=SECS            (%d, 0 = off)\n"
+    "  -D, --drain-timeout=SECS            (%d)\n"
+    "  -S, --shed=TARGET[,INTERVAL]        shed queued clients, ms (off,%d)\n"
+    "  -M, --cache=MB                      response cache (off)\n"
+    "  -B, --busy-poll=USECS               busy-poll the sockets (off)\n"
+    "  -C, --cpus=LIST                     CPUs to run on (all)\n"
+    "  -A, --admin=PATH|PORT|HOST:PORT     metrics and traces: unix socket, TCP\n"
+    "                                      port on loopback or address (off)\n"
+    "  -T, --tls=CERT[:KEY]                TLS (off)\n"
+    "      --help                          this text\n",
+    DATA_MIN, DATA_MAX, MAX_CONNS, DEF_HANDLER, EPOLL_HINT, EPOLL_EVENTS,
+    HEAD_TIMEOUT, IDLE_TIMEOUT, WRITE_TIMEOUT, DRAIN_TIMEOUT, SHED_INTERVAL);
 }
 
 //-----------------------------------------------------------------------------
@@ -251,28 +2139,74 @@ int main(int argc, char *argv[])
 
 {
     // Initializations:
-    int i, j;                      // For general use.
+    int i, j, k = 0;               // For general use.
+    int rfd = -1, nl = 0;          // Reload: socket to the old process, listeners.
+    int lfd[TOPO_CPUS];            // Reload: listeners in core order.
+    char *env;                     // Reload: RELOAD_ENV.
+    char *p;                       // Option parsing.
+    PCREW c;                       // Data-Workers crew.
+    time_t sec = 0;                // Date header refreshed for.
     pthread_t thread;              // Main thread ID (myself).
     cpu_set_t cpuset;              // Each bit represents a CPU.
-    struct sockaddr_in srvaddr;    // IPv4 socket address structure.
+    struct epoll_event ev;         // Epoll event structure.
 
     // Set config defaults:
     s.cnf.ehint = EPOLL_HINT;
     s.cnf.epoev = EPOLL_EVENTS;
-    s.cnf.athre = ACCEPT_THREADS;
-    s.cnf.dthre = DATA_THREADS;
+    s.cnf.dmin = DATA_MIN;
+    s.cnf.dmax = DATA_MAX;
     s.cnf.tcpnd = TCP_NDELAY;
+    s.cnf.mode = MODE_SHARED;
+    s.cnf.rport = 0;
+    s.cnf.maxco = MAX_CONNS;
+    s.cnf.hugep = 0;
+    s.cnf.proto = DEF_HANDLER;
+    s.cnf.parg = NULL;
+    s.cnf.zcopy = 0;
+    s.cnf.cork = 0;
+    s.cnf.engine = ENGINE_EPOLL;
+    s.cnf.tmo[T_HEAD] = HEAD_TIMEOUT;
+    s.cnf.tmo[T_IDLE] = IDLE_TIMEOUT;
+    s.cnf.tmo[T_WRITE] = WRITE_TIMEOUT;
+    s.cnf.admin = NULL;
+    s.cnf.cpus = NULL;
+    s.cnf.bpoll = 0;
+    s.cnf.drain = DRAIN_TIMEOUT;
+    s.cnf.starg = 0;
+    s.cnf.sival = SHED_INTERVAL * 1000000UL;
+    s.cnf.cache = 0;
+    s.cnf.tls = NULL;
+    s.cnf.tkey = NULL;
+    s.afd = -1;
 
     // Parse command line options:
     struct option longopts[] = {
     { "epoll-hint",     required_argument,  NULL,  'h' },
     { "epoll-events",   required_argument,  NULL,  'e' },
-    { "accept-threads", required_argument,  NULL,  'a' },
     { "data-threads",   required_argument,  NULL,  'd' },
     { "tcp-nodelay",    no_argument,        NULL,  'n' },
+    { "mode",           required_argument,  NULL,  'm' },
+    { "reuseport",      no_argument,        NULL,  'r' },
+    { "max-connections",required_argument,  NULL,  'c' },
+    { "hugepages",      no_argument,        NULL,  'H' },
+    { "handler",        required_argument,  NULL,  'p' },
+    { "zerocopy",       required_argument,  NULL,  'z' },
+    { "cork",           no_argument,        NULL,  'k' },
+    { "engine",         required_argument,  NULL,  'E' },
+    { "header-timeout", required_argument,  NULL,  'R' },
+    { "idle-timeout",   required_argument,  NULL,  'K' },
+    { "write-timeout",  required_argument,  NULL,  'W' },
+    { "admin",          required_argument,  NULL,  'A' },
+    { "cpus",           required_argument,  NULL,  'C' },
+    { "busy-poll",      required_argument,  NULL,  'B' },
+    { "drain-timeout",  required_argument,  NULL,  'D' },
+    { "shed",           required_argument,  NULL,  'S' },
+    { "cache",          required_argument,  NULL,  'M' },
+    { "tls",            required_argument,  NULL,  'T' },
+    { "help",           no_argument,        NULL,  'u' },
     { 0, 0, 0, 0 }};
 
-    while((i = getopt_long(argc, argv, "h:e:a:d:n", longopts, NULL)) != -1)
+    while((i = getopt_long(argc, argv, "h:e:d:nm:rc:Hp:z:kE:R:K:W:A:C:B:D:S:M:T:", longopts, NULL)) != -1)
 
     {
         if (i == -1) break;
@@ -284,76 +2218,310 @@ int main(int argc, char *argv[])
                       break;
             case 'e': s.cnf.epoev = atoi(optarg);
                       break;
-            case 'a': s.cnf.athre = atoi(optarg);
-                      break;
-            case 'd': s.cnf.dthre = atoi(optarg);
+            case 'd': s.cnf.dmin = s.cnf.dmax = strtol(optarg, &p, 10);
+                      if(*p == '-') s.cnf.dmax = atoi(p + 1);
                       break;
             case 'n': s.cnf.tcpnd = 1;
                       break;
-            default:  abort();
+            case 'm': if(!strcmp(optarg, "shared")) s.cnf.mode = MODE_SHARED;
+                      else if(!strcmp(optarg, "per-core")) s.cnf.mode = MODE_CORE;
+                      else if(!strcmp(optarg, "steal")) s.cnf.mode = MODE_STEAL;
+                      else abort();
+                      break;
+            case 'r': s.cnf.rport = 1;
+                      break;
+            case 'c': s.cnf.maxco = atoi(optarg);
+                      break;
+            case 'H': s.cnf.hugep = POOL_HUGE;
+                      break;
+            case 'p': s.cnf.proto = optarg;
+                      if((p = strchr(optarg, ':')) != NULL){s.cnf.proto = strndup(optarg, p - optarg); s.cnf.parg = p + 1;}
+                      break;
+            case 'z': s.cnf.zcopy = atoi(optarg);
+                      break;
+            case 'k': s.cnf.cork = 1;
+                      break;
+            case 'E': if(!strcmp(optarg, "epoll")) s.cnf.engine = ENGINE_EPOLL;
+                      else if(!strcmp(optarg, "uring")) s.cnf.engine = ENGINE_URING;
+                      else abort();
+                      break;
+            case 'R': s.cnf.tmo[T_HEAD] = atoi(optarg);
+                      break;
+            case 'K': s.cnf.tmo[T_IDLE] = atoi(optarg);
+                      break;
+            case 'W': s.cnf.tmo[T_WRITE] = atoi(optarg);
+                      break;
+            case 'A': s.cnf.admin = optarg;
+                      break;
+            case 'C': s.cnf.cpus = optarg;
+                      break;
+            case 'B': s.cnf.bpoll = strtoul(optarg, NULL, 10);
+                      break;
+            case 'D': s.cnf.drain = atoi(optarg);
+                      break;
+            case 'S': s.cnf.starg = strtoul(optarg, &p, 10) * 1000000;
+                      if(*p == ',') s.cnf.sival = strtoul(p + 1, NULL, 10) * 1000000;
+                      break;
+            case 'M': s.cnf.cache = strtoul(optarg, NULL, 10) << 20;
+                      break;
+            case 'T': s.cnf.tls = optarg;
+                      if((p = strchr(optarg, ':')) != NULL){s.cnf.tls = strndup(optarg, p - optarg); s.cnf.tkey = p + 1;}
+                      break;
+            case 'u': usage(stdout);
+                      exit(EXIT_SUCCESS);
+            default:  usage(stderr);
+                      exit(EXIT_FAILURE);
         }
     }
 
+    // A fixed pool when the bounds meet, never more threads than counters:
+    if(s.cnf.dmin < 1) s.cnf.dmin = 1;
+    if(s.cnf.dmax < s.cnf.dmin) s.cnf.dmax = s.cnf.dmin;
+
+    if(s.cnf.dmax > STAT_SLOTS / 2)
+
+    {
+        syslog(LOG_WARNING, "data-threads: %d-%d cut to at most %d", s.cnf.dmin, s.cnf.dmax, STAT_SLOTS / 2);
+        s.cnf.dmax = STAT_SLOTS / 2;
+        if(s.cnf.dmin > s.cnf.dmax) s.cnf.dmin = s.cnf.dmax;
+    }
+
+    // Shedding never starts sooner than the target:
+    if(s.cnf.sival < s.cnf.starg) s.cnf.sival = s.cnf.starg;
+
+    // Timeouts from seconds to ticks, timers are checked every tmin:
+    for(i=0, s.cnf.tmin=0; i<3; i++)
+
+    {
+        s.cnf.tmo[i] *= 1000 / TIMER_TICK;
+        if(s.cnf.tmo[i] && (s.cnf.tmin == 0 || s.cnf.tmo[i] < s.cnf.tmin)) s.cnf.tmin = s.cnf.tmo[i];
+    }
+
+    // Pick the delimiter scanners for this CPU, the latency clock and prime
+    // the Date header:
+    bb_scan_init();
+    bb_stat_init();
+    bb_resp_tick();
+
+    // Resolve the protocol handler while relative paths still work:
+    if((s.hnd = handler(s.cnf.proto)) == NULL || s.hnd->on_data == NULL) MyDBG(end0);
+    if(s.hnd->on_init && s.hnd->on_init(s.cnf.parg) < 0) MyDBG(end0);
+    bb_resp_release(HOLD_HANDLER, s.hnd->on_release);
+
+    // Response cache, for handlers that can key their requests:
+    if(s.cnf.cache && s.hnd->on_key && (s.rc = bb_rcache_new(s.cnf.cache)) == NULL) MyDBG(end0);
+    bb_resp_release(HOLD_CACHE, uncache);
+
+    // sendfile() has no MSG_NOSIGNAL:
+    if((signal(SIGPIPE, SIG_IGN)) == SIG_ERR) MyDBG(end0);
+
+    // The io_uring engine needs multishot recv into a buffer ring:
+    if(s.cnf.engine == ENGINE_URING && bb_uring_probe() < 0)
+
+    {
+        syslog(LOG_WARNING, "io_uring engine not supported, using epoll");
+        s.cnf.engine = ENGINE_EPOLL;
+    }
+
+    // TLS termination, certificate paths may be relative. Its sends can not
+    // be submitted to a ring and kTLS takes no MSG_ZEROCOPY:
+    if(s.cnf.tls)
+
+    {
+        if(bb_tls_init(s.cnf.tls, s.cnf.tkey) < 0) MyDBG(end0);
+        if(s.cnf.engine == ENGINE_URING) syslog(LOG_WARNING, "io_uring engine has no TLS, using epoll");
+        s.cnf.engine = ENGINE_EPOLL;
+        s.cnf.zcopy = 0;
+    }
+
+    // CPUs and NUMA nodes to run on (affinity, cpusets, --cpus):
+    if(bb_topo_init(&s.topo, s.cnf.cpus) < 0) MyDBG(end0);
+
+    // A reload runs the binary at this path again, from here:
+    if((i = readlink("/proc/self/exe", s.exe, sizeof(s.exe) - 1)) < 0 || getcwd(s.cwd, sizeof(s.cwd)) == NULL) MyDBG(end0);
+    s.exe[i] = '\0';
+    s.argv = argv;
+
+    // Started by a reload: the listeners come from the old process:
+    if((env = getenv(RELOAD_ENV)) != NULL)
+
+    {
+        rfd = atoi(env);
+        unsetenv(RELOAD_ENV);
+        fcntl(rfd, F_SETFD, FD_CLOEXEC);
+        if(recvfds(rfd, &s.afd, 1) < 0 || (nl = recvfds(rfd, lfd, TOPO_CPUS)) < 0) MyDBG(end0);
+    }
+
+    // Metrics listener, a relative socket path still works:
+    if(s.cnf.admin && s.afd < 0 && (s.afd = admin(s.cnf.admin)) < 0){fprintf(stderr, "--admin=%s: %s\n", s.cnf.admin, strerror(errno)); MyDBG(end0);}
+
     // Daemonize:
     daemonize();
 
-    // Initialize server structures:
-    s.cores = sysconf(_SC_NPROCESSORS_ONLN);
-    if((s.epfd = malloc(sizeof(int) * s.cores)) == NULL) MyDBG(end0);
-    if(bb_fifo_new(&s.fifo) < 0) MyDBG(end1);
+    // Initialize server structures, core i runs on the i-th usable CPU:
+    s.cores = s.topo.ncpu;
+    if(s.cnf.maxco < s.cores) s.cnf.maxco = s.cores;
+    if((s.core = aligned_alloc(CACHELINE, sizeof(CORE) * s.cores)) == NULL) MyDBG(end0);
+    if((s.fifo = calloc(s.topo.nodes, sizeof(FIFO))) == NULL) MyDBG(end1);
+    for(i=0; i<s.cores; i++){s.core[i].srvfd = -1; s.core[i].epfd = -1; s.core[i].rhead = s.core[i].rtail = s.core[i].dead = NULL; s.core[i].dq.buf = NULL; s.core[i].cpu = s.topo.cpu[i]; s.core[i].node = s.topo.node[s.topo.cpu[i]]; bb_wheel_init(&s.core[i].wheel, ticks());}
 
-    // Server blocking socket. Go ahead and reuse it:
-    if((s.srvfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) MyDBG(end1);
-    i=1; if(setsockopt(s.srvfd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i)) < 0) MyDBG(end2);
+    // One FIFO per node with cores, its slots are first touched (so the
+    // pages allocated) from that node:
+    for(i=0; i<s.topo.nodes; i++)
 
-    // Initialize srvaddr:
-    bzero(&srvaddr, sizeof(srvaddr));
-    srvaddr.sin_family = AF_INET;
-    srvaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    srvaddr.sin_port = htons(LISTENP);
+    {
+        bb_topo_node(&s.topo, i, &cpuset);
+        if(CPU_COUNT(&cpuset) == 0) continue;
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) MyDBG(end2);
+        if(bb_fifo_new(&s.fifo[i], s.cnf.maxco) < 0) MyDBG(end2);
+    }
 
-    // Bind and listen:
-    if(bind(s.srvfd, (struct sockaddr *) &srvaddr, sizeof(srvaddr)) < 0) MyDBG(end2);
-    if(listen(s.srvfd, LISTENQ) < 0) MyDBG(end2);
+    // Per-core slabs for clients (plus handler state) and RX buffers, sized
+    // by s.cnf.maxco. Each bigger buffer class gets half the slots. Pages
+    // are faulted in lazily, maybe by a Data-Worker, so they are bound to
+    // the core's node up front:
+    for(i=0; i<s.cores; i++)
+
+    {
+        if(bb_pool_new(&s.core[i].cpool, sizeof(CLIENT) + s.hnd->size, s.cnf.maxco/s.cores, s.cnf.hugep) < 0) MyDBG(end2);
+        s.core[i].cap = s.cnf.maxco/s.cores;
+        for(j=0; j<BUFF_CLASSES; j++){if(bb_pool_new(&s.core[i].bpool[j], BUFF_MIN << j, (s.cnf.maxco/s.cores >> j) + 1, s.cnf.hugep) < 0) MyDBG(end2);}
+        if(s.cnf.mode == MODE_STEAL && bb_deque_new(&s.core[i].dq, s.cnf.maxco/s.cores) < 0) MyDBG(end2);
+        if(s.topo.nodes == 1) continue;
+        bb_topo_bind(s.core[i].cpool.base, s.core[i].cpool.mlen, s.core[i].node);
+        for(j=0; j<BUFF_CLASSES; j++) bb_topo_bind(s.core[i].bpool[j].base, s.core[i].bpool[j].mlen, s.core[i].node);
+    }
+
+    // One SO_REUSEPORT listener per core or a single one shared by all:
+    for(i=0; i<s.cores; i++)
+
+    {
+        if(i>0 && !s.cnf.rport){s.core[i].srvfd = s.core[0].srvfd; continue;}
+        if(k < nl) s.core[i].srvfd = lfd[k++];
+        else if((s.core[i].srvfd = listener()) < 0) MyDBG(end2);
+
+        // Without the steering program the kernel still prefers the
+        // listener of the CPU the SYN came in on:
+        if(s.cnf.rport) setsockopt(s.core[i].srvfd, SOL_SOCKET, SO_INCOMING_CPU, &s.core[i].cpu, sizeof(int));
+    }
+
+    // Fewer cores than the old process, its spare listeners go (their queued
+    // connections move with net.ipv4.tcp_migrate_req):
+    while(k < nl) close(lfd[k++]);
+
+    // Best effort, older kernels fall back to the flow hash:
+    if(s.cnf.rport) steer(s.core[0].srvfd);
 
     // For each core in the system:
     for(i=0; i<s.cores; i++)
 
     {
-        // Open an epoll fd dimensioned for s.cnf.ehint/s.cores descriptors:
-        if((s.epfd[i] = epoll_create(s.cnf.ehint/s.cores)) < 0) MyDBG(end2);
+        // The io_uring engine arms the listener on its own ring:
+        if(s.cnf.engine == ENGINE_EPOLL)
+
+        {
+            // Open an epoll fd dimensioned for s.cnf.ehint/s.cores descriptors:
+            if((s.core[i].epfd = epoll_create(s.cnf.ehint/s.cores)) < 0) MyDBG(end2);
 
-        // Wait-Worker inherits a copy of its creator's CPU affinity mask:
-        CPU_ZERO(&cpuset); CPU_SET(i, &cpuset);
+            // Kernel busy-polling of the NIC queues in epoll_wait() (6.9+):
+            if(s.cnf.bpoll) ioctl(s.core[i].epfd, EPIOCSPARAMS, &(struct epoll_params){ .busy_poll_usecs = s.cnf.bpoll });
+
+            // Watch the listener, a shared one wakes a single core per event:
+            ev.events = s.cnf.rport ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = NULL;
+            if(epoll_ctl(s.core[i].epfd, EPOLL_CTL_ADD, s.core[i].srvfd, &ev) < 0) MyDBG(end2);
+        }
+
+        // Wait-Worker (or Ring-Worker) inherits a copy of its creator's CPU
+        // affinity mask:
+        CPU_ZERO(&cpuset); CPU_SET(s.core[i].cpu, &cpuset);
         if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) MyDBG(end2);
-        if(pthread_create(&thread, NULL, W_Wait, (void *)(intptr_t)s.epfd[i]) != 0) MyDBG(end2);
+        s.core[i].quiet = s.core[i].paused = s.core[i].armed = 0;
+        if(pthread_create(&s.core[i].tid, NULL, s.cnf.engine == ENGINE_URING ? W_Ring : W_Wait, (void *)&s.core[i]) != 0) MyDBG(end2);
     }
 
-    // Round-Robin distribution of Accept-Workers among all available cores:
-    for (j=0; j<s.cnf.athre; j++){for (i=0; i<s.cores; i++)
+    // Crews of Data-Workers (not per-core, the io_uring engine always runs
+    // to completion on the core). Shared mode has one per node, free to move
+    // within it, steal mode one per core, pinned next to its Wait-Worker.
+    // They start at their share of dmin and may grow up to that of dmax:
+    k = s.cnf.mode == MODE_STEAL ? s.cores : s.topo.nodes;
+    if(s.cnf.mode != MODE_CORE && s.cnf.engine == ENGINE_EPOLL && (s.crew = calloc(k, sizeof(CREW))) == NULL) MyDBG(end2);
+    s.ctl = bb_stat_now();
+
+    for(i=0; i<k && s.crew; i++)
 
     {
-        // Accept-Worker inherits a copy of its creator's CPU affinity mask:
-        CPU_ZERO(&cpuset); CPU_SET(i, &cpuset);
-        if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) MyDBG(end2);
-        if(pthread_create(&thread, NULL, W_Acce, (void *)(intptr_t)s.epfd[i]) != 0) MyDBG(end2);
-    }}
+        c = &s.crew[s.crews];
+
+        if(s.cnf.mode == MODE_STEAL)
+
+        {
+            c->home = &s.core[i];
+            CPU_ZERO(&c->cpus); CPU_SET(s.core[i].cpu, &c->cpus);
+            c->min = share(s.cnf.dmin, i, 1);
+            c->max = share(s.cnf.dmax, i, 1);
+        }
+
+        else
+
+        {
+            if(workers(i, 1) == 0) continue;
+            c->fifo = &s.fifo[i];
+            bb_topo_node(&s.topo, i, &c->cpus);
+            c->min = workers(i, s.cnf.dmin);
+            c->max = workers(i, s.cnf.dmax);
+        }
+
+        if((c->st = calloc(c->max, sizeof(PSTATS))) == NULL) MyDBG(end2);
+        atomic_init(&c->want, c->min);
+        bb_topo_idle(&c->cpus, &c->idle, &c->all);
+        s.crews++;
+        for(j=0; j<c->min; j++){if(hire(c) < 0) MyDBG(end2);}
+    }
 
-    // Restore creator's (myself) affinity to all available cores:
-    CPU_ZERO(&cpuset); for(i=0; i<s.cores; i++){CPU_SET(i, &cpuset);}
-    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) MyDBG(end2);
+    // Restore creator's (myself) affinity to all usable cores:
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &s.topo.usable) != 0) MyDBG(end2);
+    placement();
 
-    // Pre-threading a pool of s.cnf.dthre Data-Workers:
-    for(i=0; i<s.cnf.dthre; i++){if(pthread_create(&thread, NULL, W_Data, NULL) != 0) MyDBG(end2);}
+    // Metrics on demand:
+    if(s.afd >= 0 && pthread_create(&thread, NULL, W_Admin, (void *)(intptr_t)s.afd) != 0) MyDBG(end2);
 
-    // Register a signal handler for SIGINT (Ctrl-C)
+    // Register a signal handler for SIGINT (Ctrl-C) and SIGTERM (drain),
+    // SIGUSR1 (report), SIGUSR2 (reload) and SIGRTMIN (wakes workers up):
     if((signal(SIGINT, sig_int)) == SIG_ERR) MyDBG(end2);
+    if((signal(SIGTERM, sig_int)) == SIG_ERR) MyDBG(end2);
+    if((signal(SIGUSR1, sig_usr1)) == SIG_ERR) MyDBG(end2);
+    if((signal(SIGUSR2, sig_usr2)) == SIG_ERR) MyDBG(end2);
+    if((signal(SIGRTMIN, sig_wake)) == SIG_ERR) MyDBG(end2);
+
+    // Reload: tell the old process we serve, it drains then:
+    if(rfd >= 0 && (send(rfd, "", 1, MSG_NOSIGNAL) != 1 || close(rfd) < 0)) MyDBG(end2);
 
-    // Loop forever:
-    while(1){sleep(10);}
+    // Loop refreshing the cached Date header every second and sizing the
+    // crews, until told to quit or a new process took over:
+    while(!s.quit)
+
+    {
+        usleep(s.cnf.dmin < s.cnf.dmax ? CTL_TICK * 1000 : 1000000);
+        if(time(NULL) != sec){sec = time(NULL); bb_resp_tick();}
+        elastic();
+        if(s.rprt){s.rprt = 0; report();}
+        if(s.rload){s.rload = 0; if(reload() == 0) break;}
+    }
+
+    return drain();
 
     // Return on error:
-    end2: close(s.srvfd);
-    end1: free(s.epfd);
+    end2: for(i=0; i<s.cores; i++)
+
+    {
+        if(s.core[i].epfd >= 0) close(s.core[i].epfd);
+        if(s.core[i].srvfd >= 0 && (i==0 || s.cnf.rport)) close(s.core[i].srvfd);
+        bb_deque_free(&s.core[i].dq);
+    }
+
+    for(i=0; i<s.topo.nodes; i++) bb_fifo_free(&s.fifo[i]);
+    free(s.fifo);
+    end1: free(s.core);
     end0: return -1;
 }
@@ -36,15 +36,42 @@
 #include <getopt.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <strings.h>
+#include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <linux/filter.h>
+#include <dlfcn.h>
+#include <syslog.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <linux/types.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "bb_fifo.h"
+#include "bb_deque.h"
+#include "bb_pool.h"
+#include "bb_handler.h"
+#include "bb_scan.h"
+#include "bb_resp.h"
+#include "bb_stat.h"
+#include "bb_uring.h"
+#include "bb_wheel.h"
+#include "bb_trace.h"
+#include "bb_topo.h"
 #include "bb_daemon.h"
+#include "bb_rcache.h"
+#include "bb_tls.h"
 
 //-----------------------------------------------------------------------------
 // Defines:
@@ -54,34 +81,223 @@
 
 #define EPOLL_HINT 500     // Defaults for ehint.
 #define EPOLL_EVENTS 10    // Defaults for epoev.
-#define ACCEPT_THREADS 2   // Defaults for athre.
-#define DATA_THREADS 20    // Defaults for dthre.
+#define DATA_MIN 4         // Defaults for dmin (split among crews, one each at least).
+#define DATA_MAX 256       // Defaults for dmax.
 #define TCP_NDELAY 0       // Defaukts for tcpnd.
 #define LISTENP 8080       // Server listen port.
 #define LISTENQ 1024       // sysctl -w net.core.somaxconn=1024
+#define ADMIN_LISTENQ 16   // Metrics scrapers.
 #define MTU 2896           // 2*(1500-40-12) per socket and round.
+#define FRAME_ROOM 16      // Free output segments a frame needs to be served.
+#define FRAME_SQUASH 16384 // Output bytes copied together, more are flushed.
+#ifndef DEF_HANDLER
+#define DEF_HANDLER "http" // Defaults for proto (make HANDLER=...).
+#endif
+
+#define MODE_SHARED 0      // Wait-Workers feed a global Data-Workers pool.
+#define MODE_CORE 1        // Wait-Workers serve their own clients inline.
+#define MODE_STEAL 2       // Wait-Workers feed their own Data-Workers, idle ones steal.
+#define MAX_CONNS 65536    // Defaults for maxco (also ready-queue slots).
+#define ACCEPT_RESUME 0.9  // A full core accepts again under this share of its slots.
+#define SHED_INTERVAL 100  // Defaults for sival (ms).
+
+#define ENGINE_EPOLL 0     // Wait-Workers on epoll (see mode).
+#define ENGINE_URING 1     // One io_uring per core, run to completion.
+#define URING_ENTRIES 1024 // SQ entries per core (the CQ gets four times).
+#define URING_BUFS 1024    // Provided BUFF_MIN receive buffers per core.
+#define URING_IOVS 4096    // Resolved send segments per submission batch.
+#define URING_HOLD 64      // Provided buffers a busy client may hold.
+#define URING_CALM 8       // Drained single-shot recvs before multishot.
+
+#define TIMER_TICK 100     // Timing wheel resolution (ms).
+#define HEAD_TIMEOUT 10    // Defaults for tmo[T_HEAD] (seconds, 0 = off).
+#define IDLE_TIMEOUT 60    // Defaults for tmo[T_IDLE] (seconds, 0 = off).
+#define WRITE_TIMEOUT 30   // Defaults for tmo[T_WRITE] (seconds, 0 = off).
+#define REAP_WAIT 1000     // Shared mode: max ms before dropped clients are freed.
+#define SPIN_PAUSES 16     // Busy-poll: pause instructions between epoll polls.
+#define DRAIN_TIMEOUT 30   // Defaults for drain (seconds).
+#define DRAIN_POLL 100     // Drain: ms between checks for clients left.
+#define RELOAD_WAIT 10     // Reload: seconds the new process has to serve.
+#define RELOAD_ENV "BB_RELOAD_FD"  // Reload: socket to the old process.
+#define CTL_TICK 10        // Elastic crews: ms between sizing decisions.
+#define CTL_HIGH 0.8       // Grow: serving threads busier than this share
+#define CTL_WAIT 1000000   // while clients wait (queued or over this many ns)
+                           // and its CPUs are not busier than CTL_HIGH.
+#define CTL_LOW 0.5        // Shrink: one thread less would be under this share
+#define CTL_CALM 200       // for this many ticks in a row, then one per tick.
+#define CTL_JIFFIES 10     // CPU load: jiffies per CPU between looks.
+
+#define T_HEAD 0           // Client states a deadline applies to: partial
+#define T_IDLE 1           // request, between requests and output that the
+#define T_WRITE 2          // client does not read.
+
+#define OP_ACCEPT 0        // io_uring user_data tags (top byte).
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_CANCEL 3
+#define OP_POLL 4
+#define HOLD_HANDLER 0     // Output chain mark classes: bb_send_hold()
+#define HOLD_CACHE 1       // and cached responses being sent.
+
+#define UD(p, op) ((__u64)(uintptr_t)(p) | (__u64)(op) << 56)
+#define UD_OP(u) ((int)((u) >> 56))
+#define UD_PTR(u) ((void *)(uintptr_t)((u) & ((1ULL << 56) - 1)))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ volatile("yield")
+#else
+#define CPU_RELAX() do {} while (0)
+#endif
+
+#ifndef EPIOCSPARAMS
+struct epoll_params {__u32 busy_poll_usecs; __u16 busy_poll_budget; __u8 prefer_busy_poll; __u8 __pad;};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
 
 //-----------------------------------------------------------------------------
 // Typedefs:
 //-----------------------------------------------------------------------------
 
-typedef struct _CLIENT
+typedef struct _CORE
+
+{
+    int epfd;                    // Epoll monitoring this core's clients.
+    int srvfd;                   // Listen socket drained by this core.
+    POOL cpool;                  // CLIENT slab.
+    POOL bpool[BUFF_CLASSES];    // RX buffer slabs by size class.
+    PCLIENT rhead;               // Ready list: served again without an event.
+    PCLIENT rtail;               // Ready list tail.
+    URING ring;                  // io_uring engine: submissions and completions.
+    UBUF ubuf;                   // io_uring engine: provided RX buffers.
+    struct iovec *uiov;          // io_uring engine: send segments until submitted.
+    struct msghdr *umsg;         // io_uring engine: send headers until submitted.
+    int *unext;                  // io_uring engine: held buffers chain (by bid).
+    int *ulen;                   // io_uring engine: held buffers length (by bid).
+    int un;                      // uiov in use.
+    int um;                      // umsg in use.
+    WHEEL wheel;                 // Client timers, owner thread only.
+    PCLIENT dead;                // Shared mode: dropped by Data-Workers, freed here.
+    int cpu;                     // CPU the Wait-Worker (or Ring-Worker) runs on.
+    int node;                    // Its NUMA node (slabs and FIFO live there).
+    DEQUE dq;                    // Steal mode: clients for the Data-Workers.
+    pthread_t tid;               // Wait-Worker (or Ring-Worker).
+    int quiet;                   // Draining: no longer accepting.
+    unsigned long cap;           // Clients it may hold, its share of maxco.
+    int paused;                  // Full: no longer accepting until some go.
+    int armed;                   // io_uring engine: accept armed, 2 if multishot.
+}
+
+__attribute__((aligned(CACHELINE))) CORE, *PCORE;
+
+struct _CLIENT
+
+{
+    int clifd;       // Client socket file descriptor.
+    PCORE core;      // Core owning this client.
+    void *udata;     // Protocol handler state.
+    int events;      // Epoll events not handled yet.
+    int rrdy;        // Readable as far as we know (until EAGAIN).
+    int wrdy;        // Writable as far as we know (until EAGAIN).
+    PCLIENT next;    // Next in the core's ready list.
+    int inq;         // In the core's ready list.
+    int wantw;       // Handler waits for EPOLLOUT.
+    char *rbuf;      // Pending RX bytes (partial frame), NULL when idle.
+    int rlen;        // Bytes in rbuf.
+    int roff;        // Bytes of rbuf already consumed this round.
+    int rcls;        // rbuf size class.
+    OUTQ out;        // Pending TX segments.
+    int ops;         // io_uring requests in flight.
+    int rcv;         // Recv: 0 off, 1 armed, 2 being cancelled.
+    int calm;        // Single-shot recvs in a row that drained the socket.
+    int busy;        // io_uring send in flight.
+    int hhead;       // First provided buffer held while busy.
+    int htail;       // Last provided buffer held while busy.
+    int hcnt;        // Provided buffers held.
+    int gone;        // Dropped, freed once ops reaches zero.
+    TIMER tmr;       // Filed in the core's wheel (by the owner thread).
+    unsigned long dline;  // Deadline tick, set by whoever serves the client.
+    int tst;         // T_HEAD, T_IDLE or T_WRITE.
+    int fresh;       // No request served yet, the header is due.
+    void *tmark;     // Head of the output chain when dline was set.
+    unsigned long tacc;   // Accept time (ns) until the first byte comes in.
+    unsigned long treq;   // Oldest unanswered request in (ns).
+    int nreq;        // Requests not answered yet.
+    int bye;         // Close once the output is out (bb_close).
+    unsigned long tq;     // Handed to the Data-Workers (ns).
+    int shed;        // Queued for too long, answer as overloaded.
+    int full;        // Frames left unserved, the output chain had no room.
+    int cttl;        // Cache the response being made this long (bb_cache).
+    PTLS tls;        // --tls: the session while userspace has a part in it.
+};
+
+typedef struct _SPIN
+
+{
+    unsigned long max;   // --busy-poll window (ns), 0 = off.
+    unsigned long win;   // Current window (ns), follows the idle gaps.
+}
+
+SPIN, *PSPIN;
+
+typedef struct _CREW
 
 {
-    int clifd;    // Client socket file descriptor.
-    int epfd;     // Epoll monitoring this clifd.
+    PFIFO fifo;            // Shared mode: its node's FIFO.
+    PCORE home;            // Steal mode: the core it works for.
+    cpu_set_t cpus;        // Where its threads run.
+    int min;               // Threads serving at least.
+    int max;               // And at most (threads created).
+    int made;              // Threads created so far.
+    PSTATS *st;            // Their counters, max slots.
+    atomic_int seated;     // Slots of st taken.
+    atomic_int want;       // Threads the controller wants serving.
+    atomic_int live;       // Threads serving, the rest sleep on bench.
+    atomic_uint bench;     // Futex, bumped when want grows.
+    unsigned long busy;    // Controller: busy ns at the last tick.
+    unsigned long pops;    // Controller: clients taken at the last tick.
+    unsigned long qwait;   // Controller: queued ns at the last tick.
+    double util;           // Controller: busy share of live last tick.
+    double wait;           // Controller: mean queued ns last tick.
+    unsigned long idle;    // Controller: jiffies its CPUs were idle at the last look
+    unsigned long all;     // out of these.
+    double load;           // Controller: share of its CPUs used since the look before.
+    int calm;              // Controller: ticks the shrink condition held.
+    unsigned long grows;   // Controller: times want went up.
+    unsigned long shrinks; // Controller: times want went down.
 }
 
-CLIENT, *PCLIENT;
+CREW, *PCREW;
 
 typedef struct _CONF
 
 {
     int ehint;   // Epoll size hint.
     int epoev;   // Max epoll events per round.
-    int athre;   // Accept-threads per core.
-    int dthre;   // Data-threads pool size.
+    int dmin;    // Data-Workers serving at least (all crews).
+    int dmax;    // And at most, equal to dmin for a fixed pool.
     int tcpnd;   // Control the Nagle algorithm.
+    int mode;    // MODE_SHARED or MODE_CORE.
+    int rport;   // One SO_REUSEPORT listener per core.
+    int maxco;   // Max concurrent connections (split among cores).
+    int hugep;   // Back the slabs with huge pages.
+    char *proto; // Protocol handler name or plugin path.
+    char *parg;  // Its argument (after ':' in --handler).
+    int zcopy;   // MSG_ZEROCOPY threshold for static segments (0 = off).
+    int cork;    // MSG_MORE on partial flushes (with tcpnd).
+    int engine;  // ENGINE_EPOLL or ENGINE_URING.
+    unsigned long tmo[3]; // Timeouts in ticks by client state (0 = off).
+    unsigned long tmin;   // Shortest timeout set (0 = none).
+    char *admin; // Metrics on a Unix socket path, port or host:port (NULL = off).
+    char *cpus;  // CPU list to run on (NULL = all usable).
+    unsigned long bpoll;  // Busy-poll window in microseconds (0 = off).
+    int drain;   // Seconds the clients get to finish on shutdown.
+    unsigned long starg;  // Shed requests queued for longer (ns, 0 = off)
+    unsigned long sival;  // once over it for this long (or queued for this long).
+    unsigned long cache;  // Response cache size in bytes (0 = off).
+    char *tls;   // Certificate chain (PEM) to terminate TLS with (NULL = off).
+    char *tkey;  // Its private key (NULL = in the same file).
 }
 
 CONF, *PCONF;
@@ -89,15 +305,37 @@ CONF, *PCONF;
 typedef struct _SERVER
 
 {
-    int srvfd;     // Server socket file descriptor.
-    int cores;     // Number of system cores.
-    int *epfd;     // Will point to an epfd array.
+    int cores;     // Number of usable cores (one per usable CPU).
+    PCORE core;    // Will point to a per-core array.
     CONF cnf;      // Will store configuration options.
-    FIFO fifo;     // This FIFO will store PCLIENTs.
+    PHANDLER hnd;  // Protocol handler.
+    PRCACHE rc;    // Response cache (NULL = off).
+    PFIFO fifo;    // One FIFO of PCLIENTs per NUMA node.
+    TOPO topo;     // CPUs and NUMA nodes we run on.
+    PCREW crew;    // Data-Workers: one crew per node (per core in steal mode).
+    int crews;     // Number of crews.
+    unsigned long ctl;            // Elastic crews: last tick (ns).
+    atomic_int parked;            // Steal mode: Data-Workers asleep.
+    int afd;                      // Admin listener (-1 = none).
+    int drain;                    // Shutting down: no accepts, no keep-alive.
+    char exe[PATH_MAX];           // Reload: binary to run (by path, it may be new).
+    char cwd[PATH_MAX];           // Reload: where we were started.
+    char **argv;                  // Reload: arguments to run it with.
+    volatile sig_atomic_t rprt;   // SIGUSR1 asked for a report.
+    volatile sig_atomic_t rload;  // SIGUSR2 asked for a reload.
+    volatile sig_atomic_t quit;   // SIGINT or SIGTERM, twice cuts the drain.
 }
 
 SERVER, *PSERVER;
 
+//-----------------------------------------------------------------------------
+// Built-in handlers:
+//-----------------------------------------------------------------------------
+
+extern HANDLER bb_http;
+extern HANDLER bb_echo;
+extern HANDLER bb_static;
+
 //-----------------------------------------------------------------------------
 // End of include guard:
 //-----------------------------------------------------------------------------
@@ -0,0 +1,143 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <sys/mman.h>
+#include "bb_pool.h"
+
+//-----------------------------------------------------------------------------
+// Fixed-size object slab. The whole slab is reserved up front but objects
+// are carved lazily, so pages are only faulted in once they are used and
+// the free-list never has to walk untouched memory.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// bb_pool_new:
+//-----------------------------------------------------------------------------
+
+int bb_pool_new(PPOOL pool, size_t size, size_t count, int flags)
+
+{
+    void *ptr = MAP_FAILED;
+
+    // Objects are 16-byte aligned and big enough to hold the free-list link:
+    if(size < sizeof(void *)) size = sizeof(void *);
+    pool->size = (size + 15) & ~(size_t)15;
+    pool->mlen = pool->size * count;
+
+    // Explicit huge pages need a reserved pool, otherwise ask for THP:
+    if(flags & POOL_HUGE)
+
+    {
+        size_t hlen = (pool->mlen + (2 << 20) - 1) & ~(size_t)((2 << 20) - 1);
+        ptr = mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) pool->mlen = hlen;
+    }
+
+    if(ptr == MAP_FAILED)
+
+    {
+        ptr = mmap(NULL, pool->mlen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(ptr == MAP_FAILED) return -1;
+        if(flags & POOL_HUGE) madvise(ptr, pool->mlen, MADV_HUGEPAGE);
+    }
+
+    if(pthread_spin_init(&pool->lock, PTHREAD_PROCESS_PRIVATE) != 0)
+
+    {
+        munmap(ptr, pool->mlen);
+        return -1;
+    }
+
+    pool->base = pool->next = ptr;
+    pool->end = pool->base + pool->size * count;
+    pool->free = NULL;
+    pool->used = pool->fails = 0;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_pool_get: returns NULL (and counts it) when the pool is exhausted.
+//-----------------------------------------------------------------------------
+
+void *bb_pool_get(PPOOL pool)
+
+{
+    void *obj;
+
+    pthread_spin_lock(&pool->lock);
+
+    // Reuse a returned object or carve a fresh one:
+    if((obj = pool->free) != NULL) pool->free = *(void **)obj;
+    else if(pool->next < pool->end){obj = pool->next; pool->next += pool->size;}
+
+    if(obj != NULL) pool->used++;
+    else pool->fails++;
+
+    pthread_spin_unlock(&pool->lock);
+    return obj;
+}
+
+//-----------------------------------------------------------------------------
+// bb_pool_put:
+//-----------------------------------------------------------------------------
+
+void bb_pool_put(PPOOL pool, void *obj)
+
+{
+    pthread_spin_lock(&pool->lock);
+    *(void **)obj = pool->free;
+    pool->free = obj;
+    pool->used--;
+    pthread_spin_unlock(&pool->lock);
+}
+
+//-----------------------------------------------------------------------------
+// bb_pool_free:
+//-----------------------------------------------------------------------------
+
+void bb_pool_free(PPOOL pool)
+
+{
+    pthread_spin_destroy(&pool->lock);
+    munmap(pool->base, pool->mlen);
+    pool->base = pool->next = pool->end = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// bb_pool_buff: smallest buffer class holding len bytes, NULL if none.
+//-----------------------------------------------------------------------------
+
+void *bb_pool_buff(PPOOL pools, size_t len, int *cls)
+
+{
+    int i;
+
+    for(i=0; i<BUFF_CLASSES; i++)
+    if(len <= (size_t)BUFF_MIN << i){*cls = i; return bb_pool_get(&pools[i]);}
+
+    return NULL;
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_POOL_
+#define _BB_POOL_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <pthread.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define POOL_HUGE 1         // Try to back the slab with huge pages.
+#define BUFF_MIN 4096       // Smallest I/O buffer (size class 0).
+#define BUFF_CLASSES 5      // I/O buffers double up to BUFF_MIN<<4.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _POOL
+
+{
+    pthread_spinlock_t  lock;    // Owner core and remote frees rarely collide.
+    char                *base;   // Start of the mapped slab.
+    char                *next;   // First never-used object (lazy carving).
+    char                *end;    // End of the slab.
+    void                *free;   // Free-list of returned objects.
+    size_t              size;    // Object size.
+    size_t              mlen;    // Mapped length.
+    unsigned long       used;    // Objects handed out.
+    unsigned long       fails;   // Requests made while exhausted.
+}
+
+POOL, *PPOOL;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_pool_new(PPOOL pool, size_t size, size_t count, int flags);
+void *bb_pool_get(PPOOL pool);
+void bb_pool_put(PPOOL pool, void *obj);
+void bb_pool_free(PPOOL pool);
+void *bb_pool_buff(PPOOL pools, size_t len, int *cls);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
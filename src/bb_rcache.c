@@ -0,0 +1,374 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include "bb_rcache.h"
+
+//-----------------------------------------------------------------------------
+// Response cache: whole responses as they were sent, by a key the handler
+// makes of the request. Same scheme as the open-file cache (bb_fcache.c):
+// a fixed array of slots found through a set-associative index of single
+// words, pinned with one CAS that only succeeds for the generation the
+// index names, so hits take no lock. Writers (stores, CLOCK evictions and
+// purges) lock one of RC_SHARDS shards, each with its own slots, index and
+// share of the byte budget. Expired entries are not served and go first.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// hash: FNV-1a, 64 bits.
+//-----------------------------------------------------------------------------
+
+static unsigned long hash(const char *p, int n)
+
+{
+    unsigned long h = 14695981039346656037UL;
+
+    while(n-- > 0) h = (h ^ (unsigned char)*p++) * 1099511628211UL;
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+// shard: the one a hash belongs to (top bits, the index uses the low ones).
+//-----------------------------------------------------------------------------
+
+static PSHARD shard(PRCACHE c, unsigned long h)
+
+{
+    return &c->shard[(h >> 56) % RC_SHARDS];
+}
+
+//-----------------------------------------------------------------------------
+// pin: hold e if it still is generation gen, -1 if it went meanwhile.
+//-----------------------------------------------------------------------------
+
+static int pin(PRENT e, unsigned long gen)
+
+{
+    unsigned long st = atomic_load_explicit(&e->st, memory_order_acquire);
+
+    do {if(((st >> 32) & 0xffff) != gen || (st & RC_DEAD)) return -1;}
+    while(!atomic_compare_exchange_weak_explicit(&e->st, &st, st + 1, memory_order_acquire, memory_order_acquire));
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// reclaim: free a retired entry and its slot (locked).
+//-----------------------------------------------------------------------------
+
+static void reclaim(PSHARD sh, PRENT e)
+
+{
+    sh->bytes -= e->klen + e->len;
+    free(e->data);
+    e->data = NULL;
+    sh->free[sh->nfree++] = e - sh->slot;
+}
+
+//-----------------------------------------------------------------------------
+// unpin: let go of e, the last pin of a retired entry reclaims it.
+//-----------------------------------------------------------------------------
+
+static void unpin(PSHARD sh, PRENT e)
+
+{
+    unsigned long st = atomic_fetch_sub_explicit(&e->st, 1, memory_order_acq_rel);
+
+    if((st & RC_DEAD) && (st & RC_PINS) == 1)
+
+    {
+        pthread_mutex_lock(&sh->lock);
+        reclaim(sh, e);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// lookup: pinned entry for key (hashed h), NULL if not cached. Lock-free.
+//-----------------------------------------------------------------------------
+
+static PRENT lookup(PSHARD sh, const char *key, int klen, unsigned long h)
+
+{
+    int i;
+    unsigned long w;
+    PRENT e;
+    atomic_ulong *b = &sh->idx[(h & sh->mask) * RC_WAYS];
+
+    for(i=0; i<RC_WAYS; i++)
+
+    {
+        w = atomic_load_explicit(&b[i], memory_order_acquire);
+        if(w == 0 || w >> 32 != h >> 32) continue;
+        e = &sh->slot[(w & 0xffff) - 1];
+        if(pin(e, (w >> 16) & 0xffff) < 0) continue;
+        if(e->klen == klen && memcmp(e->data, key, klen) == 0){__atomic_store_n(&e->used, 1, __ATOMIC_RELAXED); return e;}
+        unpin(sh, e);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// retire: take slot i out of the index, reclaimed now or by the last pin.
+// Returns 1 if it was live (locked).
+//-----------------------------------------------------------------------------
+
+static int retire(PSHARD sh, int i)
+
+{
+    int j;
+    unsigned long st;
+    PRENT e = &sh->slot[i];
+    atomic_ulong *b = &sh->idx[(e->hash & sh->mask) * RC_WAYS];
+
+    if(atomic_load_explicit(&e->st, memory_order_relaxed) & RC_DEAD) return 0;
+    for(j=0; j<RC_WAYS; j++) if((atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) == (unsigned long)i + 1) atomic_store_explicit(&b[j], 0, memory_order_relaxed);
+    st = atomic_fetch_or_explicit(&e->st, RC_DEAD, memory_order_acq_rel);
+    if((st & RC_PINS) == 0) reclaim(sh, e);
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// find: slot of the live entry for key, -1 if none (locked).
+//-----------------------------------------------------------------------------
+
+static int find(PSHARD sh, const char *key, int klen, unsigned long h)
+
+{
+    int i, k;
+    unsigned long w;
+    atomic_ulong *b = &sh->idx[(h & sh->mask) * RC_WAYS];
+
+    for(i=0; i<RC_WAYS; i++)
+
+    {
+        w = atomic_load_explicit(&b[i], memory_order_relaxed);
+        k = (w & 0xffff) - 1;
+        if(w != 0 && w >> 32 == h >> 32 && sh->slot[k].klen == klen && !memcmp(sh->slot[k].data, key, klen)) return k;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// grab: a free slot with room for size more bytes, evicting with the CLOCK
+// hand (expired entries whether hit or not). -1 if what is left is pinned
+// (locked).
+//-----------------------------------------------------------------------------
+
+static int grab(PSHARD sh, size_t budget, size_t size, unsigned long now)
+
+{
+    int n;
+    PRENT e;
+
+    for(n=0; (sh->nfree == 0 || sh->bytes + size > budget) && n < 2 * RC_SLOTS; n++)
+
+    {
+        e = &sh->slot[sh->hand];
+        if(!(atomic_load_explicit(&e->st, memory_order_relaxed) & RC_DEAD))
+
+        {
+            if(__atomic_exchange_n(&e->used, 0, __ATOMIC_RELAXED) == 0 || e->expires <= now) retire(sh, sh->hand);
+        }
+
+        sh->hand = (sh->hand + 1) % RC_SLOTS;
+    }
+
+    return sh->nfree > 0 && sh->bytes + size <= budget ? sh->free[--sh->nfree] : -1;
+}
+
+//-----------------------------------------------------------------------------
+// insert: publish slot i for the entry in tmp (locked).
+//-----------------------------------------------------------------------------
+
+static void insert(PSHARD sh, int i, PRENT tmp)
+
+{
+    int j, k;
+    unsigned long gen;
+    PRENT e;
+    atomic_ulong *b = &sh->idx[(tmp->hash & sh->mask) * RC_WAYS];
+
+    // A full bucket loses its least recently hit entry (or the first):
+    for(j=0; j<RC_WAYS && atomic_load_explicit(&b[j], memory_order_relaxed) != 0; j++);
+
+    if(j == RC_WAYS)
+
+    {
+        for(j=0; j<RC_WAYS; j++){k = (atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) - 1; if(!__atomic_load_n(&sh->slot[k].used, __ATOMIC_RELAXED)) break;}
+        if(j == RC_WAYS) j = 0;
+        retire(sh, (atomic_load_explicit(&b[j], memory_order_relaxed) & 0xffff) - 1);
+    }
+
+    // Filled while retired (no pin can succeed), then published:
+    e = &sh->slot[i];
+    gen = (atomic_load_explicit(&e->st, memory_order_relaxed) >> 32) + 1;
+    memcpy((char *)e + sizeof(e->st), (char *)tmp + sizeof(tmp->st), sizeof(RENT) - sizeof(e->st));
+    sh->bytes += e->klen + e->len;
+    atomic_store_explicit(&e->st, gen << 32, memory_order_release);
+    atomic_store_explicit(&b[j], (e->hash >> 32) << 32 | (gen & 0xffff) << 16 | (i + 1), memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// bb_rcache_new: a cache of about bytes (keys and responses), NULL on error.
+//-----------------------------------------------------------------------------
+
+PRCACHE bb_rcache_new(size_t bytes)
+
+{
+    int i, j;
+    PRCACHE c;
+    PSHARD sh;
+
+    if((c = calloc(1, sizeof(RCACHE))) == NULL) return NULL;
+    if((c->shard = aligned_alloc(CACHELINE, RC_SHARDS * sizeof(SHARD))) == NULL) goto end0;
+    memset(c->shard, 0, RC_SHARDS * sizeof(SHARD));
+    c->budget = bytes / RC_SHARDS;
+
+    for(i=0; i<RC_SHARDS; i++)
+
+    {
+        sh = &c->shard[i];
+        if((sh->slot = calloc(RC_SLOTS, sizeof(RENT))) == NULL) goto end1;
+        if((sh->free = malloc(RC_SLOTS * sizeof(int))) == NULL) goto end1;
+
+        // Twice as many index words as slots:
+        for(sh->mask=1; sh->mask * RC_WAYS < 2 * RC_SLOTS; sh->mask <<= 1);
+        if((sh->idx = calloc(sh->mask, RC_WAYS * sizeof(atomic_ulong))) == NULL) goto end1;
+        sh->mask--;
+
+        // Every slot starts retired and free:
+        for(j=0; j<RC_SLOTS; j++){atomic_init(&sh->slot[j].st, RC_DEAD); sh->free[sh->nfree++] = RC_SLOTS - 1 - j;}
+        pthread_mutex_init(&sh->lock, NULL);
+    }
+
+    return c;
+
+    // Return on error:
+    end1: for(i=0; i<RC_SHARDS; i++){free(c->shard[i].slot); free(c->shard[i].free); free(c->shard[i].idx);}
+    free(c->shard);
+    end0: free(c);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// bb_rcache_get: pinned entry for key if cached and fresh at now, else NULL.
+// The response is e->data + e->klen, e->len bytes.
+//-----------------------------------------------------------------------------
+
+PRENT bb_rcache_get(PRCACHE c, const char *key, int klen, unsigned long now)
+
+{
+    unsigned long h = hash(key, klen);
+    PSHARD sh = shard(c, h);
+    PRENT e;
+
+    if((e = lookup(sh, key, klen, h)) == NULL) return NULL;
+    if(e->expires > now) return e;
+    unpin(sh, e);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// bb_rcache_set: store the response in v for key, fresh until expires
+// (bb_now in ns). Replaces what was there, -1 if it does not fit.
+//-----------------------------------------------------------------------------
+
+int bb_rcache_set(PRCACHE c, const char *key, int klen, const struct iovec *v, int n, unsigned long now, unsigned long expires)
+
+{
+    int i;
+    RENT tmp;
+    PSHARD sh;
+    char *p;
+
+    // One entry takes an eighth of its shard at most:
+    for(i=0, tmp.len=0; i<n; i++) tmp.len += v[i].iov_len;
+    if(klen > RC_KEY || klen + tmp.len > c->budget / 8) return -1;
+    if((tmp.data = malloc(klen + tmp.len)) == NULL) return -1;
+
+    memcpy(tmp.data, key, klen);
+    for(i=0, p=tmp.data+klen; i<n; p+=v[i].iov_len, i++) memcpy(p, v[i].iov_base, v[i].iov_len);
+    tmp.hash = hash(key, klen);
+    tmp.klen = klen;
+    tmp.expires = expires;
+    tmp.used = 1;
+    sh = shard(c, tmp.hash);
+
+    pthread_mutex_lock(&sh->lock);
+    if((i = find(sh, key, klen, tmp.hash)) >= 0) retire(sh, i);
+    if((i = grab(sh, c->budget, klen + tmp.len, now)) >= 0) insert(sh, i, &tmp);
+    pthread_mutex_unlock(&sh->lock);
+
+    if(i < 0){free(tmp.data); return -1;}
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_rcache_put: let go of a pinned entry.
+//-----------------------------------------------------------------------------
+
+void bb_rcache_put(PRCACHE c, PRENT e)
+
+{
+    unpin(shard(c, e->hash), e);
+}
+
+//-----------------------------------------------------------------------------
+// bb_rcache_del: drop the entry for key, every entry if key is NULL.
+// Returns how many went. Pinned ones are still sent, never served again.
+//-----------------------------------------------------------------------------
+
+int bb_rcache_del(PRCACHE c, const char *key, int klen)
+
+{
+    int i, j, n = 0;
+    unsigned long h;
+    PSHARD sh;
+
+    if(key)
+
+    {
+        h = hash(key, klen);
+        sh = shard(c, h);
+        pthread_mutex_lock(&sh->lock);
+        if((i = find(sh, key, klen, h)) >= 0) n = retire(sh, i);
+        pthread_mutex_unlock(&sh->lock);
+        return n;
+    }
+
+    for(i=0; i<RC_SHARDS; i++)
+
+    {
+        sh = &c->shard[i];
+        pthread_mutex_lock(&sh->lock);
+        for(j=0; j<RC_SLOTS; j++) n += retire(sh, j);
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    return n;
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_RCACHE_
+#define _BB_RCACHE_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "bb_fifo.h"
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define RC_SHARDS 16       // Locks on the write side (top bits of the hash).
+#define RC_SLOTS 4096      // Entries per shard.
+#define RC_WAYS 8          // Index entries per bucket.
+#define RC_KEY 1024        // Longest key.
+#define RC_DEAD (1UL << 31)          // Entry state: out of the index.
+#define RC_PINS (RC_DEAD - 1)        // Entry state: readers holding it.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _RENT
+
+{
+    atomic_ulong st;           // Generation (high 32 bits), RC_DEAD, pins.
+    unsigned long hash;        // Of the key.
+    unsigned long expires;     // bb_now (ns) it is served until.
+    unsigned char used;        // Hit since the CLOCK hand last passed.
+    int klen;                  // Key length.
+    size_t len;                // Response length.
+    char *data;                // The key, then the response as sent.
+}
+
+RENT, *PRENT;
+
+typedef struct _SHARD
+
+{
+    pthread_mutex_t lock;      // Writers: stores, evictions, purges.
+    PRENT slot;                // RC_SLOTS entries, never freed.
+    atomic_ulong *idx;         // Buckets of RC_WAYS words: hash, generation
+    unsigned int mask;         // and slot + 1 (0 is free).
+    int *free;                 // Free slots.
+    int nfree;
+    int hand;                  // CLOCK hand.
+    size_t bytes;              // Held by entries not reclaimed yet.
+}
+
+__attribute__((aligned(CACHELINE))) SHARD, *PSHARD;
+
+typedef struct _RCACHE
+
+{
+    PSHARD shard;              // RC_SHARDS of them.
+    size_t budget;             // Bytes per shard.
+}
+
+RCACHE, *PRCACHE;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+PRCACHE bb_rcache_new(size_t bytes);
+PRENT bb_rcache_get(PRCACHE c, const char *key, int klen, unsigned long now);
+int bb_rcache_set(PRCACHE c, const char *key, int klen, const struct iovec *v, int n, unsigned long now, unsigned long expires);
+void bb_rcache_put(PRCACHE c, PRENT e);
+int bb_rcache_del(PRCACHE c, const char *key, int klen);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,560 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include "bb_resp.h"
+#include "bb_stat.h"
+
+//-----------------------------------------------------------------------------
+// Output chain. Segments are kept by reference and gathered with writev().
+// Only data that cannot go out before its owner reuses it is copied into a
+// pooled TX buffer; those segments store an offset so the buffer can grow.
+// File ranges go with sendfile() and marks (OUT_HOLD) let their owner know
+// when the chain no longer refers to what it queued before them.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static char date[2][64];            // Written by the ticker only.
+static atomic_int cur;              // The one readers may use.
+static void (*release[OUT_MARKS])(void *);    // Called for every mark passed.
+
+//-----------------------------------------------------------------------------
+// bb_resp_init:
+//-----------------------------------------------------------------------------
+
+void bb_resp_init(POUTQ q)
+
+{
+    q->head = q->cnt = 0;
+    q->tbuf = NULL;
+    q->tlen = q->zcs = q->files = 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_release: set the callback for passed marks of class cls.
+//-----------------------------------------------------------------------------
+
+void bb_resp_release(int cls, void (*fn)(void *arg))
+
+{
+    release[cls] = fn;
+}
+
+//-----------------------------------------------------------------------------
+// pass: segment i is a mark, call its owner.
+//-----------------------------------------------------------------------------
+
+static void pass(POUTQ q, int i)
+
+{
+    if(release[q->fd[i]]) release[q->fd[i]](q->iov[i].iov_base);
+}
+
+//-----------------------------------------------------------------------------
+// pop: drop the first segment, its mark is passed.
+//-----------------------------------------------------------------------------
+
+static void pop(POUTQ q)
+
+{
+    int i = q->head++;
+
+    q->cnt--;
+    q->moves++;
+    if(q->kind[i] == OUT_FILE) q->files--;
+    if(q->kind[i] == OUT_HOLD) pass(q, i);
+}
+
+//-----------------------------------------------------------------------------
+// tcopy: append len bytes to the TX buffer, returns their offset or -1.
+//-----------------------------------------------------------------------------
+
+static int tcopy(POUTQ q, PPOOL pools, const void *buff, size_t len)
+
+{
+    int cls, off = q->tlen;
+    char *nbuf;
+
+    // Move to a bigger class when it does not fit (offsets stay valid):
+    if(q->tbuf == NULL || q->tlen + len > (size_t)BUFF_MIN << q->tcls)
+
+    {
+        if((nbuf = bb_pool_buff(pools, q->tlen + len, &cls)) == NULL) return -1;
+        if(q->tbuf){memcpy(nbuf, q->tbuf, q->tlen); bb_pool_put(&pools[q->tcls], q->tbuf);}
+        q->tbuf = nbuf;
+        q->tcls = cls;
+    }
+
+    memcpy(q->tbuf + off, buff, len);
+    q->tlen += len;
+    return off;
+}
+
+//-----------------------------------------------------------------------------
+// flatten: copy every run of memory segments into a single TX segment to
+// make room. File ranges stay as they are (they may be any size) and so do
+// the marks guarding them. Returns -1 if nothing can be merged or it would
+// take more than max bytes.
+//-----------------------------------------------------------------------------
+
+static int flatten(POUTQ q, PPOOL pools, size_t max)
+
+{
+    int i, j, cls, mem;
+    size_t len = 0;
+    char *nbuf, *p, *b;
+
+    // Bytes to copy and the segments left afterwards:
+    for(i=q->head, j=0, mem=0; i<q->head+q->cnt; i++)
+
+    {
+        if(q->kind[i] == OUT_FILE || q->kind[i] == OUT_HOLD){j++; mem = 0; continue;}
+        len += q->iov[i].iov_len;
+        if(!mem++) j++;
+    }
+
+    if(j == q->cnt || len > max || (nbuf = bb_pool_buff(pools, len, &cls)) == NULL) return -1;
+
+    for(p=nbuf, i=q->head, j=0; i<q->head+q->cnt; i++)
+
+    {
+        if(q->kind[i] == OUT_FILE || q->kind[i] == OUT_HOLD)
+
+        {
+            q->iov[j] = q->iov[i]; q->kind[j] = q->kind[i]; q->fd[j++] = q->fd[i];
+            continue;
+        }
+
+        // Appended to the run being built, or the start of a new one:
+        b = q->kind[i] == OUT_TBUF ? q->tbuf + (uintptr_t)q->iov[i].iov_base : (char *)q->iov[i].iov_base;
+        memcpy(p, b, q->iov[i].iov_len);
+        if(j > 0 && q->kind[j-1] == OUT_TBUF) q->iov[j-1].iov_len += q->iov[i].iov_len;
+        else {q->kind[j] = OUT_TBUF; q->iov[j].iov_base = (void *)(uintptr_t)(p - nbuf); q->iov[j++].iov_len = q->iov[i].iov_len;}
+        p += q->iov[i].iov_len;
+    }
+
+    if(q->tbuf) bb_pool_put(&pools[q->tcls], q->tbuf);
+    q->tbuf = nbuf; q->tcls = cls; q->tlen = len;
+    q->moves++;
+    q->head = 0; q->cnt = j;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_squash: make room by copying up to max bytes, -1 if it can not.
+//-----------------------------------------------------------------------------
+
+int bb_resp_squash(POUTQ q, PPOOL pools, size_t max)
+
+{
+    return flatten(q, pools, max);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_add: queue a segment, returns -1 if it cannot be held.
+//-----------------------------------------------------------------------------
+
+int bb_resp_add(POUTQ q, PPOOL pools, const void *buff, size_t len, int kind)
+
+{
+    int i, off;
+
+    if(len == 0 && kind != OUT_HOLD) return 0;
+
+    // Slide to the front or, if really full, squash what is in memory:
+    if(q->head + q->cnt == OUT_SEGS)
+
+    {
+        if(q->head > 0)
+
+        {
+            memmove(&q->iov[0], &q->iov[q->head], q->cnt * sizeof(struct iovec));
+            memmove(&q->kind[0], &q->kind[q->head], q->cnt);
+            memmove(&q->fd[0], &q->fd[q->head], q->cnt * sizeof(int));
+            q->head = 0;
+            q->moves++;
+        }
+
+        else if(flatten(q, pools, SIZE_MAX) < 0) return -1;
+    }
+
+    // Copied now, the caller's buffer may go:
+    if(kind == OUT_COPY)
+
+    {
+        if((off = tcopy(q, pools, buff, len)) < 0) return -1;
+        buff = (void *)(uintptr_t)off;
+        kind = OUT_TBUF;
+    }
+
+    i = q->head + q->cnt++;
+    q->iov[i].iov_base = (void *)buff;
+    q->iov[i].iov_len = len;
+    q->kind[i] = kind;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_file: queue len bytes of fd from off, the file must stay open
+// until a mark queued after it is passed.
+//-----------------------------------------------------------------------------
+
+int bb_resp_file(POUTQ q, PPOOL pools, int fd, off_t off, size_t len)
+
+{
+    if(len == 0) return 0;
+    if(bb_resp_add(q, pools, (void *)(uintptr_t)off, len, OUT_FILE) < 0) return -1;
+    q->fd[q->head + q->cnt - 1] = fd;
+    q->files++;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_hold: queue a mark of class cls for arg, passed right away on an
+// empty chain.
+//-----------------------------------------------------------------------------
+
+int bb_resp_hold(POUTQ q, PPOOL pools, int cls, void *arg)
+
+{
+    if(q->cnt == 0){if(release[cls]){release[cls](arg);} return 0;}
+    if(bb_resp_add(q, pools, arg, 0, OUT_HOLD) < 0) return -1;
+    q->fd[q->head + q->cnt - 1] = cls;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// consume: drop what the kernel took, and the marks right after it.
+//-----------------------------------------------------------------------------
+
+static void consume(POUTQ q, size_t n)
+
+{
+    struct iovec *v;
+
+    while(n > 0)
+
+    {
+        v = &q->iov[q->head];
+        if(n < v->iov_len){v->iov_base = (char *)v->iov_base + n; v->iov_len -= n; return;}
+        n -= v->iov_len; pop(q);
+    }
+
+    while(q->cnt > 0 && q->kind[q->head] == OUT_HOLD) pop(q);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_flush: 1 when everything is out, 0 if it would block, -1 on error.
+// Static segments of at least zc bytes (if zc > 0) go alone with
+// MSG_ZEROCOPY, completions are collected by bb_resp_reap(), unless a mark
+// follows them: marks are passed once sendmsg() returns, before the kernel
+// is done with the pages. With more,
+// every send but the last one of the chain carries MSG_MORE, and so does
+// the one before a file range.
+//-----------------------------------------------------------------------------
+
+int bb_resp_flush(POUTQ q, PPOOL pools, int fd, size_t zc, int more)
+
+{
+    struct iovec v[OUT_SEGS];
+    struct msghdr msg = { 0 };
+    int i, n, flags, hold;
+    off_t off;
+    ssize_t w;
+
+    while(q->cnt > 0)
+
+    {
+        // Last mark in the chain, what comes before it goes by copy:
+        for(hold=q->head+q->cnt-1; zc && hold>=q->head && q->kind[hold] != OUT_HOLD; hold--);
+
+        // File ranges go from the page cache, nothing left to send from
+        // where we are means the file shrunk (the response can not end):
+        if(q->kind[q->head] == OUT_FILE)
+
+        {
+            off = (off_t)(uintptr_t)q->iov[q->head].iov_base;
+            if((w = sendfile(fd, q->fd[q->head], &off, q->iov[q->head].iov_len)) == 0) return -1;
+            flags = 0;
+        }
+
+        else
+
+        {
+            // Gather up to the next zero-copy candidate or file range:
+            for(n=0, i=q->head; i<q->head+q->cnt; n++, i++)
+
+            {
+                if(q->kind[i] == OUT_FILE) break;
+                if(zc && q->kind[i] == OUT_STATIC && q->iov[i].iov_len >= zc && i > hold && n > 0) break;
+                v[n].iov_base = q->kind[i] == OUT_TBUF ? q->tbuf + (uintptr_t)q->iov[i].iov_base : q->iov[i].iov_base;
+                v[n].iov_len = q->iov[i].iov_len;
+                if(zc && q->kind[i] == OUT_STATIC && q->iov[i].iov_len >= zc && i > hold){n++; break;}
+            }
+
+            flags = MSG_NOSIGNAL;
+            if(n == 1 && zc && q->kind[q->head] == OUT_STATIC && v[0].iov_len >= zc && q->head > hold) flags |= MSG_ZEROCOPY;
+            if(n < q->cnt && (more || q->kind[q->head+n] == OUT_FILE)) flags |= MSG_MORE;
+
+            msg.msg_iov = v;
+            msg.msg_iovlen = n;
+            w = sendmsg(fd, &msg, flags);
+        }
+
+        STAT(sends);
+
+        if(w < 0)
+
+        {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN){STAT(eagains); return 0;}
+            if(errno == ENOBUFS && (flags & MSG_ZEROCOPY)){zc = 0; continue;}
+            return -1;
+        }
+
+        if(flags & MSG_ZEROCOPY) q->zcs++;
+        STAT_ADD(wbytes, w);
+        consume(q, w);
+    }
+
+    return bb_resp_done(q, pools, 0);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_write: bb_resp_flush() through wr (like write(), a TLS session in
+// userspace), the head of the chain gathered up to OUT_BOUNCE bytes per call.
+// A call that has to wait is repeated with the same bytes or more, as TLS
+// libraries want: the chain only grows at its tail.
+//-----------------------------------------------------------------------------
+
+int bb_resp_write(POUTQ q, PPOOL pools, ssize_t (*wr)(void *arg, const void *buff, size_t len), void *arg)
+
+{
+    char bounce[OUT_BOUNCE];
+    size_t len, n;
+    ssize_t w;
+    int i;
+
+    while(q->cnt > 0)
+
+    {
+        for(len=0, i=q->head; i<q->head+q->cnt && len<sizeof(bounce); len+=n, i++)
+
+        {
+            n = q->iov[i].iov_len < sizeof(bounce) - len ? q->iov[i].iov_len : sizeof(bounce) - len;
+
+            // File ranges through the bounce buffer, short means it shrunk:
+            if(q->kind[i] == OUT_FILE){if(pread(q->fd[i], bounce + len, n, (off_t)(uintptr_t)q->iov[i].iov_base) != n){return -1;} continue;}
+            memcpy(bounce + len, q->kind[i] == OUT_TBUF ? q->tbuf + (uintptr_t)q->iov[i].iov_base : q->iov[i].iov_base, n);
+        }
+
+        w = wr(arg, bounce, len);
+        STAT(sends);
+
+        if(w < 0)
+
+        {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN){STAT(eagains); return 0;}
+            return -1;
+        }
+
+        STAT_ADD(wbytes, w);
+        consume(q, w);
+    }
+
+    return bb_resp_done(q, pools, 0);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_iov: resolve the whole chain into v for an asynchronous send,
+// returns the number of segments. The chain must not change until the send
+// completes (see bb_resp_done). Not for chains with file ranges.
+//-----------------------------------------------------------------------------
+
+int bb_resp_iov(POUTQ q, struct iovec *v)
+
+{
+    int n, i;
+
+    for(n=0, i=q->head; i<q->head+q->cnt; n++, i++)
+
+    {
+        v[n].iov_base = q->kind[i] == OUT_TBUF ? q->tbuf + (uintptr_t)q->iov[i].iov_base : q->iov[i].iov_base;
+        v[n].iov_len = q->iov[i].iov_len;
+    }
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_since: resolve the segments from index from on into v, -1 if a
+// file range is among them. Only meaningful while moves stays the same.
+//-----------------------------------------------------------------------------
+
+int bb_resp_since(POUTQ q, int from, struct iovec *v)
+
+{
+    int n, i;
+
+    for(n=0, i=from; i<q->head+q->cnt; n++, i++)
+
+    {
+        if(q->kind[i] == OUT_FILE) return -1;
+        v[n].iov_base = q->kind[i] == OUT_TBUF ? q->tbuf + (uintptr_t)q->iov[i].iov_base : q->iov[i].iov_base;
+        v[n].iov_len = q->iov[i].iov_len;
+    }
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_done: drop n bytes taken by the kernel, returns 1 when empty.
+//-----------------------------------------------------------------------------
+
+int bb_resp_done(POUTQ q, PPOOL pools, size_t n)
+
+{
+    consume(q, n);
+    if(q->cnt > 0) return 0;
+
+    // All out, the TX buffer goes back to the pool:
+    q->head = 0;
+    if(q->tbuf){bb_pool_put(&pools[q->tcls], q->tbuf); q->tbuf = NULL; q->tlen = 0;}
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_pin: copy segments whose owner is about to reuse them.
+//-----------------------------------------------------------------------------
+
+int bb_resp_pin(POUTQ q, PPOOL pools)
+
+{
+    int i, off;
+
+    for(i=q->head; i<q->head+q->cnt; i++)
+
+    {
+        if(q->kind[i] != OUT_PIN) continue;
+        if((off = tcopy(q, pools, q->iov[i].iov_base, q->iov[i].iov_len)) < 0) return -1;
+        q->iov[i].iov_base = (void *)(uintptr_t)off;
+        q->kind[i] = OUT_TBUF;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_free:
+//-----------------------------------------------------------------------------
+
+void bb_resp_free(POUTQ q, PPOOL pools)
+
+{
+    int i;
+
+    // Marks are passed, unsent:
+    for(i=q->head; i<q->head+q->cnt; i++) if(q->kind[i] == OUT_HOLD) pass(q, i);
+    if(q->tbuf) bb_pool_put(&pools[q->tcls], q->tbuf);
+    bb_resp_init(q);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_reap: drain MSG_ZEROCOPY completions from the error queue.
+// Zero-copy is only used for static buffers no mark guards, nothing to
+// release, returns the number of completed sends.
+//-----------------------------------------------------------------------------
+
+int bb_resp_reap(POUTQ q, int fd)
+
+{
+    char ctl[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cm;
+    struct sock_extended_err *ee;
+    int n = 0;
+
+    while(q->zcs > 0)
+
+    {
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        if(recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) break;
+
+        for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+
+        {
+            ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if(ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            n += ee->ee_data - ee->ee_info + 1;
+        }
+    }
+
+    q->zcs -= n;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_tick: refresh the cached Date header. Callers may tick as often as
+// they like, the other buffer is only rewritten when the second changes:
+// readers copy the line, a flip a second is all they have to outrun.
+//-----------------------------------------------------------------------------
+
+void bb_resp_tick(void)
+
+{
+    static time_t last;
+    struct tm tm;
+    time_t now = time(NULL);
+    int nxt = !atomic_load_explicit(&cur, memory_order_relaxed);
+
+    if(now == last) return;
+    last = now;
+    gmtime_r(&now, &tm);
+    strftime(date[nxt], sizeof(date[nxt]), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    atomic_store_explicit(&cur, nxt, memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// bb_resp_date: current "Date: ...\r\n" header line.
+//-----------------------------------------------------------------------------
+
+const char *bb_resp_date(void)
+
+{
+    return date[atomic_load_explicit(&cur, memory_order_acquire)];
+}
@@ -0,0 +1,99 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_RESP_
+#define _BB_RESP_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "bb_pool.h"
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define OUT_SEGS 64      // Pending segments per connection.
+#define OUT_STATIC 0     // Immutable buffer, always sent by reference.
+#define OUT_PIN 1        // Caller's buffer, copied if it has to wait.
+#define OUT_TBUF 2       // Offset into the connection's TX buffer.
+#define OUT_FILE 3       // File range sent with sendfile(), the base is the offset.
+#define OUT_HOLD 4       // Empty mark, released once everything before it is out.
+#define OUT_COPY 5       // bb_resp_add() only: copied into the TX buffer right away.
+#define OUT_MARKS 2      // Mark classes, each with its release callback.
+#define OUT_BOUNCE 16384 // bb_resp_write(): bytes gathered per call (a TLS record).
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _OUTQ
+
+{
+    struct iovec iov[OUT_SEGS];    // Pending segments in order.
+    char kind[OUT_SEGS];           // OUT_STATIC, OUT_PIN, OUT_TBUF...
+    int fd[OUT_SEGS];              // OUT_FILE: the file, OUT_HOLD: its class.
+    int head;                      // First pending segment.
+    int cnt;                       // Pending segments.
+    char *tbuf;                    // Copies of data that had to wait.
+    int tlen;                      // Bytes used in tbuf.
+    int tcls;                      // tbuf size class.
+    int zcs;                       // MSG_ZEROCOPY sends not yet completed.
+    int files;                     // OUT_FILE segments (no gather, no async).
+    unsigned int moves;            // Bumped when pending segments shift.
+}
+
+OUTQ, *POUTQ;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+void bb_resp_init(POUTQ q);
+void bb_resp_release(int cls, void (*fn)(void *arg));
+int bb_resp_add(POUTQ q, PPOOL pools, const void *buff, size_t len, int kind);
+int bb_resp_file(POUTQ q, PPOOL pools, int fd, off_t off, size_t len);
+int bb_resp_squash(POUTQ q, PPOOL pools, size_t max);
+int bb_resp_hold(POUTQ q, PPOOL pools, int cls, void *arg);
+int bb_resp_since(POUTQ q, int from, struct iovec *v);
+int bb_resp_flush(POUTQ q, PPOOL pools, int fd, size_t zc, int more);
+int bb_resp_write(POUTQ q, PPOOL pools, ssize_t (*wr)(void *arg, const void *buff, size_t len), void *arg);
+int bb_resp_iov(POUTQ q, struct iovec *v);
+int bb_resp_done(POUTQ q, PPOOL pools, size_t n);
+int bb_resp_pin(POUTQ q, PPOOL pools);
+void bb_resp_free(POUTQ q, PPOOL pools);
+int bb_resp_reap(POUTQ q, int fd);
+void bb_resp_tick(void);
+const char *bb_resp_date(void);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
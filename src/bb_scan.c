@@ -0,0 +1,242 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include "bb_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+//-----------------------------------------------------------------------------
+// Delimiter scanners. Vector versions compare 16 or 32 positions at a time
+// using one unaligned load per delimiter byte (shifted by one), so a match
+// straddling two vectors is still seen. The tail is left to the scalar code
+// (through SSE2 for AVX2, the upper halves cleared first: the compiler does
+// not on a tail call and legacy SSE code pays for dirty ones).
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Scalar:
+//-----------------------------------------------------------------------------
+
+static int crlf2_c(const char *b, int i, int len)
+
+{
+    for(; i+3<len; i++) if(b[i]=='\r' && b[i+1]=='\n' && b[i+2]=='\r' && b[i+3]=='\n') return i;
+    return -1;
+}
+
+static int eol_c(const char *b, int i, int len)
+
+{
+    for(; i+1<len; i++) if(b[i]=='\r' && b[i+1]=='\n') return i;
+    return -1;
+}
+
+static int chr_c(const char *b, int i, int len, char c)
+
+{
+    for(; i<len; i++) if(b[i]==c) return i;
+    return -1;
+}
+
+#ifdef SCAN_X86
+
+//-----------------------------------------------------------------------------
+// SSE2:
+//-----------------------------------------------------------------------------
+
+#define LD16(p) _mm_loadu_si128((const __m128i *)(p))
+
+__attribute__((target("sse2")))
+static int crlf2_sse2(const char *b, int i, int len)
+
+{
+    int m;
+    __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+    for(; i+3+16<=len; i+=16)
+
+    {
+        m = _mm_movemask_epi8(_mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(LD16(b+i), cr), _mm_cmpeq_epi8(LD16(b+i+1), lf)),
+            _mm_and_si128(_mm_cmpeq_epi8(LD16(b+i+2), cr), _mm_cmpeq_epi8(LD16(b+i+3), lf))));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    return crlf2_c(b, i, len);
+}
+
+__attribute__((target("sse2")))
+static int eol_sse2(const char *b, int i, int len)
+
+{
+    int m;
+    __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+    for(; i+1+16<=len; i+=16)
+
+    {
+        m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(LD16(b+i), cr), _mm_cmpeq_epi8(LD16(b+i+1), lf)));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    return eol_c(b, i, len);
+}
+
+__attribute__((target("sse2")))
+static int chr_sse2(const char *b, int i, int len, char c)
+
+{
+    int m;
+    __m128i v = _mm_set1_epi8(c);
+
+    for(; i+16<=len; i+=16)
+
+    {
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(LD16(b+i), v));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    return chr_c(b, i, len, c);
+}
+
+//-----------------------------------------------------------------------------
+// AVX2:
+//-----------------------------------------------------------------------------
+
+#define LD32(p) _mm256_loadu_si256((const __m256i *)(p))
+
+__attribute__((target("avx2")))
+static int crlf2_avx2(const char *b, int i, int len)
+
+{
+    unsigned int m;
+    __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+
+    for(; i+3+32<=len; i+=32)
+
+    {
+        m = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(LD32(b+i), cr), _mm256_cmpeq_epi8(LD32(b+i+1), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(LD32(b+i+2), cr), _mm256_cmpeq_epi8(LD32(b+i+3), lf))));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    _mm256_zeroupper();
+    return crlf2_sse2(b, i, len);
+}
+
+__attribute__((target("avx2")))
+static int eol_avx2(const char *b, int i, int len)
+
+{
+    unsigned int m;
+    __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+
+    for(; i+1+32<=len; i+=32)
+
+    {
+        m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(LD32(b+i), cr), _mm256_cmpeq_epi8(LD32(b+i+1), lf)));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    _mm256_zeroupper();
+    return eol_sse2(b, i, len);
+}
+
+__attribute__((target("avx2")))
+static int chr_avx2(const char *b, int i, int len, char c)
+
+{
+    unsigned int m;
+    __m256i v = _mm256_set1_epi8(c);
+
+    for(; i+32<=len; i+=32)
+
+    {
+        m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(LD32(b+i), v));
+        if(m) return i + __builtin_ctz(m);
+    }
+
+    _mm256_zeroupper();
+    return chr_sse2(b, i, len, c);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Globals: best implementation for this CPU, picked by bb_scan_init().
+//-----------------------------------------------------------------------------
+
+static int (*crlf2)(const char *, int, int) = crlf2_c;
+static int (*eol)(const char *, int, int) = eol_c;
+static int (*chr)(const char *, int, int, char) = chr_c;
+
+//-----------------------------------------------------------------------------
+// bb_scan_init:
+//-----------------------------------------------------------------------------
+
+void bb_scan_init(void)
+
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")){crlf2 = crlf2_avx2; eol = eol_avx2; chr = chr_avx2;}
+    else if(__builtin_cpu_supports("sse2")){crlf2 = crlf2_sse2; eol = eol_sse2; chr = chr_sse2;}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// bb_scan_crlf2: end of a request head.
+//-----------------------------------------------------------------------------
+
+int bb_scan_crlf2(const char *buff, int from, int len)
+
+{
+    return crlf2(buff, from, len);
+}
+
+//-----------------------------------------------------------------------------
+// bb_scan_eol: end of a header line.
+//-----------------------------------------------------------------------------
+
+int bb_scan_eol(const char *buff, int from, int len)
+
+{
+    return eol(buff, from, len);
+}
+
+//-----------------------------------------------------------------------------
+// bb_scan_chr: single byte, e.g. the ':' of a header.
+//-----------------------------------------------------------------------------
+
+int bb_scan_chr(const char *buff, int from, int len, char c)
+
+{
+    return chr(buff, from, len, c);
+}
@@ -0,0 +1,277 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bb_stat.h"
+
+//-----------------------------------------------------------------------------
+// Every worker thread owns one cache-line aligned slot and bumps it without
+// atomics. Readers sum the slots on demand and may see slightly stale data.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+__thread PSTATS bb_st;                 // Calling thread's counters.
+__thread unsigned long bb_now;         // When its event batch came in (ns).
+static STATS slot[STAT_SLOTS];         // All registered threads.
+static atomic_int used;                // Slots handed out.
+static unsigned long tsc0;             // TSC at bb_stat_init() (0 = no TSC).
+static unsigned long ns0;              // CLOCK_MONOTONIC at the same time.
+static unsigned long mult;             // ns per TSC tick << 32.
+
+//-----------------------------------------------------------------------------
+// bb_stat_new: give the calling thread its own slot.
+//-----------------------------------------------------------------------------
+
+int bb_stat_new(int core)
+
+{
+    int i = atomic_fetch_add(&used, 1);
+
+    if(i >= STAT_SLOTS) return -1;
+    slot[i].core = core;
+    bb_st = &slot[i];
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_stat_sum: add up the slots of one core, of the unpinned threads
+// (STAT_WORKERS) or all of them (STAT_ALL).
+//-----------------------------------------------------------------------------
+
+void bb_stat_sum(PSTATS sum, int core)
+
+{
+    int i, n = atomic_load(&used);
+    unsigned long *a, *b;
+
+    memset(sum, 0, sizeof(STATS));
+    sum->core = core;
+
+    // Everything after core is an unsigned long (histograms included):
+    for(i=0; i<n && i<STAT_SLOTS; i++)
+
+    {
+        if(core != STAT_ALL && slot[i].core != core) continue;
+        a = (unsigned long *)((char *)sum + offsetof(STATS, reqs));
+        b = (unsigned long *)((char *)&slot[i] + offsetof(STATS, reqs));
+        while((char *)a < (char *)(sum + 1)) *a++ += *b++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// mono: CLOCK_MONOTONIC in ns (vDSO, no system call).
+//-----------------------------------------------------------------------------
+
+static unsigned long mono(void)
+
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// bb_stat_init: calibrate the TSC against CLOCK_MONOTONIC if the kernel
+// keeps time with it (then it is invariant and synchronized across CPUs).
+//-----------------------------------------------------------------------------
+
+void bb_stat_init(void)
+
+{
+#if defined(__x86_64__)
+    char src[16] = "";
+    FILE *f;
+    unsigned long t, n;
+    struct timespec ts = { 0, 20000000 };
+
+    if((f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r")) == NULL) return;
+    if(fgets(src, sizeof(src), f) == NULL || strncmp(src, "tsc", 3)){fclose(f); return;}
+    fclose(f);
+
+    n = mono(); t = __builtin_ia32_rdtsc();
+    nanosleep(&ts, NULL);
+    mult = ((mono() - n) << 32) / (__builtin_ia32_rdtsc() - t);
+    ns0 = n; tsc0 = t;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// bb_stat_now: monotonic nanoseconds, from the TSC when calibrated (half
+// the cost of the vDSO clock on the hot path).
+//-----------------------------------------------------------------------------
+
+unsigned long bb_stat_now(void)
+
+{
+#if defined(__x86_64__)
+    if(tsc0) return ns0 + (unsigned long)(((unsigned __int128)(__builtin_ia32_rdtsc() - tsc0) * mult) >> 32);
+#endif
+    return mono();
+}
+
+//-----------------------------------------------------------------------------
+// bb_stat_hist: record n samples of ns. Buckets split every power of two in
+// 2^HIST_SUB, the relative error stays under 1/2^HIST_SUB at any scale.
+//-----------------------------------------------------------------------------
+
+void bb_stat_hist(PHIST h, unsigned long ns, unsigned long n)
+
+{
+    int i, msb;
+
+    if(ns < 1UL << HIST_LOW) i = 0;
+    else if((msb = 63 - __builtin_clzl(ns)) >= HIST_HIGH) i = HIST_BUCKETS - 1;
+    else i = 1 + ((msb - HIST_LOW) << HIST_SUB) + ((ns >> (msb - HIST_SUB)) & ((1 << HIST_SUB) - 1));
+
+    h->cnt[i] += n;
+    h->sum += ns * n;
+}
+
+//-----------------------------------------------------------------------------
+// bound: upper bound of bucket i in ns.
+//-----------------------------------------------------------------------------
+
+static unsigned long bound(int i)
+
+{
+    int msb = HIST_LOW + ((i - 1) >> HIST_SUB);
+
+    if(i == 0) return 1UL << HIST_LOW;
+    return (1UL << msb) + ((unsigned long)(((i - 1) & ((1 << HIST_SUB) - 1)) + 1) << (msb - HIST_SUB));
+}
+
+//-----------------------------------------------------------------------------
+// label: Prometheus label set of a group of slots.
+//-----------------------------------------------------------------------------
+
+static void label(char *buff, size_t len, int core)
+
+{
+    if(core == STAT_WORKERS) snprintf(buff, len, "core=\"workers\"");
+    else snprintf(buff, len, "core=\"%d\"", core);
+}
+
+//-----------------------------------------------------------------------------
+// bb_stat_prom: every counter and histogram by core in the Prometheus text
+// exposition format. Threads not pinned to a core (Data-Workers) show up as
+// core="workers", fifo is the depth of their hand-off queue.
+//-----------------------------------------------------------------------------
+
+void bb_stat_prom(FILE *f, int cores, size_t fifo)
+
+{
+    int i, j, k, g, n = atomic_load(&used);
+    char lbl[32];
+    unsigned long c;
+    PSTATS sum;
+    PHIST h;
+
+    static const struct {const char *name, *type, *help; size_t off;} ctr[] = {
+    { "bb_accepts_total",        "counter", "Clients accepted.",                      offsetof(STATS, accepts)  },
+    { "bb_closes_total",         "counter", "Clients closed.",                        offsetof(STATS, closes)   },
+    { "bb_requests_total",       "counter", "Requests answered.",                     offsetof(STATS, reqs)     },
+    { "bb_reads_total",          "counter", "read() calls.",                          offsetof(STATS, reads)    },
+    { "bb_sends_total",          "counter", "sendmsg() calls.",                       offsetof(STATS, sends)    },
+    { "bb_received_bytes_total", "counter", "Bytes received.",                        offsetof(STATS, rbytes)   },
+    { "bb_sent_bytes_total",     "counter", "Bytes sent.",                            offsetof(STATS, wbytes)   },
+    { "bb_eagains_total",        "counter", "Calls that would have blocked.",         offsetof(STATS, eagains)  },
+    { "bb_rearms_total",         "counter", "epoll_ctl() re-arms.",                   offsetof(STATS, arms)     },
+    { "bb_waits_total",          "counter", "epoll_wait() calls.",                    offsetof(STATS, waits)    },
+    { "bb_enters_total",         "counter", "io_uring_enter() calls.",                offsetof(STATS, enters)   },
+    { "bb_flushes_total",        "counter", "Output flushes that sent data.",         offsetof(STATS, flushes)  },
+    { "bb_timeouts_total",       "counter", "Clients shut for missing a deadline.",   offsetof(STATS, timeouts) },
+    { "bb_busy_poll_hits_total", "counter", "Waits served by busy-polling.",          offsetof(STATS, spins)    },
+    { "bb_local_pops_total",     "counter", "Clients taken from the own deque.",      offsetof(STATS, locals)   },
+    { "bb_steals_total",         "counter", "Clients stolen from other cores.",       offsetof(STATS, steals)   },
+    { "bb_data_pops_total",      "counter", "Clients taken by the Data-Workers.",     offsetof(STATS, pops)     },
+    { "bb_shed_total",           "counter", "Requests shed, queued for too long.",    offsetof(STATS, sheds)    },
+    { "bb_accept_pauses_total",  "counter", "Times a full core stopped accepting.",   offsetof(STATS, pauses)   },
+    { "bb_cache_hits_total",     "counter", "Requests answered from the cache.",      offsetof(STATS, chits)    },
+    { "bb_cache_misses_total",   "counter", "Cacheable requests not in the cache.",   offsetof(STATS, cmisses)  },
+    { "bb_tls_handshakes_total", "counter", "TLS handshakes completed.",              offsetof(STATS, tlshs)    },
+    { "bb_ktls_total",           "counter", "Of them, sending through the kernel.",   offsetof(STATS, ktls)     }};
+
+    static const struct {const char *name, *help; size_t off;} hst[] = {
+    { "bb_first_byte_seconds",   "Accept to first request byte.",             offsetof(STATS, first) },
+    { "bb_request_seconds",      "Request to response handed to the kernel.", offsetof(STATS, lat)   }};
+
+    // One sum per core, the Data-Workers last (if there are any):
+    if((sum = calloc(cores + 1, sizeof(STATS))) == NULL) return;
+    for(i=0; i<cores; i++) bb_stat_sum(&sum[i], i);
+    for(i=0, g=cores; i<n && i<STAT_SLOTS; i++) if(slot[i].core == STAT_WORKERS) g = cores + 1;
+    if(g > cores) bb_stat_sum(&sum[cores], STAT_WORKERS);
+
+    for(j=0; j<sizeof(ctr)/sizeof(ctr[0]); j++)
+
+    {
+        fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", ctr[j].name, ctr[j].help, ctr[j].name, ctr[j].type);
+
+        for(i=0; i<g; i++)
+
+        {
+            label(lbl, sizeof(lbl), sum[i].core);
+            fprintf(f, "%s{%s} %lu\n", ctr[j].name, lbl, *(unsigned long *)((char *)&sum[i] + ctr[j].off));
+        }
+    }
+
+    // Connections are accepted and closed by the core owning them:
+    fprintf(f, "# HELP bb_connections Open client connections.\n# TYPE bb_connections gauge\n");
+    for(i=0; i<cores; i++) fprintf(f, "bb_connections{core=\"%d\"} %lu\n", i, sum[i].accepts - sum[i].closes);
+    fprintf(f, "# HELP bb_fifo_depth Clients queued for the Data-Workers.\n# TYPE bb_fifo_depth gauge\n");
+    fprintf(f, "bb_fifo_depth %zu\n", fifo);
+
+    // Cumulative buckets with the upper bounds in seconds:
+    for(j=0; j<sizeof(hst)/sizeof(hst[0]); j++)
+
+    {
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", hst[j].name, hst[j].help, hst[j].name);
+
+        for(i=0; i<g; i++)
+
+        {
+            h = (PHIST)((char *)&sum[i] + hst[j].off);
+            label(lbl, sizeof(lbl), sum[i].core);
+
+            for(k=0, c=0; k<HIST_BUCKETS-1; k++)
+
+            {
+                c += h->cnt[k];
+                fprintf(f, "%s_bucket{%s,le=\"%.9g\"} %lu\n", hst[j].name, lbl, bound(k) / 1e9, c);
+            }
+
+            c += h->cnt[k];
+            fprintf(f, "%s_bucket{%s,le=\"+Inf\"} %lu\n", hst[j].name, lbl, c);
+            fprintf(f, "%s_sum{%s} %.9f\n%s_count{%s} %lu\n", hst[j].name, lbl, h->sum / 1e9, hst[j].name, lbl, c);
+        }
+    }
+
+    free(sum);
+}
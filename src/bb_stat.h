@@ -0,0 +1,123 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_STAT_
+#define _BB_STAT_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include "bb_fifo.h"
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define STAT_SLOTS 1024                 // Max threads with counters.
+#define STAT_ALL -2                     // bb_stat_sum() every slot.
+#define STAT_WORKERS -1                 // Slots not pinned to a core.
+#define STAT(x) (bb_st->x++)            // Hot path: plain per-thread add.
+#define STAT_ADD(x, n) (bb_st->x += (n))
+#define HIST(x, ns, n) bb_stat_hist(&bb_st->x, (ns), (n))
+#define STAT_NOW() (bb_now = bb_stat_now())   // Once per event batch.
+
+#define HIST_LOW 10        // Samples under 2^10 ns share the first bucket.
+#define HIST_HIGH 36       // Samples from 2^36 ns (~69s) share the last one.
+#define HIST_SUB 2         // 2^2 linear buckets per power of two.
+#define HIST_BUCKETS (((HIST_HIGH - HIST_LOW) << HIST_SUB) + 2)
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _HIST
+
+{
+    unsigned long cnt[HIST_BUCKETS];    // Samples by log-linear bucket.
+    unsigned long sum;                  // Sum of the samples (ns).
+}
+
+HIST, *PHIST;
+
+typedef struct _STATS
+
+{
+    int core;                  // Core the owner thread works for.
+    unsigned long reqs;        // Requests answered.
+    unsigned long reads;       // read() calls.
+    unsigned long sends;       // sendmsg() calls.
+    unsigned long arms;        // epoll_ctl() re-arms.
+    unsigned long waits;       // epoll_wait() calls.
+    unsigned long flushes;     // Output flushes that sent data.
+    unsigned long enters;      // io_uring_enter() calls.
+    unsigned long timeouts;    // Clients shut for missing a deadline.
+    unsigned long accepts;     // Clients accepted.
+    unsigned long closes;      // Clients closed.
+    unsigned long rbytes;      // Bytes received.
+    unsigned long wbytes;      // Bytes sent.
+    unsigned long eagains;     // Reads and sends that would have blocked.
+    unsigned long spins;       // Waits served by busy-polling, not sleeping.
+    unsigned long locals;      // Steal mode: clients taken from the own core.
+    unsigned long steals;      // Steal mode: clients taken from another core.
+    unsigned long pops;        // Data-Workers: clients taken from the queues.
+    unsigned long qwait;       // Data-Workers: ns those clients were queued.
+    unsigned long busy;        // Data-Workers: ns spent serving them.
+    unsigned long sheds;       // Requests answered as overloaded (or reset).
+    unsigned long pauses;      // Times a core stopped accepting, full.
+    unsigned long chits;       // Requests answered from the response cache.
+    unsigned long cmisses;     // Cacheable requests the handler answered.
+    unsigned long tlshs;       // TLS handshakes completed.
+    unsigned long ktls;        // Of them, sending through the kernel (kTLS).
+    HIST first;                // Accept to first request byte.
+    HIST lat;                  // Request to response handed to the kernel.
+}
+
+__attribute__((aligned(CACHELINE))) STATS, *PSTATS;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+extern __thread PSTATS bb_st;    // Calling thread's counters.
+extern __thread unsigned long bb_now;    // When its event batch came in (ns).
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_stat_new(int core);
+void bb_stat_sum(PSTATS sum, int core);
+void bb_stat_init(void);
+unsigned long bb_stat_now(void);
+void bb_stat_hist(PHIST h, unsigned long ns, unsigned long n);
+void bb_stat_prom(FILE *f, int cores, size_t fifo);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,333 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include "bb_handler.h"
+#include "bb_scan.h"
+#include "bb_fcache.h"
+
+//-----------------------------------------------------------------------------
+// Static files below a root directory (--handler=static:DIR, the current
+// one by default). GET and HEAD, a single Range and If-None-Match. Hits are
+// answered from the shared open-file cache with no system call but the
+// send: small files from memory, the rest with sendfile(). Every response
+// pins its entry until it is out (bb_send_hold).
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _STATIC
+
+{
+    int scan;    // Offset where the delimiter search resumes.
+}
+
+STATIC, *PSTATIC;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static FCACHE cache;
+
+static const char ok[] = "HTTP/1.1 200 OK\r\n";
+static const char partial[] = "HTTP/1.1 206 Partial Content\r\n";
+static const char same[] = "HTTP/1.1 304 Not Modified\r\n";
+static const char unsat[] = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+static const char crlf[] = "\r\n";
+static const char bye[] = "Connection: close\r\n";
+
+static const char bad[] = "HTTP/1.1 400 Bad Request\r\n"
+                          "Content-Length: 0\r\n"
+                          "\r\n";
+
+static const char none[] = "HTTP/1.1 404 Not Found\r\n"
+                           "Content-Length: 0\r\n"
+                           "\r\n";
+
+static const char nope[] = "HTTP/1.1 405 Method Not Allowed\r\n"
+                           "Allow: GET, HEAD\r\n"
+                           "Content-Length: 0\r\n"
+                           "\r\n";
+
+static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                           "Retry-After: 1\r\n"
+                           "Content-Length: 0\r\n"
+                           "\r\n";
+
+//-----------------------------------------------------------------------------
+// target: the file an origin-form request target names, below the root
+// and NUL terminated in path. -1 if it is not one we serve.
+//-----------------------------------------------------------------------------
+
+static int target(const char *t, int n, char *path)
+
+{
+    int i, k = 0, x;
+    char *p, h[3] = "";
+
+    // The query is not ours:
+    if(n == 0 || t[0] != '/') return -1;
+
+    for(i=1; i<n && t[i] != '?' && t[i] != '#'; i++)
+
+    {
+        x = (unsigned char)t[i];
+        if(x == '%' && i+2 < n && isxdigit(t[i+1]) && isxdigit(t[i+2])){h[0] = t[i+1]; h[1] = t[i+2]; x = strtol(h, NULL, 16); i += 2;}
+        if(x == '\0' || k == FC_PATH - sizeof("index.html")) return -1;
+        path[k++] = x;
+    }
+
+    // Directories get their index:
+    if(k == 0 || path[k-1] == '/') k += sprintf(path + k, "index.html");
+    path[k] = '\0';
+
+    // Nothing absolute, no way up:
+    if(path[0] == '/') return -1;
+    for(p=path; (p = strstr(p, "..")) != NULL; p += 2) if((p == path || p[-1] == '/') && (p[2] == '/' || p[2] == '\0')) return -1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// range: the first byte and length a Range value asks for. 0 to ignore it
+// (malformed or several ranges, the whole file goes), -1 if unsatisfiable.
+//-----------------------------------------------------------------------------
+
+static int range(const char *v, off_t size, off_t *first, off_t *len)
+
+{
+    long long a, b = size - 1;
+    char *p;
+
+    while(*v == ' ') v++;
+    if(strncasecmp(v, "bytes=", 6)) return 0;
+    v += 6;
+
+    // Suffix: the last b bytes:
+    if(*v == '-')
+
+    {
+        if(v[1] < '0' || v[1] > '9') return 0;
+        a = strtoll(v + 1, &p, 10);
+        if(a == 0) return -1;
+        a = a < size ? size - a : 0;
+    }
+
+    else
+
+    {
+        if(*v < '0' || *v > '9') return 0;
+        a = strtoll(v, &p, 10);
+        if(*p++ != '-') return 0;
+        if(*p >= '0' && *p <= '9' && (b = strtoll(p, &p, 10)) < a) return 0;
+        if(b >= size) b = size - 1;
+    }
+
+    while(*p == ' ') p++;
+    if(*p != '\r') return 0;
+    if(a >= size) return -1;
+    *first = a;
+    *len = b - a + 1;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// answer: respond to the request head in buff (len bytes, up to the CRLF
+// of its last line). -1 closes the client.
+//-----------------------------------------------------------------------------
+
+static int answer(PCLIENT cptr, char *buff, int len)
+
+{
+    char path[FC_PATH], line[96];
+    char *inm = NULL, *rng = NULL;
+    int i, j, n, get, last = 0;
+    off_t first = 0, size;
+    PFENT e;
+
+    // Request line:
+    if((i = bb_scan_eol(buff, 0, len)) < 0) return -1;
+    get = !strncmp(buff, "GET ", 4);
+    if(!get && strncmp(buff, "HEAD ", 5)) return bb_send_static(cptr, nope, sizeof(nope)-1);
+    j = get ? 4 : 5;
+    if((n = bb_scan_chr(buff, j, i, ' ')) < 0 || target(buff + j, n - j, path) < 0) return bb_send_static(cptr, bad, sizeof(bad)-1);
+
+    // The headers we care about:
+    for(j=i+2; j<len; j=i+2)
+
+    {
+        if((i = bb_scan_eol(buff, j, len)) < 0) break;
+        if(!strncasecmp(buff + j, "Range:", 6)) rng = buff + j + 6;
+        else if(!strncasecmp(buff + j, "If-None-Match:", 14)) for(inm = buff + j + 14; *inm == ' '; inm++);
+        else if(!strncasecmp(buff + j, "Connection:", 11) && memmem(buff + j + 11, i - j - 11, "close", 5)) last = 1;
+    }
+
+    if((e = bb_fcache_get(&cache, path)) == NULL)
+
+    {
+        if(errno == EBUSY || errno == EMFILE || errno == ENFILE || errno == ENOMEM) return bb_send_static(cptr, busy, sizeof(busy)-1);
+        return bb_send_static(cptr, none, sizeof(none)-1);
+    }
+
+    size = e->size;
+
+    // Still what the client has (the tag, or any):
+    if(inm && (*inm == '*' || memmem(inm, bb_scan_eol(inm, 0, len - (inm - buff)), e->etag, e->elen)))
+
+    {
+        if(bb_send_static(cptr, same, sizeof(same)-1) < 0) goto end0;
+        if(bb_send_static(cptr, e->head, e->hlen) < 0) goto end0;
+        get = 0;
+    }
+
+    // Part of it:
+    else if(rng && (n = range(rng, e->size, &first, &size)) != 0)
+
+    {
+        if(n < 0)
+
+        {
+            n = snprintf(line, sizeof(line), "Content-Range: bytes */%lld\r\nContent-Length: 0\r\n", (long long)e->size);
+            if(bb_send_static(cptr, unsat, sizeof(unsat)-1) < 0 || bb_send_copy(cptr, line, n) < 0) goto end0;
+            get = 0;
+        }
+
+        else
+
+        {
+            n = snprintf(line, sizeof(line), "Content-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n",
+                         (long long)first, (long long)(first + size - 1), (long long)e->size, (long long)size);
+            if(bb_send_static(cptr, partial, sizeof(partial)-1) < 0) goto end0;
+            if(bb_send_static(cptr, e->head, e->hlen) < 0 || bb_send_copy(cptr, line, n) < 0) goto end0;
+        }
+    }
+
+    // All of it:
+    else
+
+    {
+        if(bb_send_static(cptr, ok, sizeof(ok)-1) < 0) goto end0;
+        if(bb_send_static(cptr, e->head, e->hlen) < 0 || bb_send_static(cptr, e->clen, e->clen_n) < 0) goto end0;
+    }
+
+    // Date, goodbye when asked or shutting down, then the body:
+    if(bb_send_copy(cptr, bb_date(), BB_DATE_LEN) < 0) goto end0;
+    if(last || bb_draining()){if(bb_send_static(cptr, bye, sizeof(bye)-1) < 0){goto end0;} bb_close(cptr);}
+    if(bb_send_static(cptr, crlf, 2) < 0) goto end0;
+
+    if(get && e->data && bb_send_static(cptr, e->data + first, size) < 0) goto end0;
+    if(get && e->fd >= 0 && bb_send_file(cptr, e->fd, first, size) < 0) goto end0;
+
+    // Let go of the entry once all this is out:
+    if(bb_send_hold(cptr, e) < 0) goto end0;
+    return 0;
+
+    // Return on error:
+    end0: bb_fcache_put(&cache, e);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// static_init: serve arg (or the current directory).
+//-----------------------------------------------------------------------------
+
+static int static_init(const char *arg)
+
+{
+    return bb_fcache_init(&cache, arg ? arg : ".");
+}
+
+//-----------------------------------------------------------------------------
+// static_accept:
+//-----------------------------------------------------------------------------
+
+static int static_accept(PCLIENT cptr)
+
+{
+    ((PSTATIC)bb_udata(cptr))->scan = 0;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// static_data: answer the first complete request head in buff.
+//-----------------------------------------------------------------------------
+
+static int static_data(PCLIENT cptr, char *buff, int len)
+
+{
+    int i;
+    PSTATIC st = bb_udata(cptr);
+
+    if((i = bb_scan_crlf2(buff, st->scan, len)) < 0){st->scan = len > 3 ? len-3 : 0; return 0;}
+    st->scan = 0;
+    if(answer(cptr, buff, i+2) < 0) return -1;
+    return i+4;
+}
+
+//-----------------------------------------------------------------------------
+// static_shed: overloaded, a canned 503 for the first complete request.
+//-----------------------------------------------------------------------------
+
+static int static_shed(PCLIENT cptr, char *buff, int len)
+
+{
+    int i;
+    PSTATIC st = bb_udata(cptr);
+
+    if((i = bb_scan_crlf2(buff, st->scan, len)) < 0){st->scan = len > 3 ? len-3 : 0; return 0;}
+    st->scan = 0;
+    if(bb_send_static(cptr, busy, sizeof(busy)-1) < 0) return -1;
+    return i+4;
+}
+
+//-----------------------------------------------------------------------------
+// static_release: a response is out, its entry may go.
+//-----------------------------------------------------------------------------
+
+static void static_release(void *arg)
+
+{
+    bb_fcache_put(&cache, (PFENT)arg);
+}
+
+//-----------------------------------------------------------------------------
+// Handler:
+//-----------------------------------------------------------------------------
+
+HANDLER bb_static = { .name = "static", .size = sizeof(STATIC), .on_init = static_init,
+                      .on_accept = static_accept, .on_data = static_data, .on_shed = static_shed,
+                      .on_release = static_release };
+
+#ifdef BB_PLUGIN
+extern HANDLER bb_handler __attribute__((alias("bb_static")));
+#endif
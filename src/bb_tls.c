@@ -0,0 +1,218 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <errno.h>
+#include "bb_tls.h"
+
+//-----------------------------------------------------------------------------
+// TLS termination. OpenSSL does the handshake on the non-blocking socket, a
+// step whenever it is ready, and then hands the session keys to the kernel
+// (SSL_OP_ENABLE_KTLS, TCP_ULP "tls") for each direction it can: plain
+// read(), sendmsg() and sendfile() on the socket from there on. Whatever
+// the kernel did not take (no tls module, a cipher or a direction it does
+// not offload) stays in userspace, with SSL_read() and SSL_write().
+// The rest of the file is empty unless built with make TLS=1.
+//-----------------------------------------------------------------------------
+
+#ifdef BB_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static SSL_CTX *ctx;    // Certificate and settings, shared by every session.
+
+//-----------------------------------------------------------------------------
+// fail: map a failed SSL call to errno (EAGAIN if it just has to wait),
+// returns -1. The error queue is per thread, clients are not.
+//-----------------------------------------------------------------------------
+
+static int fail(PTLS t, int r)
+
+{
+    switch(SSL_get_error(t->ssl, r))
+
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:   errno = EAGAIN; break;
+        case SSL_ERROR_SYSCALL:      if(errno == 0){errno = ECONNRESET;} break;
+        default:                     errno = ECONNRESET;
+    }
+
+    ERR_clear_error();
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_init: serve with the PEM certificate chain in cert and its key
+// (in cert too if key is NULL), -1 on error.
+//-----------------------------------------------------------------------------
+
+int bb_tls_init(const char *cert, const char *key)
+
+{
+    if((ctx = SSL_CTX_new(TLS_server_method())) == NULL) return -1;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    // Retried sends may come from a copy (pinned output), in pieces:
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx, cert) != 1) goto end0;
+    if(SSL_CTX_use_PrivateKey_file(ctx, key ? key : cert, SSL_FILETYPE_PEM) != 1) goto end0;
+    if(SSL_CTX_check_private_key(ctx) != 1) goto end0;
+    return 0;
+
+    // Return on error:
+    end0: ERR_print_errors_fp(stderr);
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+    errno = EINVAL;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_new: a session to accept on the socket fd, NULL on error.
+//-----------------------------------------------------------------------------
+
+PTLS bb_tls_new(int fd)
+
+{
+    PTLS t;
+
+    if((t = malloc(sizeof(TLS))) == NULL) return NULL;
+    if((t->ssl = SSL_new(ctx)) == NULL) goto end0;
+    if(SSL_set_fd(t->ssl, fd) != 1) goto end1;
+    SSL_set_accept_state(t->ssl);
+    t->hs = TLS_RD;
+    t->ktx = t->krx = 0;
+    return t;
+
+    // Return on error:
+    end1: SSL_free(t->ssl);
+    end0: free(t);
+    ERR_clear_error();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_hand: a handshake step, 0 once done (see ktx and krx), TLS_RD or
+// TLS_WR to wait for the socket and -1 on failure.
+//-----------------------------------------------------------------------------
+
+int bb_tls_hand(PTLS t)
+
+{
+    int r;
+
+    if((r = SSL_do_handshake(t->ssl)) == 1)
+
+    {
+        t->hs = 0;
+        t->ktx = BIO_get_ktls_send(SSL_get_wbio(t->ssl)) > 0;
+        t->krx = BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) > 0;
+        return 0;
+    }
+
+    switch(SSL_get_error(t->ssl, r))
+
+    {
+        case SSL_ERROR_WANT_READ:  t->hs = TLS_RD; break;
+        case SSL_ERROR_WANT_WRITE: t->hs = TLS_WR; break;
+        default:                   ERR_clear_error(); return -1;
+    }
+
+    return t->hs;
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_read: like read(), decrypted in userspace.
+//-----------------------------------------------------------------------------
+
+ssize_t bb_tls_read(PTLS t, void *buff, size_t len)
+
+{
+    int r;
+
+    if((r = SSL_read(t->ssl, buff, len)) > 0) return r;
+    if(SSL_get_error(t->ssl, r) == SSL_ERROR_ZERO_RETURN){ERR_clear_error(); return 0;}
+    return fail(t, r);
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_write: like write(), encrypted in userspace. One record at most,
+// a call that has to wait must be repeated with the same bytes (or more).
+//-----------------------------------------------------------------------------
+
+ssize_t bb_tls_write(void *arg, const void *buff, size_t len)
+
+{
+    PTLS t = (PTLS)arg;
+    int r;
+
+    if((r = SSL_write(t->ssl, buff, len)) > 0) return r;
+    return fail(t, r);
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_pending: decrypted bytes the socket will not raise an event for.
+//-----------------------------------------------------------------------------
+
+int bb_tls_pending(PTLS t)
+
+{
+    return SSL_pending(t->ssl) > 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_tls_free: drop the session (the socket is left alone).
+//-----------------------------------------------------------------------------
+
+void bb_tls_free(PTLS t)
+
+{
+    SSL_free(t->ssl);
+    free(t);
+}
+
+#else
+
+//-----------------------------------------------------------------------------
+// Built without OpenSSL: --tls fails, nothing else is ever called.
+//-----------------------------------------------------------------------------
+
+int bb_tls_init(const char *cert, const char *key){errno = ENOTSUP; return -1;}
+PTLS bb_tls_new(int fd){return NULL;}
+int bb_tls_hand(PTLS t){return -1;}
+ssize_t bb_tls_read(PTLS t, void *buff, size_t len){errno = ENOTSUP; return -1;}
+ssize_t bb_tls_write(void *arg, const void *buff, size_t len){errno = ENOTSUP; return -1;}
+int bb_tls_pending(PTLS t){return 0;}
+void bb_tls_free(PTLS t){}
+
+#endif
@@ -0,0 +1,73 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_TLS_
+#define _BB_TLS_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <sys/types.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define TLS_RD 1           // Handshake waits for the socket to be readable
+#define TLS_WR 2           // or writable.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _TLS
+
+{
+    void *ssl;     // OpenSSL session.
+    int hs;        // Handshaking: TLS_RD or TLS_WR, 0 once done.
+    int ktx;       // The kernel encrypts what we send (kTLS).
+    int krx;       // The kernel decrypts what we receive (kTLS).
+}
+
+TLS, *PTLS;
+
+//-----------------------------------------------------------------------------
+// Prototypes (make TLS=1, bb_tls_init() fails otherwise):
+//-----------------------------------------------------------------------------
+
+int bb_tls_init(const char *cert, const char *key);
+PTLS bb_tls_new(int fd);
+int bb_tls_hand(PTLS t);
+ssize_t bb_tls_read(PTLS t, void *buff, size_t len);
+ssize_t bb_tls_write(void *arg, const void *buff, size_t len);    // arg: PTLS.
+int bb_tls_pending(PTLS t);
+void bb_tls_free(PTLS t);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,240 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "bb_topo.h"
+
+//-----------------------------------------------------------------------------
+// CPU and NUMA topology from sysfs. Usable CPUs are the ones our affinity
+// allows (taskset, cgroup cpusets) that are online and not isolated,
+// narrowed down to --cpus when given. Without sysfs every allowed CPU is
+// on node 0.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define SYS_CPU "/sys/devices/system/cpu"
+
+//-----------------------------------------------------------------------------
+// slurp: a CPU list from sysfs, -1 when the file is missing.
+//-----------------------------------------------------------------------------
+
+static int slurp(const char *path, cpu_set_t *set)
+
+{
+    char buff[4096] = "";
+    FILE *f;
+
+    CPU_ZERO(set);
+    if((f = fopen(path, "r")) == NULL) return -1;
+    if(fgets(buff, sizeof(buff), f) == NULL) buff[0] = '\0';
+    fclose(f);
+    return bb_topo_list(buff, set);
+}
+
+//-----------------------------------------------------------------------------
+// nodeof: NUMA node of CPU c (its cpuN/nodeM link), 0 when unknown.
+//-----------------------------------------------------------------------------
+
+static int nodeof(int c)
+
+{
+    char path[64];
+    DIR *d;
+    struct dirent *e;
+    int n = 0;
+
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d", c);
+    if((d = opendir(path)) == NULL) return 0;
+    while((e = readdir(d)) != NULL) if(!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0' && e->d_name[4] <= '9'){n = atoi(e->d_name + 4); break;}
+    closedir(d);
+    return n < TOPO_CPUS ? n : 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_topo_list: parse a CPU list like "0-3,8,10-11" into set, -1 on junk.
+//-----------------------------------------------------------------------------
+
+int bb_topo_list(const char *list, cpu_set_t *set)
+
+{
+    char *p = (char *)list, *q;
+    long a, b;
+
+    CPU_ZERO(set);
+
+    while(*p && *p != '\n')
+
+    {
+        a = b = strtol(p, &q, 10);
+        if(q == p) return -1;
+        if(*q == '-' && (b = strtol(q + 1, &p, 10), p == q + 1)) return -1;
+        if(*q != '-') p = q;
+        if(a < 0 || b < a || b >= TOPO_CPUS) return -1;
+        for(; a<=b; a++) CPU_SET(a, set);
+        if(*p == ',') p++;
+        else if(*p && *p != '\n') return -1;
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_topo_init: discover the topology, -1 if no CPU is left to run on.
+//-----------------------------------------------------------------------------
+
+int bb_topo_init(PTOPO t, const char *list)
+
+{
+    int c, i, n, pass;
+    char path[96];
+    cpu_set_t set, sib;
+
+    // What we may run on, minus offline and isolated CPUs unless asked for:
+    if(sched_getaffinity(0, sizeof(t->usable), &t->usable) < 0) return -1;
+    if(slurp(SYS_CPU "/online", &t->online) < 0) t->online = t->usable;
+    CPU_AND(&t->usable, &t->usable, &t->online);
+
+    if(list)
+
+    {
+        if(bb_topo_list(list, &set) < 0) return -1;
+        CPU_AND(&t->usable, &t->usable, &set);
+    }
+
+    else if(slurp(SYS_CPU "/isolated", &set) == 0)
+
+    {
+        CPU_XOR(&set, &set, &t->online);
+        CPU_AND(&t->usable, &t->usable, &set);
+    }
+
+    // Every online CPU has a node, the steering program maps them all:
+    for(c=0, t->nodes=1; c<TOPO_CPUS; c++)
+
+    {
+        t->node[c] = CPU_ISSET(c, &t->online) ? nodeof(c) : 0;
+        if(t->node[c] >= t->nodes) t->nodes = t->node[c] + 1;
+    }
+
+    // Node by node, the first usable thread of each physical core goes
+    // first and its SMT siblings after all of them:
+    for(n=0, t->ncpu=0, t->smt=0; n<t->nodes; n++) for(pass=0; pass<2; pass++) for(c=0; c<TOPO_CPUS; c++)
+
+    {
+        if(!CPU_ISSET(c, &t->usable) || t->node[c] != n) continue;
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/thread_siblings_list", c);
+        if(slurp(path, &sib) < 0) CPU_SET(c, &sib);
+        CPU_AND(&sib, &sib, &t->usable);
+        for(i=0; i<c && !CPU_ISSET(i, &sib); i++);
+        if((i < c) != pass) continue;
+        if(pass) t->smt++;
+        t->cpu[t->ncpu++] = c;
+    }
+
+    return t->ncpu > 0 ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_topo_node: usable CPUs of a node.
+//-----------------------------------------------------------------------------
+
+void bb_topo_node(PTOPO t, int node, cpu_set_t *set)
+
+{
+    int i;
+
+    CPU_ZERO(set);
+    for(i=0; i<t->ncpu; i++) if(t->node[t->cpu[i]] == node) CPU_SET(t->cpu[i], set);
+}
+
+//-----------------------------------------------------------------------------
+// bb_topo_bind: prefer node for pages not faulted in yet, best effort (no
+// libnuma, a single node needs nothing).
+//-----------------------------------------------------------------------------
+
+int bb_topo_bind(void *addr, size_t len, int node)
+
+{
+    unsigned long mask[TOPO_CPUS / (8 * sizeof(unsigned long))] = { 0 };
+
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, TOPO_CPUS + 1, 0);
+}
+
+//-----------------------------------------------------------------------------
+// bb_topo_idle: jiffies the CPUs in set were idle (iowait too) and in all,
+// since boot, from /proc/stat. -1 when it can not be read. Called every
+// tick, so no stdio (it allocates): the cpu lines come first, the rest of
+// the file is not read.
+//-----------------------------------------------------------------------------
+
+int bb_topo_idle(const cpu_set_t *set, unsigned long *idle, unsigned long *all)
+
+{
+    int c, fd, len = 0;
+    char buff[4096], *p, *e;
+    unsigned long v[8];
+    ssize_t n;
+
+    *idle = *all = 0;
+    if((fd = open("/proc/stat", O_RDONLY | O_CLOEXEC)) < 0) return -1;
+
+    while((n = read(fd, buff + len, sizeof(buff) - 1 - len)) > 0)
+
+    {
+        len += n;
+        buff[len] = '\0';
+
+        for(p=buff; (e = strchr(p, '\n')) != NULL; p=e+1)
+
+        {
+            if(strncmp(p, "cpu", 3)) goto end;
+
+            // user nice system idle iowait irq softirq steal:
+            if(sscanf(p, "cpu%d %lu %lu %lu %lu %lu %lu %lu %lu", &c, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 9) continue;
+            if(c < 0 || c >= TOPO_CPUS || !CPU_ISSET(c, set)) continue;
+            *idle += v[3] + v[4];
+            *all += v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+        }
+
+        // The partial line goes to the front, a full buffer holds no cpu line:
+        if((len -= p - buff) == sizeof(buff) - 1) break;
+        memmove(buff, p, len);
+    }
+
+    end: close(fd);
+    return 0;
+}
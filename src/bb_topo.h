@@ -0,0 +1,74 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_TOPO_
+#define _BB_TOPO_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <sched.h>
+#include <stddef.h>
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define TOPO_CPUS CPU_SETSIZE     // Highest CPU number + 1 we can place.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _TOPO
+
+{
+    int ncpu;                 // Usable CPUs, one core each.
+    int cpu[TOPO_CPUS];       // Usable CPUs by node, SMT siblings last.
+    int nodes;                // Highest node + 1.
+    short node[TOPO_CPUS];    // Node of every online CPU (by CPU number).
+    cpu_set_t online;         // Online CPUs, usable or not.
+    cpu_set_t usable;         // CPUs we may run on.
+    int smt;                  // Usable CPUs sharing a physical core.
+}
+
+TOPO, *PTOPO;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_topo_init(PTOPO t, const char *list);
+int bb_topo_list(const char *list, cpu_set_t *set);
+void bb_topo_node(PTOPO t, int node, cpu_set_t *set);
+int bb_topo_bind(void *addr, size_t len, int node);
+int bb_topo_idle(const cpu_set_t *set, unsigned long *idle, unsigned long *all);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,135 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include "bb_trace.h"
+
+//-----------------------------------------------------------------------------
+// Every tracing thread owns a single-producer ring, the dumper drains them
+// all. A full ring drops new records (and counts them) instead of waiting.
+// The whole file is empty unless built with make TRACE=1.
+//-----------------------------------------------------------------------------
+
+#ifdef BB_TRACE
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static __thread PTRING mine;             // Calling thread's ring.
+static TRING ring[TRACE_THREADS];        // All tracing threads.
+static atomic_int used;                  // Rings handed out.
+
+//-----------------------------------------------------------------------------
+// bb_trace_new: give the calling thread its own ring.
+//-----------------------------------------------------------------------------
+
+int bb_trace_new(void)
+
+{
+    int i = atomic_fetch_add(&used, 1);
+
+    if(i >= TRACE_THREADS) return -1;
+    if((ring[i].rec = malloc(TRACE_SLOTS * sizeof(TREC))) == NULL) return -1;
+    mine = &ring[i];
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// bb_trace: record an event of the calling thread.
+//-----------------------------------------------------------------------------
+
+void bb_trace(unsigned int ev, void *cptr, unsigned long ts)
+
+{
+    PTRING r = mine;
+    PTREC rec;
+    size_t h;
+
+    if(r == NULL) return;
+    h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if(h - atomic_load_explicit(&r->tail, memory_order_acquire) == TRACE_SLOTS){r->drops++; return;}
+
+    rec = &r->rec[h & (TRACE_SLOTS - 1)];
+    rec->ts = ts;
+    rec->cptr = (unsigned long)cptr;
+    rec->ev = ev;
+    rec->tid = r - ring;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// bb_trace_dump: drain every ring into f, as TREC records or as a Chrome
+// trace (about:tracing, Perfetto). There the FIFO wait of a client shows up
+// as a "queued" span from push to pop. One dumper at a time.
+//-----------------------------------------------------------------------------
+
+void bb_trace_dump(FILE *f, int json)
+
+{
+    int i, n = atomic_load(&used), first = 1;
+    size_t t, h;
+    PTREC rec;
+
+    static const char *name[] = { "wait", "push", "pop", "parse", "write" };
+
+    if(json) fprintf(f, "{\"traceEvents\":[");
+
+    for(i=0; i<n && i<TRACE_THREADS; i++)
+
+    {
+        t = atomic_load_explicit(&ring[i].tail, memory_order_relaxed);
+        h = atomic_load_explicit(&ring[i].head, memory_order_acquire);
+
+        for(; t!=h; t++)
+
+        {
+            rec = &ring[i].rec[t & (TRACE_SLOTS - 1)];
+            if(!json){fwrite(rec, sizeof(TREC), 1, f); continue;}
+
+            // Instant events, and async begin/end pairs by client for the
+            // time spent in the FIFO:
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"client\":\"0x%lx\"}}",
+                    first ? "" : ",", name[rec->ev], rec->ts / 1e3, rec->tid, rec->cptr);
+            first = 0;
+
+            if(rec->ev == TR_PUSH || rec->ev == TR_POP)
+            fprintf(f, ",\n{\"name\":\"queued\",\"cat\":\"fifo\",\"ph\":\"%s\",\"id\":\"0x%lx\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    rec->ev == TR_PUSH ? "b" : "e", rec->cptr, rec->ts / 1e3, rec->tid);
+        }
+
+        atomic_store_explicit(&ring[i].tail, h, memory_order_release);
+    }
+
+    if(json)
+
+    {
+        fprintf(f, "\n],\"otherData\":{\"drops\":\"");
+        for(i=0; i<n && i<TRACE_THREADS; i++) fprintf(f, "%s%lu", i ? " " : "", ring[i].drops);
+        fprintf(f, "\"}}\n");
+    }
+}
+
+#endif
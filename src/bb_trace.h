@@ -0,0 +1,102 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_TRACE_
+#define _BB_TRACE_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include "bb_stat.h"
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define TRACE_SLOTS 65536     // Records per thread ring (power of two).
+#define TRACE_THREADS 1024    // Max threads tracing.
+
+#define TR_WAIT 0             // Event out of epoll_wait (or a recv CQE).
+#define TR_PUSH 1             // Client pushed to the Data-Workers FIFO.
+#define TR_POP 2              // Client popped by a Data-Worker.
+#define TR_PARSE 3            // Complete requests handed to the handler.
+#define TR_WRITE 4            // Responses handed to the kernel.
+
+// Tracing is compiled in with make TRACE=1, calls vanish otherwise:
+#ifdef BB_TRACE
+#define TRACE_ON 1
+#define TRACE_NEW() bb_trace_new()
+#define TRACE(ev, cptr) bb_trace((ev), (cptr), bb_stat_now())
+#define TRACE_AT(ev, cptr, ts) bb_trace((ev), (cptr), (ts))
+#define TRACE_DUMP(f, json) bb_trace_dump((f), (json))
+#else
+#define TRACE_ON 0
+#define TRACE_NEW() 0
+#define TRACE(ev, cptr) ((void)0)
+#define TRACE_AT(ev, cptr, ts) ((void)0)
+#define TRACE_DUMP(f, json) ((void)0)
+#endif
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _TREC
+
+{
+    unsigned long ts;     // bb_stat_now() in ns.
+    unsigned long cptr;   // Client (its address).
+    unsigned int ev;      // TR_*.
+    unsigned int tid;     // Tracing thread.
+}
+
+TREC, *PTREC;             // Also the binary dump format (host order).
+
+typedef struct _TRING
+
+{
+    PTREC rec;                                                   // TRACE_SLOTS records.
+    unsigned long drops;                                         // Records lost, ring full.
+    atomic_size_t head __attribute__((aligned(CACHELINE)));      // Written by the owner.
+    atomic_size_t tail __attribute__((aligned(CACHELINE)));      // Written by the dumper.
+}
+
+TRING, *PTRING;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_trace_new(void);
+void bb_trace(unsigned int ev, void *cptr, unsigned long ts);
+void bb_trace_dump(FILE *f, int json);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,309 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "bb_uring.h"
+
+//-----------------------------------------------------------------------------
+// Bare io_uring plumbing on top of the raw system calls (no liburing). One
+// thread owns a ring: SQEs are filled in place and published in batches by
+// bb_uring_enter(), CQEs are consumed in order with bb_uring_seen().
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+//-----------------------------------------------------------------------------
+// bb_uring_new: set up a ring and map it, returns -1 on error.
+//-----------------------------------------------------------------------------
+
+int bb_uring_new(PURING r, unsigned entries)
+
+{
+    struct io_uring_params p;
+    unsigned i, *arr;
+    void *sqe;
+
+    // Newest setup first (the creator thread submits), then older ones:
+    unsigned flags[] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN,
+        IORING_SETUP_CQSIZE };
+
+    // Multishot requests post many completions per submission:
+    for(r->fd=-1, i=0; r->fd<0 && i<sizeof(flags)/sizeof(flags[0]); i++)
+
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = flags[i];
+        p.cq_entries = entries * 4;
+        r->fd = syscall(__NR_io_uring_setup, entries, &p);
+        if(r->fd < 0 && errno != EINVAL) return -1;
+    }
+
+    if(r->fd < 0) return -1;
+    r->feat = p.features;
+
+    // Both rings may share one mapping:
+    r->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if((p.features & IORING_FEAT_SINGLE_MMAP) && r->cqlen > r->sqlen) r->sqlen = r->cqlen;
+
+    r->sqp = mmap(NULL, r->sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sqp == MAP_FAILED) goto end0;
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP) r->cqp = r->sqp;
+    else if((r->cqp = mmap(NULL, r->cqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) goto end1;
+
+    sqe = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(sqe == MAP_FAILED) goto end2;
+
+    r->sqes = sqe;
+    r->sqh = (unsigned *)((char *)r->sqp + p.sq_off.head);
+    r->sqt = (unsigned *)((char *)r->sqp + p.sq_off.tail);
+    r->sqm = *(unsigned *)((char *)r->sqp + p.sq_off.ring_mask);
+    r->tail = *r->sqt;
+    r->cqh = (unsigned *)((char *)r->cqp + p.cq_off.head);
+    r->cqt = (unsigned *)((char *)r->cqp + p.cq_off.tail);
+    r->cqm = *(unsigned *)((char *)r->cqp + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cqp + p.cq_off.cqes);
+
+    // SQ slot i always holds SQE i:
+    arr = (unsigned *)((char *)r->sqp + p.sq_off.array);
+    for(i=0; i<p.sq_entries; i++) arr[i] = i;
+    return 0;
+
+    // Return on error:
+    end2: if(r->cqp != r->sqp) munmap(r->cqp, r->cqlen);
+    end1: munmap(r->sqp, r->sqlen);
+    end0: close(r->fd);
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_sqe: next free SQE (zeroed), NULL if the SQ stays full.
+//-----------------------------------------------------------------------------
+
+struct io_uring_sqe *bb_uring_sqe(PURING r)
+
+{
+    struct io_uring_sqe *sqe;
+
+    // Full, hand the pending ones to the kernel:
+    if(r->tail - LOAD(r->sqh) > r->sqm && (bb_uring_enter(r, 0, -1) < 0 || r->tail - LOAD(r->sqh) > r->sqm)) return NULL;
+
+    sqe = &r->sqes[r->tail++ & r->sqm];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_enter: submit what is pending and wait for wait completions, up
+// to ms milliseconds (ms < 0 waits forever). Returns the SQEs the kernel did
+// not take yet or -1 on error.
+//-----------------------------------------------------------------------------
+
+int bb_uring_enter(PURING r, unsigned wait, int ms)
+
+{
+    int n;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+    STORE(r->sqt, r->tail);
+
+    // Bounded waits pass the timeout along (IORING_FEAT_EXT_ARG):
+    if(wait && ms >= 0)
+
+    {
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uintptr_t)&ts;
+        n = syscall(__NR_io_uring_enter, r->fd, r->tail - LOAD(r->sqh), wait, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    else n = syscall(__NR_io_uring_enter, r->fd, r->tail - LOAD(r->sqh), wait, flags, NULL, 0);
+
+    // Interrupted or timed out waits are retried by the caller's loop:
+    if(n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) return -1;
+    return r->tail - LOAD(r->sqh);
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_cqe: oldest unseen completion or NULL.
+//-----------------------------------------------------------------------------
+
+struct io_uring_cqe *bb_uring_cqe(PURING r)
+
+{
+    unsigned head = *r->cqh;
+
+    if(head == LOAD(r->cqt)) return NULL;
+    return &r->cqes[head & r->cqm];
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_seen: give the oldest completion back to the kernel.
+//-----------------------------------------------------------------------------
+
+void bb_uring_seen(PURING r)
+
+{
+    STORE(r->cqh, *r->cqh + 1);
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_free: closing the ring cancels whatever is still in flight.
+//-----------------------------------------------------------------------------
+
+void bb_uring_free(PURING r)
+
+{
+    munmap(r->sqes, (r->sqm + 1) * sizeof(struct io_uring_sqe));
+    if(r->cqp != r->sqp) munmap(r->cqp, r->cqlen);
+    munmap(r->sqp, r->sqlen);
+    close(r->fd);
+}
+
+//-----------------------------------------------------------------------------
+// bb_ubuf_new: register cnt buffers of size bytes as group bgid.
+//-----------------------------------------------------------------------------
+
+int bb_ubuf_new(PURING r, PUBUF b, unsigned cnt, unsigned size, int bgid)
+
+{
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    b->cnt = cnt;
+    b->size = size;
+    b->bgid = bgid;
+    b->tail = 0;
+
+    b->br = mmap(NULL, cnt * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(b->br == MAP_FAILED) return -1;
+
+    b->base = mmap(NULL, (size_t)cnt * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(b->base == MAP_FAILED) goto end0;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)b->br;
+    reg.ring_entries = cnt;
+    reg.bgid = bgid;
+    if(syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto end1;
+
+    for(i=0; i<cnt; i++) bb_ubuf_put(b, i);
+    return 0;
+
+    // Return on error:
+    end1: munmap(b->base, (size_t)cnt * size);
+    end0: munmap(b->br, cnt * sizeof(struct io_uring_buf));
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// bb_ubuf_get: address of buffer bid.
+//-----------------------------------------------------------------------------
+
+char *bb_ubuf_get(PUBUF b, unsigned bid)
+
+{
+    return b->base + (size_t)bid * b->size;
+}
+
+//-----------------------------------------------------------------------------
+// bb_ubuf_put: hand buffer bid back to the kernel.
+//-----------------------------------------------------------------------------
+
+void bb_ubuf_put(PUBUF b, unsigned bid)
+
+{
+    struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->cnt - 1)];
+
+    buf->addr = (uintptr_t)bb_ubuf_get(b, bid);
+    buf->len = b->size;
+    buf->bid = bid;
+    STORE(&b->br->tail, ++b->tail);
+}
+
+//-----------------------------------------------------------------------------
+// bb_ubuf_free: the ring must be gone (or the group unregistered) first.
+//-----------------------------------------------------------------------------
+
+void bb_ubuf_free(PUBUF b)
+
+{
+    munmap(b->base, (size_t)b->cnt * b->size);
+    munmap(b->br, b->cnt * sizeof(struct io_uring_buf));
+}
+
+//-----------------------------------------------------------------------------
+// bb_uring_probe: 0 if this kernel does multishot recv into a buffer ring,
+// keeps submitted data stable and takes wait timeouts, -1 otherwise (or
+// io_uring is disabled).
+//-----------------------------------------------------------------------------
+
+int bb_uring_probe(void)
+
+{
+    URING r;
+    UBUF b;
+    int sv[2], ok = -1;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+
+    if(bb_uring_new(&r, 8) < 0) return -1;
+    if(!(r.feat & IORING_FEAT_SUBMIT_STABLE) || !(r.feat & IORING_FEAT_EXT_ARG)) goto end0;
+    if(bb_ubuf_new(&r, &b, 4, 64, 0) < 0) goto end0;
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) goto end1;
+
+    // Older kernels reject the flag or complete without IORING_CQE_F_MORE:
+    if(write(sv[1], "x", 1) != 1 || (sqe = bb_uring_sqe(&r)) == NULL) goto end2;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+
+    if(bb_uring_enter(&r, 1, -1) < 0 || (cqe = bb_uring_cqe(&r)) == NULL) goto end2;
+    if(cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER)) ok = 0;
+
+    // Return:
+    end2: close(sv[0]); close(sv[1]);
+    end1: bb_uring_free(&r); bb_ubuf_free(&b); return ok;
+    end0: bb_uring_free(&r); return ok;
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_URING_
+#define _BB_URING_
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _URING
+
+{
+    int                 fd;      // Ring file descriptor.
+    unsigned            feat;    // IORING_FEAT_* reported by the kernel.
+    unsigned            *sqh;    // SQ head (kernel).
+    unsigned            *sqt;    // SQ tail (published to the kernel).
+    unsigned            sqm;     // SQ mask.
+    unsigned            tail;    // SQ tail (local, not yet published).
+    struct io_uring_sqe *sqes;   // Submission entries.
+    unsigned            *cqh;    // CQ head (ours).
+    unsigned            *cqt;    // CQ tail (kernel).
+    unsigned            cqm;     // CQ mask.
+    struct io_uring_cqe *cqes;   // Completion entries.
+    void                *sqp;    // SQ ring mapping.
+    void                *cqp;    // CQ ring mapping (may be sqp).
+    size_t              sqlen;   // SQ ring mapping length.
+    size_t              cqlen;   // CQ ring mapping length.
+}
+
+URING, *PURING;
+
+typedef struct _UBUF
+
+{
+    struct io_uring_buf_ring *br;   // Ring of buffers handed to the kernel.
+    char                *base;      // Buffer memory.
+    unsigned            cnt;        // Buffers (power of two).
+    unsigned            size;       // Bytes per buffer.
+    unsigned short      tail;       // Local copy of br->tail.
+    int                 bgid;       // Buffer group id.
+}
+
+UBUF, *PUBUF;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+int bb_uring_new(PURING r, unsigned entries);
+struct io_uring_sqe *bb_uring_sqe(PURING r);
+int bb_uring_enter(PURING r, unsigned wait, int ms);
+struct io_uring_cqe *bb_uring_cqe(PURING r);
+void bb_uring_seen(PURING r);
+void bb_uring_free(PURING r);
+int bb_uring_probe(void);
+
+int bb_ubuf_new(PURING r, PUBUF b, unsigned cnt, unsigned size, int bgid);
+char *bb_ubuf_get(PUBUF b, unsigned bid);
+void bb_ubuf_put(PUBUF b, unsigned bid);
+void bb_ubuf_free(PUBUF b);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,209 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stddef.h>
+#include "bb_wheel.h"
+
+//-----------------------------------------------------------------------------
+// Hierarchical timing wheel, single-threaded. Level l holds the timers due
+// in [64^l, 64^(l+1)) ticks, indexed by their own bits of 'when'. Crossing
+// a level boundary cascades the matching slot one level down, so adding,
+// deleting and expiring are O(1) and every timer moves WHEEL_LEVELS times
+// at most.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MASK (WHEEL_SLOTS - 1)
+#define SLOT(w, l, t) (&(w)->slot[l][((t) >> (WHEEL_BITS * (l))) & MASK])
+
+//-----------------------------------------------------------------------------
+// bb_wheel_init:
+//-----------------------------------------------------------------------------
+
+void bb_wheel_init(PWHEEL w, unsigned long now)
+
+{
+    int l, i;
+
+    w->now = now;
+    w->cnt = 0;
+
+    for(l=0; l<WHEEL_LEVELS; l++)
+    for(i=0; i<WHEEL_SLOTS; i++) w->slot[l][i].next = w->slot[l][i].prev = &w->slot[l][i];
+}
+
+//-----------------------------------------------------------------------------
+// file: link t in the slot for t->when (not before now).
+//-----------------------------------------------------------------------------
+
+static void file(PWHEEL w, PTIMER t)
+
+{
+    unsigned long d = t->when - w->now;
+    PTIMER h;
+    int l;
+
+    for(l=0; l<WHEEL_LEVELS-1 && d >= 1UL << (WHEEL_BITS * (l+1)); l++);
+
+    h = SLOT(w, l, t->when);
+    t->next = h->next;
+    t->prev = h;
+    h->next->prev = t;
+    h->next = t;
+}
+
+//-----------------------------------------------------------------------------
+// bb_wheel_add: file t for tick when (clamped to the next tick and span).
+//-----------------------------------------------------------------------------
+
+void bb_wheel_add(PWHEEL w, PTIMER t, unsigned long when)
+
+{
+    if((long)(when - w->now) < 1) when = w->now + 1;
+    if(when - w->now >= WHEEL_SPAN) when = w->now + WHEEL_SPAN - 1;
+
+    bb_wheel_del(w, t);
+    t->when = when;
+    file(w, t);
+    w->cnt++;
+}
+
+//-----------------------------------------------------------------------------
+// bb_wheel_del: unfile t, nothing if it is not filed.
+//-----------------------------------------------------------------------------
+
+void bb_wheel_del(PWHEEL w, PTIMER t)
+
+{
+    if(t->prev == NULL) return;
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    w->cnt--;
+}
+
+//-----------------------------------------------------------------------------
+// bb_wheel_pull: bring every timer filed after tick when forward to it.
+//-----------------------------------------------------------------------------
+
+void bb_wheel_pull(PWHEEL w, unsigned long when)
+
+{
+    PTIMER t, h, next, list = NULL;
+    int l, i;
+
+    for(l=0; l<WHEEL_LEVELS; l++)
+    for(i=0; i<WHEEL_SLOTS; i++)
+
+    {
+        for(h=&w->slot[l][i], t=h->next; t!=h; t=next)
+
+        {
+            next = t->next;
+            if((long)(t->when - when) <= 0) continue;
+            bb_wheel_del(w, t);
+            t->next = list;
+            list = t;
+        }
+    }
+
+    for(t=list; t; t=next){next = t->next; bb_wheel_add(w, t, when);}
+}
+
+//-----------------------------------------------------------------------------
+// bb_wheel_advance: process ticks up to now, returns the expired timers
+// (unfiled, chained by next).
+//-----------------------------------------------------------------------------
+
+PTIMER bb_wheel_advance(PWHEEL w, unsigned long now)
+
+{
+    PTIMER t, h, out = NULL;
+    int l;
+
+    // Nothing filed, jump:
+    if(w->cnt == 0){w->now = now; return NULL;}
+
+    while((long)(now - w->now) > 0)
+
+    {
+        w->now++;
+
+        // Top-down, a cascaded timer may land in a lower slot due now:
+        for(l=WHEEL_LEVELS-1; l>0; l--)
+
+        {
+            if(w->now & ((1UL << (WHEEL_BITS * l)) - 1)) continue;
+
+            for(h=SLOT(w, l, w->now), t=h->next, h->next=h->prev=h; t!=h; t=h->next)
+
+            {
+                h->next = t->next;
+                file(w, t);
+            }
+        }
+
+        // Everything in the current level-0 slot is due:
+        for(h=SLOT(w, 0, w->now), t=h->next; t!=h; t=h->next)
+
+        {
+            h->next = t->next;
+            t->prev = NULL;
+            t->next = out;
+            out = t;
+            w->cnt--;
+        }
+
+        h->prev = h;
+    }
+
+    return out;
+}
+
+//-----------------------------------------------------------------------------
+// bb_wheel_next: ticks until the wheel may have work, -1 if it is empty.
+//-----------------------------------------------------------------------------
+
+long bb_wheel_next(PWHEEL w)
+
+{
+    PTIMER h;
+    long i;
+
+    if(w->cnt == 0) return -1;
+
+    // A due slot or a boundary where higher levels cascade:
+    for(i=1; i<WHEEL_SLOTS; i++)
+
+    {
+        h = SLOT(w, 0, w->now + i);
+        if(h->next != h || ((w->now + i) & MASK) == 0) return i;
+    }
+
+    return WHEEL_SLOTS;
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Include guard:
+//-----------------------------------------------------------------------------
+
+#ifndef _BB_WHEEL_
+#define _BB_WHEEL_
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define WHEEL_BITS 6                       // Slots per level as a power of 2.
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4                     // 64^4 ticks ahead at most.
+#define WHEEL_SPAN (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _TIMER
+
+{
+    struct _TIMER *next;    // Slot list (or list of expired timers).
+    struct _TIMER *prev;    // NULL when not filed.
+    unsigned long when;     // Tick it is filed for.
+}
+
+TIMER, *PTIMER;
+
+typedef struct _WHEEL
+
+{
+    unsigned long now;                        // Last tick processed.
+    unsigned long cnt;                        // Filed timers.
+    TIMER slot[WHEEL_LEVELS][WHEEL_SLOTS];    // Circular list heads.
+}
+
+WHEEL, *PWHEEL;
+
+//-----------------------------------------------------------------------------
+// Prototypes:
+//-----------------------------------------------------------------------------
+
+void bb_wheel_init(PWHEEL w, unsigned long now);
+void bb_wheel_add(PWHEEL w, PTIMER t, unsigned long when);
+void bb_wheel_del(PWHEEL w, PTIMER t);
+void bb_wheel_pull(PWHEEL w, unsigned long when);
+PTIMER bb_wheel_advance(PWHEEL w, unsigned long now);
+long bb_wheel_next(PWHEEL w);
+
+//-----------------------------------------------------------------------------
+// End of include guard:
+//-----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,92 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//-----------------------------------------------------------------------------
+// Allocation counter for test/malloc.sh, preloaded into bb (LD_PRELOAD).
+// Every call to the allocator is counted in a word of the file named by
+// BB_MALLOCS, shared with the test and surviving bb's fork, then forwarded
+// to glibc's own entry points (dlsym() would allocate).
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Externs:
+//-----------------------------------------------------------------------------
+
+extern void *__libc_malloc(size_t len);
+extern void *__libc_calloc(size_t n, size_t len);
+extern void *__libc_realloc(void *ptr, size_t len);
+extern void *__libc_memalign(size_t align, size_t len);
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static atomic_ulong early;              // Until the file is mapped.
+static atomic_ulong *calls = &early;    // Allocations so far.
+
+//-----------------------------------------------------------------------------
+// init: map the counter, calls before it are not counted.
+//-----------------------------------------------------------------------------
+
+__attribute__((constructor)) static void init(void)
+
+{
+    char *path = getenv("BB_MALLOCS");
+    void *m;
+    int fd;
+
+    if(path == NULL || (fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) return;
+    if(ftruncate(fd, sizeof(atomic_ulong)) == 0 &&
+      (m = mmap(NULL, sizeof(atomic_ulong), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED) calls = m;
+    close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// The allocator:
+//-----------------------------------------------------------------------------
+
+#define COUNT() atomic_fetch_add_explicit(calls, 1, memory_order_relaxed)
+
+void *malloc(size_t len){COUNT(); return __libc_malloc(len);}
+void *calloc(size_t n, size_t len){COUNT(); return __libc_calloc(n, len);}
+void *realloc(void *ptr, size_t len){COUNT(); return __libc_realloc(ptr, len);}
+void *memalign(size_t align, size_t len){COUNT(); return __libc_memalign(align, len);}
+void *aligned_alloc(size_t align, size_t len){COUNT(); return __libc_memalign(align, len);}
+
+int posix_memalign(void **ptr, size_t align, size_t len)
+
+{
+    COUNT();
+    if((*ptr = __libc_memalign(align, len)) == NULL) return ENOMEM;
+    return 0;
+}
@@ -0,0 +1,159 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../src/bb_deque.h"
+
+//-----------------------------------------------------------------------------
+// Work-stealing deque stress test: the owner pushes numbered items into a
+// small deque (full and wrapping all the time) while thieves take them from
+// the top, half polling bb_deque_steal(), half parking the way Data-Workers
+// do (bb_deque_idle, a last look, bb_deque_park) and woken by the owner
+// after every push. The owner never pops (bb_deque has no owner end to
+// consume from), so its pushes race the thieves' CAS on top. Every item must
+// come out exactly once, each thief seeing them oldest first, and no thief
+// may sleep through a push (the test would hang: it is cut after a minute).
+//
+//   deque [thieves] [items] [deque size]
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MAX_THREADS 64
+#define STOP ((void *)UINTPTR_MAX)
+#define WATCHDOG 60        // Seconds before a lost wake-up is called.
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static DEQUE dq;
+static int thieves = 4;
+static unsigned long items = 1000000;
+static atomic_uchar *seen;           // Times each item came out.
+static atomic_ulong bad;             // Out of order or unknown items.
+static atomic_ulong parks;           // Times a thief went to sleep.
+
+//-----------------------------------------------------------------------------
+// take: steal, or park until woken (odd thieves poll).
+//-----------------------------------------------------------------------------
+
+static void *take(int poll)
+
+{
+    unsigned int wake;
+    void *ptr;
+
+    while(1)
+
+    {
+        if((ptr = bb_deque_steal(&dq)) != NULL) return ptr;
+        if(poll){sched_yield(); continue;}
+
+        wake = bb_deque_idle(&dq);
+        ptr = bb_deque_steal(&dq);
+        if(ptr == NULL) atomic_fetch_add_explicit(&parks, 1, memory_order_relaxed);
+        bb_deque_park(&dq, wake, ptr);
+        if(ptr != NULL) return ptr;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// thief: take until told to stop, checking the order.
+//-----------------------------------------------------------------------------
+
+static void *thief(void *arg)
+
+{
+    long last = -1;
+    uintptr_t i;
+    void *ptr;
+
+    while((ptr = take((uintptr_t)arg & 1)) != STOP)
+
+    {
+        i = (uintptr_t)ptr - 1;
+        if(i >= items || (long)i <= last){atomic_fetch_add(&bad, 1); continue;}
+        last = i;
+        atomic_fetch_add_explicit(&seen[i], 1, memory_order_relaxed);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// give: owner push, yields while full, then calls a parked thief back.
+//-----------------------------------------------------------------------------
+
+static void give(void *ptr)
+
+{
+    while(bb_deque_push(&dq, ptr) < 0) sched_yield();
+    bb_deque_wake(&dq);
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    pthread_t tt[MAX_THREADS];
+    unsigned long i, lost = 0, dups = 0;
+    size_t size = 64;
+    int k;
+
+    if(argc > 1) thieves = atoi(argv[1]);
+    if(argc > 2) items = strtoul(argv[2], NULL, 10);
+    if(argc > 3) size = strtoul(argv[3], NULL, 10);
+    if(thieves < 1 || thieves > MAX_THREADS){fprintf(stderr, "1-%d thieves\n", MAX_THREADS); return 1;}
+
+    if((seen = calloc(items, 1)) == NULL || bb_deque_new(&dq, size) < 0){perror("deque"); return 1;}
+    for(k=0; k<thieves; k++) pthread_create(&tt[k], NULL, thief, (void *)(uintptr_t)k);
+
+    // This thread owns the deque, one stop per thief at the end:
+    alarm(WATCHDOG);
+    for(i=0; i<items; i++) give((void *)(i + 1));
+    for(k=0; k<thieves; k++) give(STOP);
+    for(k=0; k<thieves; k++) pthread_join(tt[k], NULL);
+
+    for(i=0; i<items; i++){if(seen[i] == 0) lost++; else if(seen[i] > 1) dups++;}
+    printf("deque: %d thieves, size %ld: %lu items, %lu lost, %lu twice, %lu out of order, %lu parks, %zu left\n",
+           thieves, dq.mask + 1, items, lost, dups, (unsigned long)bad, (unsigned long)parks, bb_deque_len(&dq));
+
+    k = lost || dups || bad || bb_deque_len(&dq);
+    bb_deque_free(&dq);
+    free(seen);
+    return k;
+}
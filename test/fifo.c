@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../src/bb_fifo.h"
+
+//-----------------------------------------------------------------------------
+// MPMC stress test for the ready queue: producers push numbered items into
+// a small ring (full and wrapping all the time), consumers pop them, half
+// parking in bb_fifo_wait(), half polling bb_fifo_pop(). Every item must
+// come out exactly once, and each producer's items in the order pushed.
+//
+//   fifo [producers] [consumers] [items per producer] [ring size]
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MAX_THREADS 64
+#define ITEM(p, i) ((void *)(((uintptr_t)(p) + 1) << 32 | (i)))
+#define STOP ((void *)UINTPTR_MAX)
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static FIFO fifo;
+static int prods = 4, cons = 4;
+static unsigned long items = 250000;
+static atomic_uchar *seen;           // Times each item came out.
+static atomic_ulong bad;             // Out of order or unknown items.
+
+//-----------------------------------------------------------------------------
+// producer: push items in order, yield while the ring is full.
+//-----------------------------------------------------------------------------
+
+static void *producer(void *arg)
+
+{
+    uintptr_t p = (uintptr_t)arg;
+    unsigned long i;
+
+    for(i=0; i<items; i++) while(bb_fifo_push(&fifo, ITEM(p, i)) < 0) sched_yield();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// consumer: pop until told to stop, checking the order per producer.
+//-----------------------------------------------------------------------------
+
+static void *consumer(void *arg)
+
+{
+    long last[MAX_THREADS];
+    uintptr_t v, p, i;
+    void *ptr;
+    int k;
+
+    for(k=0; k<MAX_THREADS; k++) last[k] = -1;
+
+    while(1)
+
+    {
+        if((uintptr_t)arg & 1){if((ptr = bb_fifo_pop(&fifo)) == NULL){sched_yield(); continue;}}
+        else ptr = bb_fifo_wait(&fifo);
+        if(ptr == STOP) break;
+
+        v = (uintptr_t)ptr;
+        p = (v >> 32) - 1;
+        i = v & 0xffffffff;
+        if(p >= prods || i >= items || (long)i <= last[p]){atomic_fetch_add(&bad, 1); continue;}
+        last[p] = i;
+        atomic_fetch_add_explicit(&seen[p * items + i], 1, memory_order_relaxed);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    pthread_t pt[MAX_THREADS], ct[MAX_THREADS];
+    unsigned long i, lost = 0, dups = 0;
+    size_t size = 64;
+    int k;
+
+    if(argc > 1) prods = atoi(argv[1]);
+    if(argc > 2) cons = atoi(argv[2]);
+    if(argc > 3) items = strtoul(argv[3], NULL, 10);
+    if(argc > 4) size = strtoul(argv[4], NULL, 10);
+    if(prods < 1 || prods > MAX_THREADS || cons < 1 || cons > MAX_THREADS){fprintf(stderr, "1-%d producers and consumers\n", MAX_THREADS); return 1;}
+
+    if((seen = calloc(prods * items, 1)) == NULL || bb_fifo_new(&fifo, size) < 0){perror("fifo"); return 1;}
+    for(k=0; k<cons; k++) pthread_create(&ct[k], NULL, consumer, (void *)(uintptr_t)k);
+    for(k=0; k<prods; k++) pthread_create(&pt[k], NULL, producer, (void *)(uintptr_t)k);
+
+    // Producers done, one stop per consumer (each takes exactly one):
+    for(k=0; k<prods; k++) pthread_join(pt[k], NULL);
+    for(k=0; k<cons; k++) while(bb_fifo_push(&fifo, STOP) < 0) sched_yield();
+    for(k=0; k<cons; k++) pthread_join(ct[k], NULL);
+
+    for(i=0; i<prods * items; i++){if(seen[i] == 0) lost++; else if(seen[i] > 1) dups++;}
+    printf("fifo: %d producers, %d consumers, ring %zu: %lu items, %lu lost, %lu twice, %lu out of order, %s at the end\n",
+           prods, cons, fifo.mask + 1, prods * items, lost, dups, (unsigned long)bad, bb_fifo_empty(&fifo) ? "empty" : "not empty");
+
+    k = lost || dups || bad || !bb_fifo_empty(&fifo) || bb_fifo_len(&fifo);
+    bb_fifo_free(&fifo);
+    free(seen);
+    return k;
+}
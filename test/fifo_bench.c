@@ -0,0 +1,190 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../src/bb_fifo.h"
+
+//-----------------------------------------------------------------------------
+// Hand-off microbenchmark, N producers x M consumers: the lock-free ring
+// (consumers parked in bb_fifo_wait) against the FIFO it replaced, a linked
+// list with a node malloc()ed per push behind one mutex and condvar, used
+// the way the Wait-Workers and Data-Workers used it.
+//
+//   fifo_bench [items per run]
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MAX_THREADS 16
+#define STOP ((void *)UINTPTR_MAX)
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _NODE
+
+{
+    void            *cptr;
+    struct _NODE    *nxt;
+}
+
+NODE, *PNODE;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static FIFO ring;                    // The lock-free ring.
+static PNODE cap, cua;               // The old FIFO, from the dummy node.
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cnd = PTHREAD_COND_INITIALIZER;
+static unsigned long items;          // Per producer.
+
+//-----------------------------------------------------------------------------
+// old_push/old_pop: the old FIFO and its locking.
+//-----------------------------------------------------------------------------
+
+static void old_push(void *cptr)
+
+{
+    PNODE ptr = malloc(sizeof(NODE));
+
+    ptr->cptr = cptr;
+    ptr->nxt = NULL;
+    pthread_mutex_lock(&mtx);
+    cua->nxt = ptr;
+    cua = ptr;
+    pthread_cond_signal(&cnd);
+    pthread_mutex_unlock(&mtx);
+}
+
+static void *old_pop(void)
+
+{
+    PNODE ptr;
+    void *cptr;
+
+    pthread_mutex_lock(&mtx);
+    while(cap == cua) pthread_cond_wait(&cnd, &mtx);
+    ptr = cap;
+    cap = ptr->nxt;
+    cptr = cap->cptr;
+    pthread_mutex_unlock(&mtx);
+    free(ptr);
+    return cptr;
+}
+
+//-----------------------------------------------------------------------------
+// The threads, arg tells the old FIFO (0) from the ring (1):
+//-----------------------------------------------------------------------------
+
+static void *producer(void *arg)
+
+{
+    unsigned long i;
+
+    for(i=1; i<=items; i++)
+
+    {
+        if(arg == NULL) old_push((void *)i);
+        else while(bb_fifo_push(&ring, (void *)i) < 0) sched_yield();
+    }
+
+    return NULL;
+}
+
+static void *consumer(void *arg)
+
+{
+    while((arg == NULL ? old_pop() : bb_fifo_wait(&ring)) != STOP);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// run: items/s through n producers and m consumers.
+//-----------------------------------------------------------------------------
+
+static double run(int lf, int n, int m)
+
+{
+    pthread_t pt[MAX_THREADS], ct[MAX_THREADS];
+    struct timespec t0, t1;
+    void *arg = lf ? &ring : NULL;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(i=0; i<m; i++) pthread_create(&ct[i], NULL, consumer, arg);
+    for(i=0; i<n; i++) pthread_create(&pt[i], NULL, producer, arg);
+    for(i=0; i<n; i++) pthread_join(pt[i], NULL);
+
+    for(i=0; i<m; i++)
+
+    {
+        if(!lf) old_push(STOP);
+        else while(bb_fifo_push(&ring, STOP) < 0) sched_yield();
+    }
+
+    for(i=0; i<m; i++) pthread_join(ct[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return n * items / ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    static const int np[] = { 1, 2, 4, 8 }, nm[] = { 1, 4, 16 };
+    double a, b;
+    int i, j;
+
+    items = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    if((cap = cua = calloc(1, sizeof(NODE))) == NULL || bb_fifo_new(&ring, 4096) < 0){perror("fifo"); return 1;}
+
+    printf("%-12s %14s %14s %8s\n", "producers x consumers", "old (items/s)", "ring (items/s)", "speedup");
+
+    for(i=0; i<sizeof(np)/sizeof(np[0]); i++)
+    for(j=0; j<sizeof(nm)/sizeof(nm[0]); j++)
+
+    {
+        a = run(0, np[i], nm[j]);
+        b = run(1, np[i], nm[j]);
+        printf("%10d x %-10d %14.0f %14.0f %7.2fx\n", np[i], nm[j], a, b, b / a);
+    }
+
+    bb_fifo_free(&ring);
+    free(cap);
+    return 0;
+}
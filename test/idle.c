@@ -0,0 +1,274 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//-----------------------------------------------------------------------------
+// Idle connection reaping test, driven by test/idle.sh. Opens conns
+// connections: half never send a byte (header timeout), half send one
+// request, read the answer and go quiet (keep-alive idle timeout). bb must
+// close every one secs after it went quiet as the kernel saw it, within the
+// timer resolution and how late we see the close, while its CPU stays flat between the last connect and the first close
+// (with -P, from /proc). Connections come from 127.0.0.2 on, 20000 per
+// source address, so the ephemeral ports last.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MyDBG(x) do {fprintf(stderr, "(%d) %s:%d\n", errno, __FILE__, __LINE__); goto x;} while (0)
+
+#define PENDING 512        // Connects in flight at most.
+#define PER_ADDR 20000     // Connections per source address.
+#define EVENTS 1024        // Max epoll events per round.
+#define EARLY 200          // Closing this many ms early is a failure.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _CONN
+
+{
+    int fd;                  // Socket, -1 once closed.
+    int talk;                // Sends a request first.
+    int up;                  // Connected.
+    unsigned long t0;        // Went quiet (ns), 0 not yet.
+}
+
+CONN, *PCONN;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static const char req[] = "GET / HTTP/1.1\r\nHost: bb\r\n\r\n";
+
+//-----------------------------------------------------------------------------
+// now: monotonic ns.
+//-----------------------------------------------------------------------------
+
+unsigned long now(void)
+
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// cpu: seconds of CPU pid used so far, -1 if unknown.
+//-----------------------------------------------------------------------------
+
+double cpu(int pid)
+
+{
+    char path[64], buff[1024], *p;
+    unsigned long ut, st;
+    FILE *f;
+    int n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if(pid <= 0 || (f = fopen(path, "r")) == NULL) return -1;
+    n = fread(buff, 1, sizeof(buff) - 1, f);
+    fclose(f);
+    buff[n > 0 ? n : 0] = '\0';
+
+    // Fields 14 and 15 (utime, stime), counted after the ")" of the name:
+    if((p = strrchr(buff, ')')) == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st) != 2) return -1;
+    return (double)(ut + st) / sysconf(_SC_CLK_TCK);
+}
+
+//-----------------------------------------------------------------------------
+// quiet: when the last ack (the handshake's) or data came in on fd, from
+// the kernel: this process may see it much later, bb as busy as it is.
+//-----------------------------------------------------------------------------
+
+unsigned long quiet(int fd, int data, unsigned long t)
+
+{
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) return t;
+    return t - (unsigned long)(data ? ti.tcpi_last_data_recv : ti.tcpi_last_ack_recv) * 1000000UL;
+}
+
+//-----------------------------------------------------------------------------
+// dial: connect c from the source address for connection i.
+//-----------------------------------------------------------------------------
+
+int dial(int epfd, PCONN c, int i, struct sockaddr_in *dst)
+
+{
+    int one = 1;
+    struct sockaddr_in src = { .sin_family = AF_INET };
+    struct epoll_event ev;
+
+    if((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) return -1;
+    setsockopt(c->fd, SOL_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    src.sin_addr.s_addr = htonl(0x7f000002 + i / PER_ADDR);
+    if(bind(c->fd, (struct sockaddr *)&src, sizeof(src)) < 0) goto end0;
+    if(connect(c->fd, (struct sockaddr *)dst, sizeof(*dst)) < 0 && errno != EINPROGRESS) goto end0;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) goto end0;
+    c->talk = i & 1;
+    return 0;
+
+    // Return on error:
+    end0: close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// cmp: for qsort().
+//-----------------------------------------------------------------------------
+
+int cmp(const void *a, const void *b)
+
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    int i, n, k, epfd, conns = 100000, secs = 10, late = 1000, pid = 0, opened = 0, pending = 0, left, early = 0, lost = 0;
+    double util = 10, c0 = -1, c1 = -1, idle = -1;
+    unsigned long t, t0 = now(), tc = 0, tr = 0, end;
+    char *host = "127.0.0.1", buff[4096];
+    struct epoll_event ev[EVENTS];
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(8080) };
+    long *d = NULL;
+    PCONN c, conn;
+
+    // Parse command line options:
+    while((i = getopt(argc, argv, "a:p:c:T:L:P:U:")) != -1)
+
+    {
+        switch(i)
+
+        {
+            case 'a': host = optarg;
+                      break;
+            case 'p': dst.sin_port = htons(atoi(optarg));
+                      break;
+            case 'c': conns = atoi(optarg);
+                      break;
+            case 'T': secs = atoi(optarg);
+                      break;
+            case 'L': late = atoi(optarg);
+                      break;
+            case 'P': pid = atoi(optarg);
+                      break;
+            case 'U': util = atof(optarg);
+                      break;
+            default:  fprintf(stderr, "usage: %s [-a host] [-p port] [-c conns] [-T timeout secs] [-L late ms] [-P bb pid] [-U max idle cpu %%]\n", argv[0]);
+                      return 1;
+        }
+    }
+
+    if(inet_pton(AF_INET, host, &dst.sin_addr) != 1) MyDBG(end0);
+    if((conn = calloc(conns, sizeof(CONN))) == NULL || (d = calloc(conns, sizeof(long))) == NULL) MyDBG(end0);
+    if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) MyDBG(end0);
+    for(i=0; i<conns; i++) conn[i].fd = -1;
+
+    // Connect (PENDING at a time) and wait for every close, or give up
+    // well after the last one was due:
+    for(left=conns, end=now()+(secs+60)*1000000000UL; left > 0 && (t = now()) < end; )
+
+    {
+        while(opened < conns && pending < PENDING){if(dial(epfd, &conn[opened], opened, &dst) < 0){MyDBG(end1);} opened++; pending++;}
+        if(opened == conns && pending == 0 && tc == 0){tc = t; c0 = cpu(pid); end = t + (secs + 10) * 1000000000UL;}
+        if((n = epoll_wait(epfd, ev, EVENTS, 100)) < 0){if(errno == EINTR){continue;} MyDBG(end1);}
+
+        for(i=0, t=now(); i<n; i++)
+
+        {
+            c = ev[i].data.ptr;
+
+            // Connected, the talking ones ask:
+            if(!c->up && (ev[i].events & EPOLLOUT))
+
+            {
+                c->up = 1; pending--;
+                if(!c->talk) c->t0 = quiet(c->fd, 0, t);
+                else if(write(c->fd, req, sizeof(req) - 1) != sizeof(req) - 1){MyDBG(end1);}
+            }
+
+            if(!(ev[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))) continue;
+
+            // The answer starts the quiet time, the end of file ends it:
+            while((k = read(c->fd, buff, sizeof(buff))) > 0) c->t0 = quiet(c->fd, 1, t);
+            if(k < 0 && errno == EAGAIN) continue;
+
+            if(c->up && c->t0 == 0 && c->talk) lost++;
+            if(!c->up){pending--; lost++;}
+            if(tr == 0){tr = t; c1 = cpu(pid);}
+            d[conns - left] = c->t0 ? ((long)t - (long)c->t0) / 1000000 - secs * 1000L : -secs * 1000L;
+            if(d[conns - left] < -EARLY) early++;
+            close(c->fd); c->fd = -1; left--;
+        }
+    }
+
+    // Lateness percentiles of what was reaped:
+    n = conns - left;
+    qsort(d, n, sizeof(long), cmp);
+    if(tc && tr > tc && c0 >= 0 && c1 >= 0) idle = 100 * (c1 - c0) / ((tr - tc) / 1e9);
+
+    printf("idle: %d connections in %.1fs, %d reaped (%d early, %d lost), lateness ms min %ld p50 %ld p99 %ld max %ld, bb cpu %.1f%% between the last connect and the first close\n",
+           conns, ((tc ? tc : now()) - t0) / 1e9, n, early, lost, n ? d[0] : 0, n ? d[n / 2] : 0, n ? d[(long)n * 99 / 100] : 0, n ? d[n - 1] : 0, idle);
+
+    k = left == 0 && early == 0 && lost == 0 && n && d[n - 1] <= late;
+    if(pid && idle < 0){fprintf(stderr, "no quiet time to measure, raise -T\n"); k = 0;}
+    if(pid && idle > util){fprintf(stderr, "bb cpu %.1f%% over %.1f%% while idle\n", idle, util); k = 0;}
+    return !k;
+
+    // Return on error:
+    end1: close(epfd);
+    end0: return 1;
+}
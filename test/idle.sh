@@ -0,0 +1,81 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# Idle connection reaping check: bin/bb runs with header and idle timeouts
+# of SECS, bin/idle_test opens CONNS connections that go quiet (half before
+# sending anything, half after one request) and checks bb closes each one on
+# time, with its CPU flat while they all sit there:
+#
+#   make test    (or ./test/idle.sh [conns] [secs] once built)
+#
+# Both processes need CONNS descriptors, the count is cut to what the hard
+# limit (ulimit -Hn) allows.
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+CONNS=${1:-100000}   # Idle connections.
+SECS=${2:-10}        # Header and idle timeouts, longer than connecting takes.
+PORT=8080            # bb listens here.
+
+MODES=(
+  ""
+  "--mode=per-core"
+)
+
+[ -x bin/bb ] && [ -x bin/idle_test ] || { echo "run make test" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+hard=$(ulimit -Hn)
+if [ "$hard" != unlimited ] && [ $((CONNS + 1024)) -gt "$hard" ]; then
+  echo "descriptors limited to $hard, $((hard - 1024)) connections instead of $CONNS" >&2
+  CONNS=$((hard - 1024))
+fi
+ulimit -n $((CONNS + 1024)) || exit 1
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+fail=0
+for opts in "${MODES[@]}"; do
+
+  # bb daemonizes, wait for its listener:
+  ./bin/bb $opts --header-timeout="$SECS" --idle-timeout="$SECS" --max-connections=$((CONNS + 1024)) || { echo "$opts: bb failed to start" >&2; fail=1; continue; }
+  for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+  pid=$(pgrep -n -x bb)
+
+  echo "${opts:-shared}:" >&2
+  ./bin/idle_test -c "$CONNS" -T "$SECS" -P "$pid" || fail=1
+
+  kill "$pid" 2>/dev/null
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+done
+
+[ "$fail" = 0 ] || { echo "FAIL" >&2; exit 1; }
+echo "PASS" >&2
@@ -0,0 +1,90 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# Steady-state allocation check: bin/bb runs with bin/bb_malloc.so preloaded,
+# which counts every malloc(), calloc(), realloc()... in a shared file. After
+# a warm-up load (connections, buffers and threads made once), a second one
+# with pipelining and connection churn must not allocate at all:
+#
+#   make test    (or ./test/malloc.sh [secs] once built)
+#
+# Modes go with a fixed --data-threads: growing the crew allocates a thread.
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+SECS=${1:-2}   # Measured load duration.
+PORT=8080      # bb listens here.
+WWW=${TMPDIR:-/tmp}/bb-test-www.$$
+CNT=${TMPDIR:-/tmp}/bb-test-mallocs.$$
+
+MODES=(
+  "--data-threads=8"
+  "--mode=per-core"
+  "--mode=steal --data-threads=8"
+  "--mode=per-core --engine=uring"
+  "--mode=per-core --zerocopy=1024 --cork"
+  "--mode=per-core --handler=static:$WWW|-u /small.html"
+  "--data-threads=8 --handler=static:$WWW|-u /large.bin -c 8"
+)
+
+[ -x bin/bb ] && [ -x bin/bb_load ] && [ -f bin/bb_malloc.so ] || { echo "run make test" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+mkdir -p "$WWW" && trap 'rm -rf "$WWW" "$CNT"' EXIT
+head -c 4096 /dev/urandom | base64 -w 76 | head -c 4096 > "$WWW/small.html"
+head -c 1M /dev/zero > "$WWW/large.bin"
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+fail=0
+for m in "${MODES[@]}"; do
+  IFS='|' read -r opts load <<< "$m"
+  rm -f "$CNT"
+
+  # bb daemonizes, wait for its listener:
+  BB_MALLOCS=$CNT LD_PRELOAD=$PWD/bin/bb_malloc.so ./bin/bb $opts || { echo "$opts: bb failed to start" >&2; fail=1; continue; }
+  for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+  pid=$(pgrep -n -x bb)
+
+  ./bin/bb_load -c 50 -k 10 -T 1 $load > /dev/null
+  a=$(od -An -tu8 "$CNT")
+  reqs=$(./bin/bb_load -c 50 -d 4 -k 10 -T "$SECS" $load | sed -n 's/.*"requests":\([0-9]*\).*/\1/p')
+  b=$(od -An -tu8 "$CNT")
+
+  kill "$pid" 2>/dev/null
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+
+  echo "$opts: $((b - a)) allocations in ${reqs:-0} requests" >&2
+  [ "${reqs:-0}" -gt 0 ] && [ "$b" = "$a" ] || fail=1
+done
+
+[ "$fail" = 0 ] || { echo "FAIL" >&2; exit 1; }
+echo "PASS" >&2
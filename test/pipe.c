@@ -0,0 +1,166 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//-----------------------------------------------------------------------------
+// Pipelined large responses to a slow reader, driven by test/pipe.sh. One
+// connection with a tiny receive buffer sends n GETs for the same file at
+// once and reads the answers a little at a time: bb has to hold the
+// requests it can not answer yet, not drop the client, and every body must
+// match the local copy of the file (-f).
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MyDBG(x) do {fprintf(stderr, "(%d) %s:%d\n", errno, __FILE__, __LINE__); goto x;} while (0)
+
+#define STALL 10000        // No byte for this many ms is a failure.
+#define HEAD_MAX 4096      // Response header bytes at most.
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    // Initializations:
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(8080) };
+    char *host = "127.0.0.1", *path = "/big.bin", *file = NULL;
+    int i, k, n, fd, reqs = 12, rcvbuf = 4096, delay = 200;
+    char buff[4096], head[HEAD_MAX], *req, *data, *p;
+    long hlen = 0, blen = -1, boff = 0, got = 0, bad = 0;
+    unsigned long bytes = 0;
+    struct pollfd pfd;
+    struct stat st;
+
+    while((i = getopt(argc, argv, "a:p:n:u:f:r:d:")) != -1)
+
+    {
+        switch(i)
+
+        {
+            case 'a': host = optarg;
+                      break;
+            case 'p': dst.sin_port = htons(atoi(optarg));
+                      break;
+            case 'n': reqs = atoi(optarg);
+                      break;
+            case 'u': path = optarg;
+                      break;
+            case 'f': file = optarg;
+                      break;
+            case 'r': rcvbuf = atoi(optarg);
+                      break;
+            case 'd': delay = atoi(optarg);
+                      break;
+            default:  fprintf(stderr, "usage: %s [-a host] [-p port] [-n requests] [-u path] -f file [-r rcvbuf] [-d us]\n", argv[0]);
+                      return 1;
+        }
+    }
+
+    // The file as it should come:
+    if(file == NULL || (fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) MyDBG(end0);
+    if((data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) MyDBG(end0);
+    close(fd);
+
+    // All the requests at once:
+    n = snprintf(buff, sizeof(buff), "GET %s HTTP/1.1\r\nHost: bb\r\n\r\n", path);
+    if((req = malloc(n * reqs)) == NULL) MyDBG(end0);
+    for(i=0; i<reqs; i++) memcpy(req + i * n, buff, n);
+
+    // A receive buffer set before connecting keeps the window small:
+    if(inet_pton(AF_INET, host, &dst.sin_addr) != 1) MyDBG(end0);
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) MyDBG(end0);
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) MyDBG(end0);
+    if(connect(fd, (struct sockaddr *)&dst, sizeof(dst)) < 0) MyDBG(end0);
+    if(write(fd, req, n * reqs) != n * reqs) MyDBG(end0);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while(got < reqs)
+
+    {
+        if(poll(&pfd, 1, STALL) <= 0){fprintf(stderr, "pipe: stalled\n"); break;}
+        if((n = read(fd, buff, sizeof(buff))) <= 0){fprintf(stderr, "pipe: %s\n", n == 0 ? "EOF" : strerror(errno)); break;}
+        bytes += n;
+
+        for(i=0; i<n;)
+
+        {
+            // Header, byte by byte up to the blank line:
+            if(blen < 0)
+
+            {
+                if(hlen == HEAD_MAX - 1){fprintf(stderr, "pipe: header too long\n"); goto done;}
+                head[hlen++] = buff[i++];
+                if(hlen < 4 || memcmp(head + hlen - 4, "\r\n\r\n", 4)) continue;
+                head[hlen] = '\0';
+                if(strncmp(head, "HTTP/1.1 200 ", 13) || (p = strcasestr(head, "\r\nContent-Length:")) == NULL){fprintf(stderr, "pipe: %.*s\n", (int)strcspn(head, "\r"), head); goto done;}
+                blen = strtol(p + 17, NULL, 10);
+                if(blen != st.st_size){fprintf(stderr, "pipe: %ld bytes instead of %ld\n", blen, (long)st.st_size); goto done;}
+                boff = hlen = 0;
+            }
+
+            // Body, checked against the file:
+            else
+
+            {
+                k = n - i < blen - boff ? n - i : blen - boff;
+                if(memcmp(buff + i, data + boff, k)) bad++;
+                boff += k;
+                i += k;
+            }
+
+            if(blen >= 0 && boff == blen){got++; blen = -1;}
+        }
+
+        if(delay) usleep(delay);
+    }
+
+    // Return:
+    done: printf("pipe: %d requests for %ld bytes: %ld answered, %ld corrupt, %lu bytes read\n", reqs, (long)st.st_size, got, bad, bytes);
+    return got == reqs && bad == 0 ? 0 : 1;
+
+    // Return on error:
+    end0: return 1;
+}
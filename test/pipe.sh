@@ -0,0 +1,79 @@
+#!/bin/bash
+
+#------------------------------------------------------------------------------
+# Copyright (C) 2011 Marc Villacorta Morera
+#
+# Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+#
+# This file is part of BlackBird.
+#
+# BlackBird is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# BlackBird is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+#------------------------------------------------------------------------------
+
+#------------------------------------------------------------------------------
+# Pipelining check: bin/bb serves static files, bin/pipe_test sends a batch
+# of GETs at once on one connection with a tiny receive buffer and reads
+# slowly. Every response has to come, whole: bb holds the requests it has no
+# room to answer instead of dropping the client:
+#
+#   make test    (or ./test/pipe.sh [requests] once built)
+#------------------------------------------------------------------------------
+
+cd "$(dirname "$0")/.." || exit 1
+
+REQS=${1:-40}   # Pipelined requests for the large file.
+PORT=8080       # bb listens here.
+WWW=${TMPDIR:-/tmp}/bb-test-www.$$
+
+MODES=(
+  ""
+  "--mode=per-core"
+  "--mode=steal"
+  "--mode=per-core --engine=uring"
+  "--mode=per-core --zerocopy=1024"
+)
+
+[ -x bin/bb ] && [ -x bin/pipe_test ] || { echo "run make test" >&2; exit 1; }
+
+if ss -Hltn "sport = :$PORT" | grep -q .; then
+  echo "port $PORT is busy, stop the server first" >&2
+  exit 1
+fi
+
+mkdir -p "$WWW" && trap 'rm -rf "$WWW"' EXIT
+head -c 1M /dev/urandom > "$WWW/large.bin"
+head -c 4096 /dev/urandom > "$WWW/small.bin"
+
+#------------------------------------------------------------------------------
+# Run:
+#------------------------------------------------------------------------------
+
+fail=0
+for opts in "${MODES[@]}"; do
+
+  # bb daemonizes, wait for its listener:
+  ./bin/bb $opts --handler=static:"$WWW" || { echo "$opts: bb failed to start" >&2; fail=1; continue; }
+  for i in $(seq 50); do ss -Hltn "sport = :$PORT" | grep -q . && break; sleep 0.1; done
+  pid=$(pgrep -n -x bb)
+
+  echo "${opts:-shared}:" >&2
+  ./bin/pipe_test -n "$REQS" -u /large.bin -f "$WWW/large.bin" >&2 || fail=1
+  ./bin/pipe_test -n 2000 -u /small.bin -f "$WWW/small.bin" -d 0 >&2 || fail=1
+
+  kill "$pid" 2>/dev/null
+  while kill -0 "$pid" 2>/dev/null; do sleep 0.1; done
+done
+
+[ "$fail" = 0 ] || { echo "FAIL" >&2; exit 1; }
+echo "PASS" >&2
@@ -0,0 +1,194 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/bb_scan.c"    // The variants are static.
+
+//-----------------------------------------------------------------------------
+// Delimiter scanner unit test. Every variant this CPU runs (scalar, SSE2,
+// AVX2) must agree with a byte at a time reference on:
+//  - a delimiter at each offset of buffers up to 3 vectors long, from each
+//    start, at each alignment: matches straddling 16 and 32 byte vectors
+//    and the scalar tail,
+//  - near misses around it ("\r\n\r", "\r\r\n\n"...),
+//  - requests arriving in two reads split at every byte, resuming the scan
+//    the way the handlers do (len - 3 for CRLFCRLF),
+//  - random buffers of delimiter bytes.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Defines:
+//-----------------------------------------------------------------------------
+
+#define MAX_LEN 100      // Over 3 AVX2 vectors.
+#define RANDOM 200000    // Random buffers.
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _IMPL
+
+{
+    const char *name;
+    int (*crlf2)(const char *, int, int);
+    int (*eol)(const char *, int, int);
+    int (*chr)(const char *, int, int, char);
+}
+
+IMPL, *PIMPL;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static IMPL impl[3];
+static int nimpl;
+static unsigned long checks, fails;
+
+//-----------------------------------------------------------------------------
+// ref: byte at a time reference for the pattern p of n bytes.
+//-----------------------------------------------------------------------------
+
+static int ref(const char *b, int from, int len, const char *p, int n)
+
+{
+    int i;
+
+    for(i=from; i+n<=len; i++) if(!memcmp(b + i, p, n)) return i;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// check: every variant on b[from, len) against the reference.
+//-----------------------------------------------------------------------------
+
+static void check(const char *b, int from, int len, const char *what)
+
+{
+    int k, r[3] = { ref(b, from, len, "\r\n\r\n", 4), ref(b, from, len, "\r\n", 2), ref(b, from, len, ":", 1) }, g[3];
+
+    for(k=0; k<nimpl; k++)
+
+    {
+        g[0] = impl[k].crlf2(b, from, len);
+        g[1] = impl[k].eol(b, from, len);
+        g[2] = impl[k].chr(b, from, len, ':');
+        checks += 3;
+        if(g[0] == r[0] && g[1] == r[1] && g[2] == r[2]) continue;
+        if(fails++ < 10) fprintf(stderr, "%s: %s, from %d len %d: crlf2 %d/%d eol %d/%d chr %d/%d\n",
+                                 impl[k].name, what, from, len, g[0], r[0], g[1], r[1], g[2], r[2]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// placed: a pattern at each offset, scanned from each start and alignment.
+//-----------------------------------------------------------------------------
+
+static void placed(char *mem, const char *p, const char *what)
+
+{
+    static const int align[] = { 0, 1, 15, 31 };
+    int a, len, at, from, n = strlen(p);
+    char *b;
+
+    for(a=0; a<sizeof(align)/sizeof(align[0]); a++)
+    for(len=0, b=mem+align[a]; len<=MAX_LEN; len++)
+    for(at=0; at<=len; at++)
+
+    {
+        // Filler, then the pattern cut at the end of the buffer if it must:
+        memset(b, 'a', MAX_LEN);
+        memcpy(b + at, p, at + n <= len ? n : len - at);
+        for(from=0; from<=len; from++) check(b, from, len, what);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// reads: a request in two reads split at every byte, the CRLFCRLF scan
+// resumed as the handlers do must find it where a single read does.
+//-----------------------------------------------------------------------------
+
+static void reads(void)
+
+{
+    static const char req[] = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\n\r\n";
+    int k, cut, scan, n = sizeof(req) - 1, want = ref(req, 0, n, "\r\n\r\n", 4), got;
+
+    for(k=0; k<nimpl; k++)
+    for(cut=0; cut<=n; cut++)
+
+    {
+        // First read, not found (or found already), then the rest:
+        if((got = impl[k].crlf2(req, 0, cut)) < 0)
+
+        {
+            scan = cut > 3 ? cut - 3 : 0;
+            got = impl[k].crlf2(req, scan, n);
+        }
+
+        checks++;
+        if(got != want && fails++ < 10) fprintf(stderr, "%s: split at %d: %d, want %d\n", impl[k].name, cut, got, want);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    static const char *near[] = { "\r\n\r\n", "\r\n\r", "\r\r\n\n", "\n\r\n\r\n", "\r\n:\r\n", "\r\r\n\r\n", ":" };
+    char *mem, b[MAX_LEN + 4];
+    int i, j, len;
+
+    impl[nimpl++] = (IMPL){ "scalar", crlf2_c, eol_c, chr_c };
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) impl[nimpl++] = (IMPL){ "sse2", crlf2_sse2, eol_sse2, chr_sse2 };
+    if(__builtin_cpu_supports("avx2")) impl[nimpl++] = (IMPL){ "avx2", crlf2_avx2, eol_avx2, chr_avx2 };
+#endif
+
+    if((mem = aligned_alloc(64, 256)) == NULL) return 1;
+    for(i=0; i<sizeof(near)/sizeof(near[0]); i++) placed(mem, near[i], near[i]);
+    reads();
+
+    // Random buffers from the delimiter bytes and a filler:
+    for(srandom(1), i=0; i<RANDOM; i++)
+
+    {
+        len = random() % (MAX_LEN + 1);
+        for(j=0; j<len; j++) b[j] = "\r\n:a"[random() % 4];
+        check(b, len ? random() % len : 0, len, "random");
+    }
+
+    for(i=0; i<nimpl; i++) printf("%s%s", i ? ", " : "scan: ", impl[i].name);
+    printf(": %lu checks, %lu failed\n", checks, fails);
+    free(mem);
+    return fails != 0;
+}
@@ -0,0 +1,143 @@
+/******************************************************************************
+* Copyright (C) 2011 Marc Villacorta Morera
+*
+* Authors: Marc Villacorta Morera <marc.villacorta@gmail.com>
+*
+* This file is part of BlackBird.
+*
+* BlackBird is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* BlackBird is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with BlackBird. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+//-----------------------------------------------------------------------------
+// Includes:
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/bb_scan.c"    // The variants are static.
+
+//-----------------------------------------------------------------------------
+// Delimiter scanner microbenchmark, GB/s of request head per variant on
+// realistic sizes: "head" finds the CRLFCRLF ending it, "lines" then walks
+// its header lines and their ':' as the handlers do.
+//
+//   scan_bench [MB per run]
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Typedefs:
+//-----------------------------------------------------------------------------
+
+typedef struct _IMPL
+
+{
+    const char *name;
+    int (*crlf2)(const char *, int, int);
+    int (*eol)(const char *, int, int);
+    int (*chr)(const char *, int, int, char);
+}
+
+IMPL, *PIMPL;
+
+//-----------------------------------------------------------------------------
+// Globals:
+//-----------------------------------------------------------------------------
+
+static volatile int sink;    // Keeps the scans from being optimized out.
+
+//-----------------------------------------------------------------------------
+// head: a request with hdrs header lines of about llen bytes, into b.
+//-----------------------------------------------------------------------------
+
+static int head(char *b, int hdrs, int llen)
+
+{
+    int i, n = sprintf(b, "GET /static/app/main.js?v=1 HTTP/1.1\r\nHost: www.example.com\r\n");
+
+    for(i=0; i<hdrs; i++)
+
+    {
+        n += sprintf(b + n, "X-Header-%02d: ", i);
+        memset(b + n, 'v', llen); n += llen;
+        n += sprintf(b + n, "\r\n");
+    }
+
+    return n + sprintf(b + n, "\r\n");
+}
+
+//-----------------------------------------------------------------------------
+// run: GB/s over about mb MB of len byte heads, lines or not.
+//-----------------------------------------------------------------------------
+
+static double run(PIMPL m, const char *b, int len, int lines, int mb)
+
+{
+    struct timespec t0, t1;
+    long k, reps = (long)mb * 1000000 / len;
+    int i, j, e, x = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for(k=0; k<reps; k++)
+
+    {
+        e = m->crlf2(b, 0, len);
+        if(lines) for(j=0; (i = m->eol(b, j, e + 2)) > j; j=i+2) x += m->chr(b, j, i, ':');
+        x += e;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sink = x;
+    return reps * len / ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec));
+}
+
+//-----------------------------------------------------------------------------
+// Entry point:
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+
+{
+    static const struct {const char *name; int hdrs, llen;} size[] = {
+    { "curl (~100B)",      1,  10 },
+    { "browser (~600B)",  10,  40 },
+    { "cookies (~2KB)",   12, 150 },
+    { "large (~8KB)",     40, 190 }};
+
+    IMPL impl[3];
+    char b[16384];
+    int i, k, n, len, mb = argc > 1 ? atoi(argv[1]) : 500;
+
+    n = 0;
+    impl[n++] = (IMPL){ "scalar", crlf2_c, eol_c, chr_c };
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) impl[n++] = (IMPL){ "sse2", crlf2_sse2, eol_sse2, chr_sse2 };
+    if(__builtin_cpu_supports("avx2")) impl[n++] = (IMPL){ "avx2", crlf2_avx2, eol_avx2, chr_avx2 };
+#endif
+
+    printf("%-18s %6s %-8s %10s %10s\n", "request", "bytes", "variant", "head GB/s", "lines GB/s");
+
+    for(i=0; i<sizeof(size)/sizeof(size[0]); i++)
+
+    {
+        len = head(b, size[i].hdrs, size[i].llen);
+        for(k=0; k<n; k++) printf("%-18s %6d %-8s %10.2f %10.2f\n", k ? "" : size[i].name, len, impl[k].name,
+                                   run(&impl[k], b, len, 0, mb), run(&impl[k], b, len, 1, mb));
+    }
+
+    return 0;
+}